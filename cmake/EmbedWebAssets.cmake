@@ -0,0 +1,135 @@
+# Generates a header embedding the web page resources as constant data, so
+# they are served straight from flash. Run in script mode:
+#
+#   cmake -DRESOURCE_DIR=<dir> -DINDEX_PAGE=<file> -DMAX_AGE=<seconds> -DOUTPUT=<header> -P EmbedWebAssets.cmake
+#
+# Every .html, .js and .css file in RESOURCE_DIR is served at /<file name>,
+# except INDEX_PAGE which is served at /index.html. Each file is minified and
+# stored both as is and gzip compressed, as complete HTTP responses with an
+# ETag from the content hash, along with the matching 304 responses. Pages
+# are revalidated on every load, scripts and stylesheets are cached for
+# MAX_AGE seconds. The asset table is sorted by path for FindAsset's binary
+# search.
+
+get_filename_component(RESOURCE_DIR ${RESOURCE_DIR} ABSOLUTE)
+get_filename_component(WORK_DIR ${OUTPUT} DIRECTORY)
+set(WORK_DIR ${WORK_DIR}/web)
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+file(GLOB resources RELATIVE ${RESOURCE_DIR}
+     ${RESOURCE_DIR}/*.html ${RESOURCE_DIR}/*.js ${RESOURCE_DIR}/*.css)
+
+set(paths "")
+foreach(resource ${resources})
+  if(resource STREQUAL INDEX_PAGE)
+    set(path "/index.html")
+  else()
+    set(path "/${resource}")
+  endif()
+
+  list(APPEND paths ${path})
+  set(resource_for_${path} ${resource})
+endforeach()
+
+list(SORT paths)
+
+# Removes indentation, trailing spaces and blank lines, and for stylesheets
+# the source map comment. Line breaks are kept so no tokens are joined.
+function(minify resource output)
+  file(READ ${RESOURCE_DIR}/${resource} content)
+  string(REGEX REPLACE "\r" "" content "${content}")
+  string(REGEX REPLACE "\n[ \t]+" "\n" content "${content}")
+  string(REGEX REPLACE "[ \t]+\n" "\n" content "${content}")
+  string(REGEX REPLACE "\n\n+" "\n" content "${content}")
+  if(resource MATCHES "\\.css$")
+    string(REGEX REPLACE "/\\*# sourceMappingURL=[^*]*\\*/" "" content "${content}")
+  endif()
+
+  string(STRIP "${content}" content)
+  file(WRITE ${output} "${content}\n")
+endfunction()
+
+# Appends a C array named symbol holding an HTTP response for the body in
+# file to the data variable, along with <symbol>_304 holding the not
+# modified response, and sets <symbol>_variant to the table entry.
+function(append_response symbol file content_type encoding etag cache_control)
+  file(READ ${file} body HEX)
+  string(LENGTH "${body}" length)
+  math(EXPR length "${length} / 2")
+
+  set(validators "ETag: \"${etag}\"\r\nCache-Control: ${cache_control}\r\n")
+  set(header "HTTP/1.0 200 OK\r\nContent-Type: ${content_type}\r\nContent-Length: ${length}\r\n${validators}")
+  if(encoding)
+    string(APPEND header "Content-Encoding: ${encoding}\r\n")
+  endif()
+  string(APPEND header "Vary: Accept-Encoding\r\n\r\n")
+  string(HEX "${header}" header_hex)
+
+  set(content "${header_hex}${body}")
+  string(LENGTH "${content}" total)
+  math(EXPR total "${total} / 2")
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," content "${content}")
+  string(REGEX REPLACE "((0x[0-9a-f][0-9a-f],){16})" "\\1\n   " content "${content}")
+
+  # The C string form of the 304 response.
+  set(not_modified "HTTP/1.0 304 Not Modified\r\n${validators}\r\n")
+  string(REPLACE "\"" "\\\"" not_modified "${not_modified}")
+  string(REPLACE "\r\n" "\\r\\n" not_modified "${not_modified}")
+
+  set(data "${data}static const uint8_t ${symbol}[] = {\n   ${content}};\n\nstatic const char ${symbol}_304[] = \"${not_modified}\";\n\n" PARENT_SCOPE)
+  set(${symbol}_variant "{(const char *)${symbol}, ${total}, ${symbol}_304, sizeof(${symbol}_304) - 1, \"\\\"${etag}\\\"\"}" PARENT_SCOPE)
+endfunction()
+
+set(data "")
+set(table "")
+foreach(path ${paths})
+  set(resource ${resource_for_${path}})
+  string(MAKE_C_IDENTIFIER "asset_${resource}" symbol)
+
+  set(cache_control "max-age=${MAX_AGE}")
+  if(resource MATCHES "\\.html$")
+    set(content_type "text/html")
+    set(cache_control "no-cache")
+  elseif(resource MATCHES "\\.js$")
+    set(content_type "application/javascript")
+  else()
+    set(content_type "text/css")
+  endif()
+
+  set(minified ${WORK_DIR}/${resource})
+  minify(${resource} ${minified})
+  file(ARCHIVE_CREATE OUTPUT ${minified}.gz PATHS ${minified} FORMAT raw COMPRESSION GZip COMPRESSION_LEVEL 9)
+
+  file(SIZE ${RESOURCE_DIR}/${resource} original_size)
+  file(SIZE ${minified} minified_size)
+  file(SIZE ${minified}.gz gzip_size)
+
+  file(SHA1 ${minified} hash)
+  string(SUBSTRING ${hash} 0 16 etag)
+
+  string(APPEND data "// ${resource}\n")
+  append_response(${symbol} ${minified} ${content_type} "" ${etag} ${cache_control})
+  if(gzip_size LESS minified_size)
+    append_response(${symbol}_gz ${minified}.gz ${content_type} gzip ${etag}-gz ${cache_control})
+    set(gzip_symbol ${symbol}_gz)
+    set(served_size ${gzip_size})
+  else()
+    # Not worth compressing, send the minified response to every client.
+    set(gzip_symbol ${symbol})
+    set(served_size ${minified_size})
+  endif()
+
+  math(EXPR saved "100 - 100 * ${served_size} / ${original_size}")
+  message(STATUS "${path}: ${original_size} bytes, minified ${minified_size}, gzip ${gzip_size}, ${saved}% smaller")
+
+  string(APPEND table "   {\"${path}\",\n    ${${symbol}_variant},\n    ${${gzip_symbol}_variant}},\n")
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+  "// Generated by cmake/EmbedWebAssets.cmake from resources/. Do not edit.\n\n"
+  "${data}"
+  "static const zuluide::web::Asset assets[] = {\n${table}};\n")
+
+# Only touch the header when it changes so dependent files are not rebuilt.
+file(COPY_FILE ${OUTPUT}.tmp ${OUTPUT} ONLY_IF_DIFFERENT)
+file(REMOVE ${OUTPUT}.tmp)
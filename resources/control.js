@@ -1,12 +1,10 @@
-var timer;
+var statusSeq = -1;
 function showStatus() {
  document.getElementById('si').setAttribute('class', 'hdn');
  document.getElementById('st').removeAttribute('class');
  setTimeout(refresh, 1500);
 }
 function onload() {
- let elm = document.getElementById('ar');
- elm.checked = false;
  setTimeout(refresh, 1500);
 }
 function ejectClk() {
@@ -25,11 +23,13 @@ function updateStatus(status) {
  elm = document.getElementById('img');
  elm.innerHTML = status.image ? status.image.filename : '';
 }
-function autoRefresh() {
- let elm = document.getElementById('ar');
- if (elm.checked) {
-  timer = setInterval(refresh, 45000);
- } else if (timer) {
-  clearTimeout(timer);
- }
+function watchStatus() {
+ fetch('status?since=' + statusSeq)
+  .then(response => {
+   statusSeq = response.headers.get('X-Status-Sequence') || -1;
+   return response.json();
+  })
+  .then(status => { updateStatus(status); watchStatus(); })
+  .catch(() => setTimeout(watchStatus, 1500));
 }
+watchStatus();
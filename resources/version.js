@@ -15,6 +15,9 @@ function updateVersion(version) {
     elm = document.getElementById('sav');
     if (version.serverAPIVersion)
      elm.innerHTML = version.serverAPIVersion;
+    elm = document.getElementById('bus');
+    if (version.i2cBaudrate)
+     elm.innerHTML = (version.i2cBaudrate / 1000) + ' kHz, ' + version.i2cThroughput + ' bytes/s';
     if (version.message)
     {
      elm = document.getElementById('avm');
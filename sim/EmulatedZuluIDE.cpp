@@ -0,0 +1,354 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "EmulatedZuluIDE.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "SimBus.h"
+#include "ZuluControlI2CClient.h"
+
+namespace sim {
+
+EmulatedZuluIDE::EmulatedZuluIDE(const ServerConfig& config)
+    : config(config),
+      readState(ReadState::Idle),
+      readLength(0),
+      lastPollEmpty(false),
+      wroteLast(false),
+      subscribed(false),
+      iterator(0),
+      cardChanged(false),
+      nextImage(0),
+      clientDiffs(false),
+      catalogGeneration(1),
+      historyStart(1),
+      polls(0),
+      writes(0),
+      corrupted() {
+}
+
+void EmulatedZuluIDE::Send(uint8_t command, const std::string& payload) {
+   pending.push_back({command, payload, 0, false});
+}
+
+void EmulatedZuluIDE::PushStatus() {
+   if (subscribed) {
+      Send(I2C_SERVER_SYSTEM_STATUS_JSON, StatusRecord());
+   }
+}
+
+bool EmulatedZuluIDE::TakeWritten(BusMessage* message) {
+   // Corrupted messages never reach the client.
+   while (!written.empty() && written.front().corrupted) {
+      written.pop_front();
+   }
+
+   if (written.empty()) {
+      return false;
+   }
+
+   *message = written.front();
+   written.pop_front();
+   return true;
+}
+
+bool EmulatedZuluIDE::IsQuiet() const {
+   return pending.empty() && readState == ReadState::Idle && lastPollEmpty;
+}
+
+std::string EmulatedZuluIDE::ImageName(unsigned int index) const {
+   char name[32];
+   snprintf(name, sizeof(name), " %05u.iso", index);
+   std::string filename(config.nameLength > 10 ? config.nameLength - 10 : 0, 'A' + index % 26);
+   return filename + name;
+}
+
+std::string EmulatedZuluIDE::ImageRecord(unsigned int index) const {
+   return "{\"filename\":\"" + ImageName(index) + "\",\"size\":" + std::to_string(681574400u - index * 2048u) + "}";
+}
+
+std::vector<unsigned int>& EmulatedZuluIDE::Card() {
+   if (!cardChanged) {
+      for (unsigned int i = 0; i < config.catalogSize; i++) {
+         cardImages.push_back(i);
+      }
+
+      nextImage = config.catalogSize;
+      cardChanged = true;
+   }
+
+   return cardImages;
+}
+
+void EmulatedZuluIDE::RecordChange(const std::string& change) {
+   history.push_back({++catalogGeneration, change});
+
+   // Like the ZuluIDE, only keep enough history to diff from recent generations.
+   while (history.size() > 256) {
+      historyStart = history.front().first;
+      history.pop_front();
+   }
+}
+
+void EmulatedZuluIDE::AnnounceCatalog() {
+   config.catalogSize = cardImages.size();
+   if (clientDiffs) {
+      Send(I2C_SERVER_CATALOG_DIFF, "?" + std::to_string(catalogGeneration));
+   }
+}
+
+void EmulatedZuluIDE::AddImages(unsigned int count) {
+   std::vector<unsigned int>& card = Card();
+   for (unsigned int i = 0; i < count; i++) {
+      card.push_back(nextImage);
+      RecordChange("+" + ImageRecord(nextImage++));
+   }
+
+   AnnounceCatalog();
+}
+
+void EmulatedZuluIDE::RemoveImages(unsigned int count) {
+   std::vector<unsigned int>& card = Card();
+   count = std::min(count, (unsigned int)card.size());
+   if (count == 0) {
+      return;
+   }
+
+   // Back to front so the positions still to remove do not move.
+   size_t step = card.size() / count;
+   for (size_t k = count; k-- > 0;) {
+      size_t position = k * step + step / 2;
+      RecordChange("-" + ImageName(card[position]));
+      card.erase(card.begin() + position);
+   }
+
+   AnnounceCatalog();
+}
+
+void EmulatedZuluIDE::SendCatalogDiff(const std::string& since) {
+   uint32_t generation = since.empty() ? 0 : strtoul(since.c_str(), NULL, 10);
+   std::string current = std::to_string(catalogGeneration);
+   if (since.empty() || generation < historyStart || generation > catalogGeneration) {
+      // Too old to diff from, send every record.
+      Send(I2C_SERVER_CATALOG_DIFF, "*" + current);
+      for (unsigned int i = 0; i < config.catalogSize; i++) {
+         Send(I2C_SERVER_CATALOG_DIFF, "+" + ImageRecord(ImageAt(i)));
+      }
+   } else {
+      for (const auto& change : history) {
+         if (change.first > generation) {
+            Send(I2C_SERVER_CATALOG_DIFF, change.second);
+         }
+      }
+   }
+
+   Send(I2C_SERVER_CATALOG_DIFF, "=" + current);
+}
+
+std::string EmulatedZuluIDE::StatusRecord() const {
+   std::string status = "{\"isPrimary\":true,\"type\":\"cdrom\",\"image\":";
+   if (loadedImage.empty()) {
+      status += "null";
+   } else {
+      status += "{\"filename\":\"" + loadedImage + "\"}";
+   }
+
+   return status + "}";
+}
+
+void EmulatedZuluIDE::Step() {
+   // Poll the client between writes so its requests are not starved.
+   if (readState == ReadState::Idle && !pending.empty() && !wroteLast) {
+      wroteLast = true;
+      BusMessage message = pending.front();
+      std::string frame;
+      frame.push_back((char)message.command);
+      frame.push_back((char)(message.payload.length() >> 8));
+      frame.push_back((char)message.payload.length());
+      frame += message.payload;
+
+      message.startNs = BusNowNs();
+      bool noisy = config.noisyAboveHz > 0 && BusGetClock() > config.noisyAboveHz;
+      if (noisy && (writes + 1) % 4 == 0) {
+         // A glitch in the length makes the client discard the frame.
+         frame[1] = (char)0xFF;
+         message.corrupted = true;
+      }
+
+      if (!BusWrite((const uint8_t*)frame.data(), frame.length())) {
+         // The client is busy, write the message again later.
+         return;
+      }
+
+      writes += noisy ? 1 : 0;
+      if (message.corrupted) {
+         corrupted[message.command]++;
+      }
+
+      pending.pop_front();
+      written.push_back(message);
+      return;
+   }
+
+   wroteLast = false;
+   switch (readState) {
+      case ReadState::Idle: {
+         uint8_t command = I2C_CLIENT_NOOP;
+         polls++;
+         uint64_t startNs = BusNowNs();
+         if (BusRead(&command, 1) < 0) {
+            // The client is busy, poll again later.
+            lastPollEmpty = false;
+            break;
+         }
+
+         lastPollEmpty = command == I2C_CLIENT_NOOP;
+         if (!lastPollEmpty) {
+            reading = {command, std::string(), startNs, false};
+            readState = ReadState::Length;
+         }
+
+         break;
+      }
+
+      case ReadState::Length: {
+         uint8_t lengthBytes[2] = {0, 0};
+         if (BusRead(lengthBytes, 2) < 0) {
+            break;
+         }
+
+         readLength = (lengthBytes[0] << 8) | lengthBytes[1];
+         if (readLength == 0) {
+            readState = ReadState::Idle;
+            HandleRequest(reading);
+         } else {
+            readState = ReadState::Payload;
+         }
+
+         break;
+      }
+
+      case ReadState::Payload: {
+         uint8_t chunk[MAX_MSG_SIZE];
+         size_t count = std::min((size_t)config.readChunk, readLength - reading.payload.length());
+         int received = BusRead(chunk, count);
+         if (received < 0) {
+            break;
+         }
+
+         reading.payload.append((const char*)chunk, received);
+         if (reading.payload.length() == readLength) {
+            readState = ReadState::Idle;
+            HandleRequest(reading);
+         }
+
+         break;
+      }
+   }
+}
+
+void EmulatedZuluIDE::HandleRequest(const BusMessage& request) {
+   if (onRequest) {
+      onRequest(request);
+   }
+
+   switch (request.command) {
+      case I2C_CLIENT_API_VERSION: {
+         // Every handshake starts from the default settings.
+         config.readChunk = BUFFER_LENGTH;
+         clientDiffs = false;
+         std::string version = config.apiVersion;
+         if (config.maxReadChunk > 0) {
+            version += ";chunk=" + std::to_string(config.maxReadChunk);
+         }
+
+         if (!config.speeds.empty()) {
+            version += ";speeds=" + config.speeds;
+         }
+
+         if (config.catalogDiffs) {
+            version += ";catalog=diff";
+         }
+
+         Send(I2C_SERVER_API_VERSION, version);
+         break;
+      }
+      case I2C_CLIENT_CAPABILITIES: {
+         size_t chunk = request.payload.find("chunk=");
+         if (chunk != std::string::npos) {
+            config.readChunk = std::stoul(request.payload.substr(chunk + sizeof("chunk=") - 1));
+         }
+
+         // Switch speed after reading the request, the client does the same.
+         size_t speed = request.payload.find("speed=");
+         if (speed != std::string::npos) {
+            BusSetClock(std::stoul(request.payload.substr(speed + sizeof("speed=") - 1)) * 1000);
+         }
+
+         clientDiffs = config.catalogDiffs && request.payload.find("catalog=diff") != std::string::npos;
+         break;
+      }
+      case I2C_CLIENT_FETCH_SSID:
+         Send(I2C_SERVER_SSID, config.ssid);
+         break;
+      case I2C_CLIENT_FETCH_SSID_PASS:
+         Send(I2C_SERVER_SSID_PASS, config.password);
+         break;
+      case I2C_CLIENT_SUBSCRIBE_STATUS_JSON:
+         subscribed = true;
+         PushStatus();
+         break;
+      case I2C_CLIENT_LOAD_IMAGE:
+         loadedImage = request.payload;
+         PushStatus();
+         break;
+      case I2C_CLIENT_EJECT_IMAGE:
+         loadedImage.clear();
+         PushStatus();
+         break;
+      case I2C_CLIENT_FETCH_IMAGES_JSON:
+         for (unsigned int i = 0; i < config.catalogSize; i++) {
+            Send(I2C_SERVER_IMAGE_JSON, ImageRecord(ImageAt(i)));
+         }
+
+         Send(I2C_SERVER_IMAGE_JSON, std::string());
+         break;
+      case I2C_CLIENT_FETCH_ITR_IMAGE:
+         if (iterator < config.catalogSize) {
+            Send(I2C_SERVER_IMAGE_JSON, ImageRecord(ImageAt(iterator++)));
+         } else {
+            iterator = 0;
+            Send(I2C_SERVER_IMAGE_JSON, std::string());
+         }
+
+         break;
+      case I2C_CLIENT_FETCH_CATALOG_DIFF:
+         SendCatalogDiff(request.payload);
+         break;
+      default:
+         break;
+   }
+}
+
+}  // namespace sim
@@ -0,0 +1,171 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef EMULATED_ZULUIDE_H
+#define EMULATED_ZULUIDE_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+   Emulates the ZuluIDE side of the I2C control protocol. The ZuluIDE is the
+   bus master: it polls the client for requests and pushes responses and
+   status updates to it.
+ */
+namespace sim {
+
+typedef struct {
+   std::string apiVersion;
+   std::string ssid;
+   std::string password;
+   // Number of images on the emulated SD card.
+   unsigned int catalogSize;
+   // Length of the generated image file names.
+   unsigned int nameLength;
+   // Number of payload bytes read from the client per read transaction.
+   unsigned int readChunk;
+   // Largest read chunk advertised in the API version reply, 0 to advertise nothing.
+   unsigned int maxReadChunk;
+   // Bus speeds in kHz advertised in the API version reply, e.g. "100,400,1000".
+   std::string speeds;
+   // Above this clock every fourth message written is corrupted, 0 for a clean bus.
+   unsigned int noisyAboveHz;
+   // Whether catalog diffs are advertised in the API version reply.
+   bool catalogDiffs;
+} ServerConfig;
+
+/**
+   A complete message moved across the bus in either direction.
+ */
+typedef struct {
+   uint8_t command;
+   std::string payload;
+   uint64_t startNs;
+   bool corrupted;
+} BusMessage;
+
+class EmulatedZuluIDE {
+  public:
+   explicit EmulatedZuluIDE(const ServerConfig& config);
+
+   /**
+      Performs the next bus transaction: continues reading a client request,
+      writes the next pending message or polls the client.
+    */
+   void Step();
+
+   /**
+      Queues a message to write to the client.
+    */
+   void Send(uint8_t command, const std::string& payload);
+
+   /**
+      Queues a status update reflecting the currently loaded image.
+    */
+   void PushStatus();
+
+   /**
+      Removes the oldest message written to the client, used to match it
+      against what the client dispatched.
+    */
+   bool TakeWritten(BusMessage* message);
+
+   /**
+      True when nothing is waiting to be written and the last poll found the
+      client had nothing to send.
+    */
+   bool IsQuiet() const;
+
+   /**
+      Called with every request fully read from the client.
+    */
+   std::function<void(const BusMessage&)> onRequest;
+
+   ServerConfig& Config() { return config; }
+
+   std::string ImageRecord(unsigned int index) const;
+
+   /**
+      Adds images to the end of the SD card's list, announcing the new
+      catalog generation to a client that asked for diffs.
+    */
+   void AddImages(unsigned int count);
+
+   /**
+      Removes images spread across the SD card's list.
+    */
+   void RemoveImages(unsigned int count);
+
+   /**
+      The index of the image at position in the SD card's list.
+    */
+   unsigned int ImageAt(size_t position) const { return cardChanged ? cardImages[position] : position; }
+
+   std::string StatusRecord() const;
+
+   uint64_t Polls() const { return polls; }
+
+   uint64_t Corrupted(uint8_t command) const { return corrupted[command]; }
+
+  private:
+   enum class ReadState { Idle,
+                          Length,
+                          Payload };
+
+   void HandleRequest(const BusMessage& request);
+   std::string ImageName(unsigned int index) const;
+   std::vector<unsigned int>& Card();
+   void RecordChange(const std::string& change);
+   void AnnounceCatalog();
+   void SendCatalogDiff(const std::string& since);
+
+   ServerConfig config;
+   std::deque<BusMessage> pending;
+   std::deque<BusMessage> written;
+   ReadState readState;
+   BusMessage reading;
+   size_t readLength;
+   bool lastPollEmpty;
+   bool wroteLast;
+   bool subscribed;
+   unsigned int iterator;
+   // Images on the card once it has changed, until then images 0 to catalogSize - 1.
+   std::vector<unsigned int> cardImages;
+   bool cardChanged;
+   unsigned int nextImage;
+   bool clientDiffs;
+   uint32_t catalogGeneration;
+   // Changes since generation historyStart, each with the generation it made.
+   std::deque<std::pair<uint32_t, std::string>> history;
+   uint32_t historyStart;
+   std::string loadedImage;
+   uint64_t polls;
+   uint64_t writes;
+   uint64_t corrupted[256];
+};
+
+}  // namespace sim
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "SimBus.h"
+
+#include <hardware/dma.h>
+#include <pico/i2c_slave.h>
+#include <pico/stdlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+struct i2c_inst {
+   i2c_hw_t hw;
+   uint baudrate;
+   uint8_t address;
+   i2c_slave_handler_t handler;
+   std::deque<uint8_t> rxFifo;
+   std::vector<uint8_t> txFifo;
+};
+
+i2c_inst_t i2c0_inst = {};
+
+namespace {
+unsigned int clockHz = 100000;
+unsigned int overheadBits = 20;
+uint64_t nowNs = 0;
+sim::BusStats stats = {};
+
+void Charge(size_t bytes) {
+   // Every byte is 8 data bits plus the ACK/NACK bit.
+   uint64_t bits = overheadBits + bytes * 9;
+   nowNs += bits * 1000000000ull / clockHz;
+}
+}  // namespace
+
+uint64_t time_us_64() {
+   return nowNs / 1000;
+}
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate) {
+   i2c->hw.enable = I2C_IC_ENABLE_ENABLE_BITS;
+   return i2c_set_baudrate(i2c, baudrate);
+}
+
+uint i2c_set_baudrate(i2c_inst_t* i2c, uint baudrate) {
+   i2c->baudrate = baudrate;
+   return baudrate;
+}
+
+void i2c_slave_init(i2c_inst_t* i2c, uint8_t address, i2c_slave_handler_t handler) {
+   i2c->address = address;
+   i2c->handler = handler;
+}
+
+size_t i2c_get_read_available(i2c_inst_t* i2c) {
+   return i2c->rxFifo.size();
+}
+
+uint8_t i2c_read_byte_raw(i2c_inst_t* i2c) {
+   uint8_t value = i2c->rxFifo.front();
+   i2c->rxFifo.pop_front();
+   return value;
+}
+
+void i2c_write_raw_blocking(i2c_inst_t* i2c, const uint8_t* src, size_t len) {
+   i2c->txFifo.insert(i2c->txFifo.end(), src, src + len);
+}
+
+void i2c_write_byte_raw(i2c_inst_t* i2c, uint8_t value) {
+   i2c->txFifo.push_back(value);
+}
+
+i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c) {
+   return &i2c->hw;
+}
+
+uint i2c_get_dreq(i2c_inst_t* i2c, bool is_tx) {
+   return is_tx ? 32 : 33;
+}
+
+namespace {
+struct {
+   volatile void* writeAddr;
+   enum dma_channel_transfer_size size;
+   uint64_t transfers;
+   // Every stallEvery transfers one is left busy until it is aborted.
+   unsigned int stallEvery;
+   bool busy;
+} dmaChannel = {};
+}  // namespace
+
+int dma_claim_unused_channel(bool required) {
+   return 0;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+   return {0};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) {
+   c->ctrl = size;
+}
+
+void channel_config_set_read_increment(dma_channel_config* c, bool incr) {}
+
+void channel_config_set_write_increment(dma_channel_config* c, bool incr) {}
+
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) {}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger) {
+   dmaChannel.writeAddr = write_addr;
+   dmaChannel.size = (enum dma_channel_transfer_size)config->ctrl;
+   if (trigger) {
+      dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+   }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_addr, uint32_t transfer_count) {
+   i2c_inst_t* i2c = i2c0;
+   for (uint32_t i = 0; i < transfer_count; i++) {
+      uint32_t value;
+      if (dmaChannel.size == DMA_SIZE_8) {
+         value = ((const volatile uint8_t*)read_addr)[i];
+      } else if (dmaChannel.size == DMA_SIZE_16) {
+         value = ((const volatile uint16_t*)read_addr)[i];
+      } else {
+         value = ((const volatile uint32_t*)read_addr)[i];
+      }
+
+      if (dmaChannel.writeAddr == &i2c->hw.data_cmd) {
+         // Bit 8 set would be a read command, which is invalid for a slave transmitter.
+         if (value & 0x100) {
+            printf("DMA wrote a read command to the I2C data register.\n");
+         }
+
+         i2c->txFifo.push_back((uint8_t)value);
+      }
+   }
+
+   dmaChannel.transfers++;
+   dmaChannel.busy = dmaChannel.stallEvery > 0 && dmaChannel.transfers % dmaChannel.stallEvery == 0;
+}
+
+bool dma_channel_is_busy(uint channel) {
+   return dmaChannel.busy;
+}
+
+void dma_channel_abort(uint channel) {
+   dmaChannel.busy = false;
+}
+
+namespace sim {
+
+void BusSetClock(unsigned int hz) {
+   clockHz = hz;
+}
+
+unsigned int BusGetClock() {
+   return clockHz;
+}
+
+void BusSetTransactionOverhead(unsigned int bits) {
+   overheadBits = bits;
+}
+
+void BusSetDmaStall(unsigned int every) {
+   dmaChannel.stallEvery = every;
+   dmaChannel.busy = false;
+}
+
+bool BusWrite(const uint8_t* data, size_t length) {
+   i2c_inst_t* i2c = i2c0;
+   stats.transactions++;
+   if (!(i2c->hw.enable & I2C_IC_ENABLE_ENABLE_BITS)) {
+      stats.naks++;
+      Charge(0);
+      return false;
+   }
+   stats.bytesToSlave += length;
+   Charge(length);
+
+   for (size_t i = 0; i < length; i++) {
+      i2c->rxFifo.push_back(data[i]);
+      // RX_FULL is level triggered, keep raising it while the handler drains the FIFO.
+      while (!i2c->rxFifo.empty()) {
+         size_t before = i2c->rxFifo.size();
+         stats.receiveEvents++;
+         i2c->handler(i2c, I2C_SLAVE_RECEIVE);
+         if (i2c->rxFifo.size() == before) {
+            break;
+         }
+      }
+   }
+
+   i2c->handler(i2c, I2C_SLAVE_FINISH);
+   return true;
+}
+
+int BusRead(uint8_t* data, size_t length) {
+   i2c_inst_t* i2c = i2c0;
+   stats.transactions++;
+   if (!(i2c->hw.enable & I2C_IC_ENABLE_ENABLE_BITS)) {
+      stats.naks++;
+      Charge(0);
+      return -1;
+   }
+
+   size_t received = 0;
+   while (received < length) {
+      // RD_REQ is raised whenever the master clocks a byte out of an empty TX FIFO.
+      if (i2c->txFifo.empty()) {
+         stats.requestEvents++;
+         i2c->handler(i2c, I2C_SLAVE_REQUEST);
+         if (i2c->txFifo.empty()) {
+            stats.underruns++;
+            break;
+         }
+      }
+
+      size_t count = std::min(length - received, i2c->txFifo.size());
+      std::copy(i2c->txFifo.begin(), i2c->txFifo.begin() + count, data + received);
+      i2c->txFifo.erase(i2c->txFifo.begin(), i2c->txFifo.begin() + count);
+      received += count;
+   }
+
+   // The master NACKs the last byte, which flushes anything left in the FIFO.
+   stats.flushedBytes += i2c->txFifo.size();
+   i2c->txFifo.clear();
+
+   stats.bytesFromSlave += received;
+   Charge(length);
+   i2c->handler(i2c, I2C_SLAVE_FINISH);
+   return (int)received;
+}
+
+void BusIdle(uint64_t ns) {
+   nowNs += ns;
+}
+
+uint64_t BusNowNs() {
+   return nowNs;
+}
+
+const BusStats& GetBusStats() {
+   return stats;
+}
+
+}  // namespace sim
@@ -0,0 +1,93 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_BUS_H
+#define SIM_BUS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+   Emulated I2C bus connecting the emulated ZuluIDE master to the I2C client
+   under test. Every transaction invokes the client's slave handler the same
+   way the Pico SDK interrupt handler does and advances a virtual clock by the
+   time the transfer would take on the wire.
+ */
+namespace sim {
+
+typedef struct {
+   uint64_t transactions;
+   uint64_t bytesToSlave;
+   uint64_t bytesFromSlave;
+   uint64_t receiveEvents;
+   uint64_t requestEvents;
+   // Read transactions where the slave supplied fewer bytes than requested.
+   uint64_t underruns;
+   // Bytes the slave queued beyond what the master read (flushed on NACK).
+   uint64_t flushedBytes;
+   // Transactions where the slave did not acknowledge its address.
+   uint64_t naks;
+} BusStats;
+
+/**
+   Sets the SCL frequency the master drives the bus at.
+ */
+void BusSetClock(unsigned int hz);
+
+unsigned int BusGetClock();
+
+/**
+   Sets the number of bit times charged per transaction for the start
+   condition, address byte and stop condition.
+ */
+void BusSetTransactionOverhead(unsigned int bits);
+
+/**
+   Leaves every Nth transmit DMA transfer reporting busy until the client
+   aborts it, which the client takes to mean the master stopped reading
+   part way through the chunk. 0 turns this off.
+ */
+void BusSetDmaStall(unsigned int every);
+
+/**
+   Performs a master write transaction of the provided bytes. Returns false
+   if the slave did not acknowledge its address.
+ */
+bool BusWrite(const uint8_t* data, size_t length);
+
+/**
+   Performs a master read transaction, returning the number of bytes the
+   slave supplied, or -1 if it did not acknowledge its address.
+ */
+int BusRead(uint8_t* data, size_t length);
+
+/**
+   Advances the virtual clock without any bus activity.
+ */
+void BusIdle(uint64_t ns);
+
+uint64_t BusNowNs();
+
+const BusStats& GetBusStats();
+
+}  // namespace sim
+
+#endif
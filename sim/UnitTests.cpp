@@ -0,0 +1,235 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "CatalogSync.h"
+#include "ImageCatalog.h"
+#include "LongPoll.h"
+#include "pico/stdlib.h"
+
+/**
+   Host unit tests for the parts of the firmware that do not need the I2C
+   bus. Each test returns false after printing the first check that failed.
+ */
+
+#define CHECK(condition)                                                       \
+   do {                                                                        \
+      if (!(condition)) {                                                      \
+         printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+         return false;                                                         \
+      }                                                                        \
+   } while (0)
+
+// The log stamps messages with the time, which stands still without the bus.
+uint64_t time_us_64() {
+   return 0;
+}
+
+static bool Append(zuluide::ImageCatalog* catalog, const char* record) {
+   return catalog->Append((const uint8_t*)record, strlen(record));
+}
+
+static bool CatalogFinishTwiceEmpty() {
+   zuluide::ImageCatalog catalog;
+   catalog.Finish();
+   catalog.Finish();
+   CHECK(catalog.IsComplete());
+   CHECK(std::string(catalog.Json()) == "[]");
+   CHECK(catalog.JsonLength() == 2);
+   return true;
+}
+
+static bool CatalogFinishTwice() {
+   zuluide::ImageCatalog catalog;
+   CHECK(Append(&catalog, "{\"filename\":\"a.iso\",\"size\":1}"));
+   catalog.Finish();
+   catalog.Finish();
+   CHECK(std::string(catalog.Json()) == "[{\"filename\":\"a.iso\",\"size\":1}]");
+   return true;
+}
+
+static bool CatalogAppendAfterFinish() {
+   zuluide::ImageCatalog catalog;
+   CHECK(Append(&catalog, "{\"filename\":\"a.iso\",\"size\":1}"));
+   catalog.Finish();
+   uint32_t generation = catalog.Generation();
+
+   // The closing bracket must not be overwritten while the catalog claims to be complete.
+   CHECK(Append(&catalog, "{\"filename\":\"b.iso\",\"size\":2}"));
+   CHECK(!catalog.IsComplete());
+   CHECK(catalog.Generation() != generation);
+   CHECK(std::string(catalog.Json()) == "[]");
+
+   catalog.Finish();
+   CHECK(std::string(catalog.Json()) == "[{\"filename\":\"a.iso\",\"size\":1},{\"filename\":\"b.iso\",\"size\":2}]");
+   CHECK(catalog.Count() == 2);
+   return true;
+}
+
+static bool CatalogAppendAfterFinishEmpty() {
+   zuluide::ImageCatalog catalog;
+   catalog.Finish();
+   CHECK(Append(&catalog, "{\"filename\":\"a.iso\",\"size\":1}"));
+   catalog.Finish();
+   CHECK(std::string(catalog.Json()) == "[{\"filename\":\"a.iso\",\"size\":1}]");
+   return true;
+}
+
+/**
+   A read from another core stays valid across an append that fits, and not
+   across one that grows the memory or a change that moves records.
+ */
+static bool CatalogReadAcrossChanges() {
+   zuluide::ImageCatalog catalog;
+   CHECK(Append(&catalog, "{\"filename\":\"a.iso\",\"size\":1}"));
+   uint32_t begun = catalog.ReadBegin();
+   CHECK(Append(&catalog, "{\"filename\":\"b.iso\",\"size\":2}"));
+   CHECK(catalog.ReadValid(begun));
+
+   std::string large = "{\"filename\":\"" + std::string(3000, 'x') + "\",\"size\":4}";
+   begun = catalog.ReadBegin();
+   CHECK(Append(&catalog, large.c_str()));
+   CHECK(Append(&catalog, large.c_str()));
+   CHECK(!catalog.ReadValid(begun));
+   catalog.Truncate(2);
+
+   begun = catalog.ReadBegin();
+   CHECK(catalog.Remove("a.iso", 5));
+   CHECK(!catalog.ReadValid(begun));
+   size_t length;
+   const char* record = catalog.Range(0, 1, &length);
+   CHECK(std::string(record, length) == "{\"filename\":\"b.iso\",\"size\":2}");
+
+   CHECK(Append(&catalog, "{\"filename\":\"c.iso\",\"size\":3}"));
+   CHECK(Append(&catalog, "{\"filename\":\"d.iso\",\"size\":4}"));
+   begun = catalog.ReadBegin();
+   catalog.Truncate(2);
+   CHECK(!catalog.ReadValid(begun));
+   catalog.Finish();
+   const char* json = catalog.Json(&length);
+   CHECK(std::string(json, length) == "[{\"filename\":\"b.iso\",\"size\":2},{\"filename\":\"c.iso\",\"size\":3}]");
+   CHECK(catalog.JsonLength() == length);
+   return true;
+}
+
+static zuluide::SyncResult Apply(zuluide::CatalogSync* sync, const char* message) {
+   return sync->Apply((const uint8_t*)message, strlen(message) + 1);
+}
+
+static bool CatalogSyncDiverged() {
+   zuluide::ImageCatalog catalog;
+   CHECK(Append(&catalog, "{\"filename\":\"a.iso\",\"size\":1}"));
+   catalog.Finish();
+   zuluide::CatalogSync sync(&catalog);
+   sync.Restore(3);
+   char payload[16];
+   sync.Request(payload, sizeof(payload));
+   CHECK(std::string(payload) == "3");
+   CHECK(Apply(&sync, "-missing.iso") == zuluide::SyncResult::None);
+   CHECK(Apply(&sync, "=4") == zuluide::SyncResult::Outdated);
+   sync.Request(payload, sizeof(payload));
+   CHECK(payload[0] == 0);
+   CHECK(Apply(&sync, "*4") == zuluide::SyncResult::None);
+   CHECK(Apply(&sync, "+{\"filename\":\"b.iso\",\"size\":1}") == zuluide::SyncResult::None);
+   CHECK(Apply(&sync, "=4") == zuluide::SyncResult::Finished);
+   uint32_t generation;
+   CHECK(sync.Held(&generation) && generation == 4);
+   return true;
+}
+
+/**
+   A /status?since= response held at sequence 7, read the way lwIP httpd
+   reads it: release_status calls Poll before every read and
+   ServiceWebResponses calls ShouldResume for a delayed one.
+ */
+static bool LongPollNewStatus() {
+   using Readiness = zuluide::web::LongPoll::Readiness;
+   zuluide::web::LongPoll poll;
+   poll.Hold(7, 6000);
+   CHECK(poll.Poll(7, 1000) == Readiness::Waiting);
+   CHECK(!poll.ShouldResume(7, 2000));
+   CHECK(poll.ShouldResume(8, 2000));
+   // Only the read that releases it takes the snapshot.
+   CHECK(poll.Poll(8, 2000) == Readiness::Released);
+   CHECK(poll.Poll(8, 2000) == Readiness::Ready);
+   CHECK(!poll.ShouldResume(9, 2000));
+   CHECK(!poll.Release());
+   return true;
+}
+
+static bool LongPollDeadline() {
+   using Readiness = zuluide::web::LongPoll::Readiness;
+   zuluide::web::LongPoll poll;
+   poll.Hold(7, 6000);
+   CHECK(!poll.ShouldResume(7, 5999));
+   CHECK(poll.Poll(7, 5999) == Readiness::Waiting);
+   CHECK(poll.ShouldResume(7, 6000));
+   CHECK(poll.Poll(7, 6000) == Readiness::Released);
+   return true;
+}
+
+static bool LongPollNotHeld() {
+   using Readiness = zuluide::web::LongPoll::Readiness;
+   zuluide::web::LongPoll poll;
+   CHECK(!poll.ShouldResume(7, 0));
+   CHECK(poll.Poll(7, 0) == Readiness::Ready);
+   // Closing a held response releases it without a read.
+   poll.Hold(7, 6000);
+   CHECK(poll.Release());
+   CHECK(poll.Poll(7, 0) == Readiness::Ready);
+   return true;
+}
+
+typedef struct {
+   const char* name;
+   bool (*run)();
+} Test;
+
+static const Test tests[] = {
+    {"catalog_finish_twice_empty", CatalogFinishTwiceEmpty},
+    {"catalog_finish_twice", CatalogFinishTwice},
+    {"catalog_append_after_finish", CatalogAppendAfterFinish},
+    {"catalog_append_after_finish_empty", CatalogAppendAfterFinishEmpty},
+    {"catalog_read_across_changes", CatalogReadAcrossChanges},
+    {"catalog_sync_diverged", CatalogSyncDiverged},
+    {"long_poll_new_status", LongPollNewStatus},
+    {"long_poll_deadline", LongPollDeadline},
+    {"long_poll_not_held", LongPollNotHeld},
+};
+
+int main(int argc, char* argv[]) {
+   int failed = 0;
+   for (const Test& test : tests) {
+      if (argc > 1 && strcmp(argv[1], test.name) != 0) {
+         continue;
+      }
+
+      bool passed = test.run();
+      printf("%s %s\n", passed ? "pass" : "FAIL", test.name);
+      failed += passed ? 0 : 1;
+   }
+
+   printf("%d failed\n", failed);
+   return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,766 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+/**
+   Host-side simulation of the ZuluIDE I2C client. The client code from src/
+   is built against a shim of the Pico SDK and driven by an emulated ZuluIDE
+   I2C master running a scripted scenario. Bus timings are modelled from the
+   configured clock so the reported throughput and latency reflect the wire,
+   while the host time per message reflects the client's processing cost.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CatalogSync.h"
+#include "EmulatedZuluIDE.h"
+#include "FlashStore.h"
+#include "ImageCatalog.h"
+#include "Log.h"
+#include "SimBus.h"
+#include "ZuluControlI2CClient.h"
+#include "pico/platform.h"
+
+static const char* defaultScenario = R"(
+# Boot handshake, status traffic, a full catalog and image loads.
+clock 100000
+catalog 2000 40
+handshake
+report handshake
+status 200
+report status
+fetch-images
+report catalog
+iterate
+report iterate
+load-long 20 200
+report load
+)";
+
+static sim::ServerConfig serverConfig = {"2.0.0", "ZuluNet", "password", 0, 40, BUFFER_LENGTH, 0, "", 0, false};
+static sim::EmulatedZuluIDE* server = NULL;
+
+static unsigned int mainEvery = 1;
+// Image records to hand back for a later retry, as the I2C core does while
+// the network core's inbox is full.
+static unsigned int retryImages = 0;
+// Iteration requests kept outstanding by the iterate command.
+static unsigned int prefetchDepth = 1;
+static unsigned int iterationsInFlight = 0;
+// Replies to requests sent before the end of an iteration arrived, which start the next pass.
+static unsigned int carriedImages = 0;
+static bool catalogDone = false;
+static unsigned int catalogReceived = 0;
+static bool passwordReceived = false;
+static unsigned int statusReceived = 0;
+static zuluide::ImageCatalog catalog;
+static zuluide::CatalogSync catalogSync(&catalog);
+// Set once the catalog has been fetched, after which announced changes are synced.
+static bool catalogSynced = false;
+static uint64_t syncPayloadBytes = 0;
+static uint64_t catalogPayloadBytes = 0;
+static double catalogHostNs = 0;
+// Bus times at which the fetch started and the first page of images could be served.
+static uint64_t catalogStartNs = 0;
+static uint64_t firstPageNs = 0;
+
+/**
+   Measurements accumulated between two report commands.
+ */
+typedef struct {
+   std::vector<uint64_t> inboundLatencyNs;
+   std::vector<uint64_t> outboundLatencyNs;
+   uint64_t inboundPayloadBytes;
+   uint64_t outboundPayloadBytes;
+   uint64_t startNs;
+   sim::BusStats startBus;
+   std::chrono::steady_clock::time_point hostStart;
+   uint64_t enqueueFailures;
+} PhaseStats;
+
+// Record types as the firmware numbers them.
+#define STORE_CREDENTIALS 1
+#define STORE_CATALOG 2
+
+// Persisted the way PersistToFlash does; the flash-reload command mounts a
+// fresh copy as a reset would.
+static zuluide::FlashStore flashStore;
+
+// The core requests are made on. The client runs on core 0, so requests made
+// on core 1 take the path the network core's do in dual core mode.
+static unsigned int requestCore = 0;
+
+static PhaseStats phase;
+static uint64_t mismatches = 0;
+static std::deque<sim::BusMessage> outbound;
+
+static void ResetPhase() {
+   phase.inboundLatencyNs.clear();
+   phase.outboundLatencyNs.clear();
+   phase.inboundPayloadBytes = 0;
+   phase.outboundPayloadBytes = 0;
+   phase.startNs = sim::BusNowNs();
+   phase.startBus = sim::GetBusStats();
+   phase.hostStart = std::chrono::steady_clock::now();
+   phase.enqueueFailures = 0;
+}
+
+/**
+   Enqueues a request the same way the firmware does and remembers it so the
+   emulated master can verify what it reads.
+ */
+static void Request(uint8_t command, const char* payload = NULL) {
+   simCore = requestCore;
+   bool added = payload ? zuluide::i2c::client::EnqueueRequest(command, payload)
+                        : zuluide::i2c::client::EnqueueRequest(command);
+   simCore = 0;
+   if (added) {
+      outbound.push_back({command, payload ? payload : "", sim::BusNowNs(), false});
+   } else {
+      phase.enqueueFailures++;
+   }
+}
+
+static void OnServerRead(const sim::BusMessage& request) {
+   if (request.command == I2C_CLIENT_CAPABILITIES) {
+      // Sent by the client itself while negotiating.
+      return;
+   }
+
+   if (outbound.empty() || outbound.front().command != request.command || outbound.front().payload != request.payload) {
+      printf("Mismatch: master read command 0x%x (%zu bytes) that was not sent in order.\n", request.command, request.payload.length());
+      mismatches++;
+      return;
+   }
+
+   phase.outboundLatencyNs.push_back(sim::BusNowNs() - outbound.front().startNs);
+   phase.outboundPayloadBytes += request.payload.length();
+   outbound.pop_front();
+}
+
+/**
+   Matches a message dispatched by the client against the oldest message the
+   master wrote.
+ */
+static void Delivered(uint8_t command, const uint8_t* message, size_t length) {
+   sim::BusMessage sent;
+   if (!server->TakeWritten(&sent)) {
+      printf("Mismatch: client dispatched command 0x%x that was never written.\n", command);
+      mismatches++;
+      return;
+   }
+
+   if (command == I2C_SERVER_API_VERSION) {
+      // The client strips the capabilities before passing the version on.
+      sent.payload = sent.payload.substr(0, sent.payload.find(';'));
+   }
+
+   if (sent.command != command || sent.payload.length() != length || memcmp(sent.payload.data(), message, length) != 0) {
+      printf("Mismatch: wrote command 0x%x (%zu bytes), client dispatched 0x%x (%zu bytes).\n",
+             sent.command, sent.payload.length(), command, length);
+      mismatches++;
+      return;
+   }
+
+   phase.inboundLatencyNs.push_back(sim::BusNowNs() - sent.startNs);
+   phase.inboundPayloadBytes += length;
+}
+
+/**
+   Asks for the changes since the generation held, as the firmware does.
+ */
+static void RequestCatalogDiff() {
+   char generation[16];
+   catalogSync.Request(generation, sizeof(generation));
+   Request(I2C_CLIENT_FETCH_CATALOG_DIFF, generation);
+}
+
+namespace zuluide::i2c::client {
+
+void ProcessServerAPIVersion(const uint8_t* message, size_t length) {
+   Delivered(I2C_SERVER_API_VERSION, message, length);
+}
+
+void ProcessSystemStatus(const uint8_t* message, size_t length) {
+   Delivered(I2C_SERVER_SYSTEM_STATUS_JSON, message, length);
+   statusReceived++;
+}
+
+void ProcessImage(const uint8_t* message, size_t length) {
+   if (retryImages > 0) {
+      retryImages--;
+      RetryLater();
+      return;
+   }
+
+   Delivered(I2C_SERVER_IMAGE_JSON, message, length);
+   auto start = std::chrono::steady_clock::now();
+   if (iterationsInFlight > 0) {
+      // Replies to iteration requests come first as the server answers in order.
+      iterationsInFlight--;
+      if (catalogDone) {
+         carriedImages++;
+      } else if (length == 0) {
+         catalogDone = true;
+      } else {
+         // Keep the pipeline full as each image arrives.
+         catalogReceived++;
+         iterationsInFlight++;
+         Request(I2C_CLIENT_FETCH_ITR_IMAGE);
+      }
+   } else if (length == 0) {
+      catalogDone = true;
+      catalog.Finish();
+   } else {
+      catalogReceived++;
+      if (catalog.Append(message, length)) {
+         catalogPayloadBytes += length;
+         if (catalog.Count() == CATALOG_PAGE_DEFAULT) {
+            firstPageNs = sim::BusNowNs();
+         }
+      }
+   }
+
+   catalogHostNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ProcessCatalogDiff(const uint8_t* message, size_t length) {
+   Delivered(I2C_SERVER_CATALOG_DIFF, message, length);
+   auto start = std::chrono::steady_clock::now();
+   syncPayloadBytes += length;
+   if (length > 0 && message[0] == '+') {
+      catalogReceived++;
+      catalogPayloadBytes += length - 1;
+      if (catalog.Count() + 1 == CATALOG_PAGE_DEFAULT) {
+         firstPageNs = sim::BusNowNs();
+      }
+   }
+
+   switch (catalogSync.Apply(message, length)) {
+      case zuluide::SyncResult::Outdated:
+         if (catalogSynced) {
+            RequestCatalogDiff();
+         }
+
+         break;
+      case zuluide::SyncResult::Finished:
+         catalogSynced = true;
+         catalogDone = true;
+         break;
+      default:
+         break;
+   }
+
+   catalogHostNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ProcessSSID(const uint8_t* message, size_t length) {
+   Delivered(I2C_SERVER_SSID, message, length);
+   Request(I2C_CLIENT_FETCH_SSID_PASS);
+}
+
+void ProcessPassword(const uint8_t* message, size_t length) {
+   Delivered(I2C_SERVER_SSID_PASS, message, length);
+   Request(I2C_CLIENT_SUBSCRIBE_STATUS_JSON);
+   passwordReceived = true;
+}
+
+void ProcessReset() {
+   Delivered(I2C_SERVER_RESET, NULL, 0);
+}
+
+void NotifyMessageReceived() {
+   // The simulated main loop processes messages every mainEvery transactions.
+}
+
+}  // namespace zuluide::i2c::client
+
+/**
+   Runs bus transactions, letting the client's main loop process messages
+   every mainEvery transactions, until the condition is met or the bus goes
+   quiet.
+ */
+template <typename Condition>
+static bool Run(Condition done, const char* what) {
+   const uint64_t limit = 10000000;
+   uint64_t transactions = 0;
+   while (!(done() && server->IsQuiet() && outbound.empty())) {
+      server->Step();
+      if (++transactions % mainEvery == 0) {
+         for (unsigned int i = 0; i < mainEvery; i++) {
+            zuluide::i2c::client::ProcessMessages();
+         }
+
+         zuluide::log::Drain(LOG_RING_RECORDS);
+      }
+
+      if (transactions > limit) {
+         printf("Error: %s did not complete within %llu transactions.\n", what, (unsigned long long)limit);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/**
+   Checks the catalog built from a full fetch is one well formed JSON array
+   holding every record received.
+ */
+static bool CheckCatalog() {
+   size_t count = catalog.Count();
+   size_t expected = count > 0 ? catalogPayloadBytes + count + 1 : 2;
+   const char* json = catalog.Json();
+   if (!catalog.IsComplete() || count != catalogReceived || catalog.JsonLength() != expected || strlen(json) != expected ||
+       json[0] != '[' || json[expected - 1] != ']') {
+      printf("Error: catalog of %zu images is %zu bytes, expected %u images in %zu bytes.\n",
+             count, catalog.JsonLength(), catalogReceived, expected);
+      return false;
+   }
+
+   for (size_t i = 0; i < count; i++) {
+      size_t length;
+      const char* entry = catalog.Entry(i, &length);
+      if (entry[-1] != (i == 0 ? '[' : ',') || (entry[length] != ',' && entry[length] != ']')) {
+         printf("Error: catalog entry %zu is not delimited.\n", i);
+         return false;
+      }
+   }
+
+   // A page from the middle of the catalog runs from the start of its first record to the end of its last.
+   if (count > 0) {
+      size_t first = count / 2;
+      size_t last = std::min(first + CATALOG_PAGE_DEFAULT, count) - 1;
+      size_t pageLength, firstLength, lastLength;
+      const char* page = catalog.Range(first, CATALOG_PAGE_DEFAULT, &pageLength);
+      const char* firstEntry = catalog.Entry(first, &firstLength);
+      const char* lastEntry = catalog.Entry(last, &lastLength);
+      if (page != firstEntry || page + pageLength != lastEntry + lastLength) {
+         printf("Error: catalog page at %zu does not match its records.\n", first);
+         return false;
+      }
+   }
+
+   // Sorting and searching the index. Sizes fall as the index rises and every tenth name ends in 7.
+   std::vector<uint32_t> matches(CATALOG_PAGE_MAX);
+   auto start = std::chrono::steady_clock::now();
+   size_t byName = catalog.Search("", zuluide::CatalogSort::Name, 0, matches.data(), matches.size());
+   auto sorted = std::chrono::steady_clock::now();
+   size_t bySize = catalog.Search("", zuluide::CatalogSort::Size, 0, matches.data(), matches.size());
+   auto sortedSize = std::chrono::steady_clock::now();
+   size_t found = catalog.Search("7.ISO", zuluide::CatalogSort::Name, 0, matches.data(), matches.size());
+   auto searched = std::chrono::steady_clock::now();
+   uint32_t smallest = count;
+   catalog.Search("", zuluide::CatalogSort::Size, 0, &smallest, 1);
+   if (byName != count || bySize != count || (count > 0 && smallest != count - 1) || found != (count + 2) / 10) {
+      printf("Error: catalog search found %zu by name, %zu by size and %zu ending in 7.\n", byName, bySize, found);
+      return false;
+   }
+
+   auto stats = catalog.Stats();
+   uint64_t doneNs = sim::BusNowNs();
+   printf("  catalog: %zu images, %zu bytes, peak %zu bytes, %.0f host ns per image\n",
+          stats.entries, stats.bytes, stats.peakBytes, count > 0 ? catalogHostNs / count : 0.0);
+   printf("  index: %zu bytes, %.1f per image, host sort by name %.0f us, by size %.0f us, search %.0f us\n",
+          stats.indexBytes, count > 0 ? (double)stats.indexBytes / count : 0.0,
+          std::chrono::duration<double, std::micro>(sorted - start).count(),
+          std::chrono::duration<double, std::micro>(sortedSize - sorted).count(),
+          std::chrono::duration<double, std::micro>(searched - sortedSize).count());
+   printf("  catalog: first page of %d after %.1f ms, complete after %.1f ms\n", CATALOG_PAGE_DEFAULT,
+          ((firstPageNs ? firstPageNs : doneNs) - catalogStartNs) / 1e6, (doneNs - catalogStartNs) / 1e6);
+   return true;
+}
+
+/**
+   Checks the catalog holds the SD card's images in the server's order.
+ */
+static bool CheckSynced() {
+   size_t count = server->Config().catalogSize;
+   if (!catalog.IsComplete() || catalog.Count() != count) {
+      printf("Error: synced catalog has %zu images, the SD card %zu.\n", catalog.Count(), count);
+      return false;
+   }
+
+   for (size_t i = 0; i < count; i++) {
+      size_t length;
+      const char* entry = catalog.Entry(i, &length);
+      if (server->ImageRecord(server->ImageAt(i)) != std::string(entry, length)) {
+         printf("Error: synced catalog entry %zu does not match the SD card.\n", i);
+         return false;
+      }
+   }
+
+   std::string json = catalog.Json();
+   if (json.length() != catalog.JsonLength() || json.front() != '[' || json.back() != ']') {
+      printf("Error: synced catalog is not a JSON array.\n");
+      return false;
+   }
+
+   return true;
+}
+
+static uint64_t Percentile(std::vector<uint64_t> values, double percentile) {
+   if (values.empty()) {
+      return 0;
+   }
+
+   std::sort(values.begin(), values.end());
+   size_t index = (size_t)(percentile * (values.size() - 1));
+   return values[index];
+}
+
+static void Report(const std::string& label) {
+   const sim::BusStats& bus = sim::GetBusStats();
+   double seconds = (sim::BusNowNs() - phase.startNs) / 1e9;
+   uint64_t bytes = (bus.bytesToSlave - phase.startBus.bytesToSlave) + (bus.bytesFromSlave - phase.startBus.bytesFromSlave);
+   uint64_t transactions = bus.transactions - phase.startBus.transactions;
+   size_t messages = phase.inboundLatencyNs.size() + phase.outboundLatencyNs.size();
+   double hostNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - phase.hostStart).count();
+
+   zuluide::i2c::client::QueueStats outputQueue;
+   zuluide::i2c::client::GetQueueStats(&outputQueue);
+   zuluide::i2c::client::RingStats ring;
+   zuluide::i2c::client::GetReceiveStats(&ring);
+
+   printf("[%s]\n", label.c_str());
+   printf("  bus: %llu transactions, %llu bytes in %.3f s at %u Hz, %.0f bytes/s, payload %.0f bytes/s\n",
+          (unsigned long long)transactions, (unsigned long long)bytes, seconds, sim::BusGetClock(),
+          seconds > 0 ? bytes / seconds : 0.0,
+          seconds > 0 ? (phase.inboundPayloadBytes + phase.outboundPayloadBytes) / seconds : 0.0);
+   printf("  to client: %zu messages, latency us p50 %.1f p99 %.1f max %.1f\n",
+          phase.inboundLatencyNs.size(),
+          Percentile(phase.inboundLatencyNs, 0.5) / 1e3, Percentile(phase.inboundLatencyNs, 0.99) / 1e3,
+          Percentile(phase.inboundLatencyNs, 1.0) / 1e3);
+   printf("  from client: %zu messages, latency us p50 %.1f p99 %.1f max %.1f\n",
+          phase.outboundLatencyNs.size(),
+          Percentile(phase.outboundLatencyNs, 0.5) / 1e3, Percentile(phase.outboundLatencyNs, 0.99) / 1e3,
+          Percentile(phase.outboundLatencyNs, 1.0) / 1e3);
+   zuluide::i2c::client::LinkStats link;
+   zuluide::i2c::client::GetLinkStats(&link);
+   printf("  link: %u Hz, %u byte chunks, %u bytes/s, %u aborted chunks, %u framing errors, %u fallbacks\n",
+          link.baudrate, link.txChunk, link.throughput, link.txAborts, link.framingErrors, link.fallbacks);
+   printf("  output queue: max %u/%u, enqueue failures %llu\n",
+          outputQueue.maxLevel, outputQueue.capacity, (unsigned long long)phase.enqueueFailures);
+   printf("  receive ring: max %u/%u bytes, max %u messages pending, %u dropped, %u holds\n",
+          ring.highWater, ring.size, ring.maxPending, ring.dropped, ring.holds);
+   zuluide::i2c::client::PoolStats pools[OUTPUT_POOL_CLASSES];
+   zuluide::i2c::client::GetOutputPoolStats(pools);
+   printf("  output pool:");
+   for (int i = 0; i < OUTPUT_POOL_CLASSES; i++) {
+      printf(" %u B max %u/%u exhausted %u;", pools[i].payloadSize, pools[i].highWater, pools[i].capacity, pools[i].exhausted);
+   }
+
+   printf("\n  host: %.0f ns per message\n", messages > 0 ? hostNs / messages : 0.0);
+
+   ResetPhase();
+}
+
+static bool RunScenario(std::istream& script) {
+   std::string line;
+   while (std::getline(script, line)) {
+      std::istringstream tokens(line);
+      std::string command;
+      if (!(tokens >> command) || command[0] == '#') {
+         continue;
+      }
+
+      bool ok = true;
+      if (command == "clock") {
+         unsigned int hz;
+         tokens >> hz;
+         sim::BusSetClock(hz);
+      } else if (command == "overhead") {
+         unsigned int bits;
+         tokens >> bits;
+         sim::BusSetTransactionOverhead(bits);
+      } else if (command == "dma-stall") {
+         unsigned int every = 0;
+         tokens >> every;
+         sim::BusSetDmaStall(every);
+      } else if (command == "expect-tx-aborts") {
+         zuluide::i2c::client::LinkStats link;
+         zuluide::i2c::client::GetLinkStats(&link);
+         if (link.txAborts == 0) {
+            printf("Error: no transmit DMA transfers were aborted.\n");
+            ok = false;
+         }
+      } else if (command == "read-chunk") {
+         tokens >> server->Config().readChunk;
+      } else if (command == "server-speeds") {
+         tokens >> server->Config().speeds;
+      } else if (command == "noisy-above") {
+         tokens >> server->Config().noisyAboveHz;
+      } else if (command == "server-chunk") {
+         tokens >> server->Config().maxReadChunk;
+      } else if (command == "main-every") {
+         tokens >> mainEvery;
+         mainEvery = std::max(1u, mainEvery);
+      } else if (command == "retry-images") {
+         tokens >> retryImages;
+      } else if (command == "server-version") {
+         tokens >> server->Config().apiVersion;
+      } else if (command == "ssid") {
+         tokens >> server->Config().ssid;
+      } else if (command == "password") {
+         tokens >> server->Config().password;
+      } else if (command == "catalog") {
+         unsigned int nameLength;
+         tokens >> server->Config().catalogSize;
+         if (tokens >> nameLength) {
+            server->Config().nameLength = nameLength;
+         }
+      } else if (command == "handshake") {
+         // Same order as main(): SSID request first, then the API version.
+         Request(I2C_CLIENT_FETCH_SSID);
+         Request(I2C_CLIENT_API_VERSION, I2C_API_VERSION);
+         ok = Run([] { return passwordReceived; }, "handshake");
+      } else if (command == "status") {
+         unsigned int count = 0;
+         tokens >> count;
+         unsigned int target = statusReceived + count;
+         for (unsigned int i = 0; i < count; i++) {
+            server->PushStatus();
+         }
+
+         ok = Run([target] { return statusReceived + server->Corrupted(I2C_SERVER_SYSTEM_STATUS_JSON) >= target; }, "status");
+      } else if (command == "fetch-images" || command == "iterate") {
+         catalogDone = false;
+         catalogReceived = 0;
+         catalogPayloadBytes = 0;
+         catalogHostNs = 0;
+         catalogStartNs = sim::BusNowNs();
+         firstPageNs = 0;
+         if (command == "iterate") {
+            prefetchDepth = 1;
+            tokens >> prefetchDepth;
+            catalogReceived = carriedImages;
+            carriedImages = 0;
+            for (unsigned int i = 0; i < prefetchDepth; i++) {
+               iterationsInFlight++;
+               Request(I2C_CLIENT_FETCH_ITR_IMAGE);
+            }
+         } else {
+            zuluide::i2c::client::LinkStats link;
+            zuluide::i2c::client::GetLinkStats(&link);
+            if (link.catalogDiffs) {
+               // The first diff carries every record.
+               RequestCatalogDiff();
+            } else {
+               catalog.Clear();
+               Request(I2C_CLIENT_FETCH_IMAGES_JSON);
+            }
+         }
+
+         ok = Run([] { return catalogDone; }, command.c_str());
+         if (ok && command == "iterate") {
+            ok = Run([] { return iterationsInFlight == 0; }, "iterate drain");
+            printf("  iterate: prefetch depth %u, %u replies kept for the next pass\n", prefetchDepth, carriedImages);
+         }
+
+         if (ok && catalogReceived != server->Config().catalogSize) {
+            printf("Error: received %u of %u images.\n", catalogReceived, server->Config().catalogSize);
+            ok = false;
+         }
+
+         if (ok && command == "fetch-images") {
+            ok = CheckCatalog();
+         }
+      } else if (command == "catalog-diffs") {
+         server->Config().catalogDiffs = true;
+      } else if (command == "card-add" || command == "card-remove") {
+         unsigned int count = 0;
+         tokens >> count;
+         catalogDone = false;
+         syncPayloadBytes = 0;
+         auto before = catalogSync.Stats();
+         uint64_t startNs = sim::BusNowNs();
+         if (command == "card-add") {
+            server->AddImages(count);
+         } else {
+            server->RemoveImages(count);
+         }
+
+         ok = Run([] { return catalogDone; }, "catalog sync") && CheckSynced();
+         if (ok) {
+            auto after = catalogSync.Stats();
+            printf("  sync: %u added, %u removed%s in %.1f ms, %llu payload bytes against %zu for a full fetch\n",
+                   after.added - before.added, after.removed - before.removed,
+                   after.fullSyncs != before.fullSyncs ? " replacing the catalog" : "", (sim::BusNowNs() - startNs) / 1e6,
+                   (unsigned long long)syncPayloadBytes, catalog.Stats().bytes);
+         }
+      } else if (command == "load" || command == "load-long") {
+         unsigned int count = 1;
+         unsigned int length = 0;
+         std::string name;
+         if (command == "load") {
+            tokens >> name;
+         } else {
+            tokens >> count >> length;
+         }
+
+         for (unsigned int i = 0; i < count; i++) {
+            std::string image = command == "load" ? name : std::string(length, 'a' + i % 26);
+            unsigned int target = statusReceived + 1;
+            Request(I2C_CLIENT_LOAD_IMAGE, image.c_str());
+            ok = ok && Run([target] { return statusReceived >= target; }, "load");
+         }
+      } else if (command == "eject") {
+         unsigned int target = statusReceived + 1;
+         Request(I2C_CLIENT_EJECT_IMAGE);
+         ok = Run([target] { return statusReceived >= target; }, "eject");
+      } else if (command == "flash-hold") {
+         // Holds the link off for a flash operation lasting ms while a load is
+         // answered, as PersistToFlash does: only once the link is between
+         // messages, after which the server is refused until it resumes.
+         unsigned int ms = 0;
+         tokens >> ms;
+         unsigned int target = statusReceived + 1;
+         uint64_t naks = sim::GetBusStats().naks;
+         Request(I2C_CLIENT_LOAD_IMAGE, "held.iso");
+         uint64_t transactions = 0;
+         while (!zuluide::i2c::client::HoldOff() && ++transactions < 1000000) {
+            server->Step();
+            zuluide::i2c::client::ProcessMessages();
+         }
+
+         uint64_t endNs = sim::BusNowNs() + ms * 1000000ull;
+         while (sim::BusNowNs() < endNs) {
+            server->Step();
+         }
+
+         zuluide::i2c::client::ResumeLink();
+         ok = Run([target] { return statusReceived >= target; }, "flash hold");
+         naks = sim::GetBusStats().naks - naks;
+         printf("  flash hold: %u ms, %llu transactions refused\n", ms, (unsigned long long)naks);
+         if (ok && naks == 0) {
+            printf("Error: the link was not held off.\n");
+            ok = false;
+         }
+      } else if (command == "request-core") {
+         tokens >> requestCore;
+      } else if (command == "flash-credentials") {
+         std::string credentials = serverConfig.ssid + '\0' + serverConfig.password;
+         ok = flashStore.Begin(STORE_CREDENTIALS, credentials.length()) &&
+              flashStore.Write((const uint8_t*)credentials.data(), credentials.length()) && flashStore.Commit();
+         if (!ok) {
+            printf("Error: the credentials could not be saved.\n");
+         }
+      } else if (command == "flash-catalog") {
+         // Saves a catalog of the given size a page at a time, as
+         // PersistToFlash does, abandoning it after "abort" bytes if given as
+         // when the catalog changes part way through.
+         unsigned int bytes = 0;
+         unsigned int abortAt = UINT_MAX;
+         std::string option;
+         tokens >> bytes;
+         if (tokens >> option && option == "abort") {
+            tokens >> abortAt;
+         }
+
+         ok = flashStore.Begin(STORE_CATALOG, bytes);
+         std::vector<uint8_t> page(FLASH_PAGE_SIZE, 'c');
+         for (unsigned int written = 0; ok && written < bytes; written += FLASH_PAGE_SIZE) {
+            if (written >= abortAt) {
+               flashStore.Abort();
+               break;
+            }
+
+            ok = flashStore.Write(page.data(), std::min<size_t>(FLASH_PAGE_SIZE, bytes - written));
+         }
+
+         if (ok && flashStore.IsWriting()) {
+            ok = flashStore.Commit();
+         }
+
+         if (!ok) {
+            printf("Error: the catalog could not be saved.\n");
+         }
+      } else if (command == "flash-reload") {
+         // Mounts the store afresh, as after a reset, and checks the
+         // credentials are still there.
+         auto stats = flashStore.Stats();
+         flashStore = zuluide::FlashStore();
+         flashStore.Mount();
+         size_t length;
+         const uint8_t* saved = flashStore.Find(STORE_CREDENTIALS, &length);
+         std::string credentials = serverConfig.ssid + '\0' + serverConfig.password;
+         printf("  flash: %lu writes, %lu erases, %lu records dropped, %lu found on reload\n",
+                (unsigned long)stats.writes, (unsigned long)stats.erases, (unsigned long)stats.dropped,
+                (unsigned long)flashStore.Stats().mounted);
+         if (!saved || std::string((const char*)saved, length) != credentials) {
+            printf("Mismatch: the credentials were lost from flash.\n");
+            mismatches++;
+         }
+      } else if (command == "report") {
+         std::string label;
+         std::getline(tokens >> std::ws, label);
+         Report(label);
+      } else {
+         printf("Unknown scenario command: %s\n", command.c_str());
+         ok = false;
+      }
+
+      if (!ok) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+int main(int argc, char* argv[]) {
+   sim::EmulatedZuluIDE emulated(serverConfig);
+   server = &emulated;
+   server->onRequest = OnServerRead;
+
+   zuluide::i2c::client::Init(0, 1, 0x45, 100000, 1000000);
+   ResetPhase();
+
+   bool ok;
+   if (argc > 1) {
+      std::ifstream script(argv[1]);
+      if (!script) {
+         printf("Unable to open %s\n", argv[1]);
+         return 2;
+      }
+
+      ok = RunScenario(script);
+   } else {
+      std::istringstream script(defaultScenario);
+      ok = RunScenario(script);
+   }
+
+   const sim::BusStats& bus = sim::GetBusStats();
+   printf("total: %llu transactions, %llu underruns, %llu flushed bytes, %llu mismatches\n",
+          (unsigned long long)bus.transactions, (unsigned long long)bus.underruns,
+          (unsigned long long)bus.flushedBytes, (unsigned long long)mismatches);
+
+   return ok && mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+// Host flash for the simulation shim: erased bytes read 0xFF and
+// programming can only clear bits, as on the real part.
+
+#include "hardware/flash.h"
+
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static uint8_t* MapFlash() {
+   void* flash = mmap((void*)XIP_BASE, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+   if (flash != (void*)XIP_BASE) {
+      printf("Unable to map the simulated flash at 0x%x.\n", XIP_BASE);
+      exit(2);
+   }
+
+   memset(flash, 0xFF, PICO_FLASH_SIZE_BYTES);
+   return (uint8_t*)flash;
+}
+
+static uint8_t* const flash = MapFlash();
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+   memset(flash + flash_offs, 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+   for (size_t i = 0; i < count; i++) {
+      flash[flash_offs + i] &= data[i];
+   }
+}
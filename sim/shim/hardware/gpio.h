@@ -0,0 +1,39 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_SHIM_HARDWARE_GPIO_H
+#define SIM_SHIM_HARDWARE_GPIO_H
+
+#include <sys/types.h>
+
+enum gpio_function { GPIO_FUNC_I2C = 3 };
+
+enum gpio_drive_strength { GPIO_DRIVE_STRENGTH_2MA,
+                           GPIO_DRIVE_STRENGTH_4MA,
+                           GPIO_DRIVE_STRENGTH_8MA,
+                           GPIO_DRIVE_STRENGTH_12MA };
+
+static inline void gpio_init(uint gpio) {}
+static inline void gpio_set_function(uint gpio, enum gpio_function fn) {}
+static inline void gpio_pull_up(uint gpio) {}
+static inline void gpio_set_drive_strength(uint gpio, enum gpio_drive_strength drive) {}
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_SHIM_HARDWARE_I2C_H
+#define SIM_SHIM_HARDWARE_I2C_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/**
+   Emulated I2C block. The RX FIFO is filled by the emulated master and the
+   bytes written by the slave are collected for the master to read.
+ */
+typedef struct i2c_inst i2c_inst_t;
+
+typedef struct {
+   volatile uint32_t data_cmd;
+   volatile uint32_t status;
+   // The emulated block turns on and off at once, so its status is the enable
+   // bit itself and it is never disabled part way through a transaction.
+   union {
+      volatile uint32_t enable;
+      volatile uint32_t enable_status;
+   };
+} i2c_hw_t;
+
+#define I2C_IC_ENABLE_ENABLE_BITS 0x00000001u
+#define I2C_IC_ENABLE_STATUS_IC_EN_BITS 0x00000001u
+#define I2C_IC_ENABLE_STATUS_SLV_DISABLED_WHILE_BUSY_BITS 0x00000002u
+#define I2C_IC_STATUS_SLV_ACTIVITY_BITS 0x00000040u
+
+extern i2c_inst_t i2c0_inst;
+#define i2c0 (&i2c0_inst)
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate);
+uint i2c_set_baudrate(i2c_inst_t* i2c, uint baudrate);
+size_t i2c_get_read_available(i2c_inst_t* i2c);
+uint8_t i2c_read_byte_raw(i2c_inst_t* i2c);
+void i2c_write_raw_blocking(i2c_inst_t* i2c, const uint8_t* src, size_t len);
+void i2c_write_byte_raw(i2c_inst_t* i2c, uint8_t value);
+i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c);
+uint i2c_get_dreq(i2c_inst_t* i2c, bool is_tx);
+
+#endif
@@ -17,40 +17,23 @@
  *
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
-**/
-#ifndef INDEX_HTML_H
-#define INDEX_HTML_H
+ **/
 
-const char *index_html =  R"(
-@FILE_CONTENT@
-)";
+#ifndef SIM_SHIM_HARDWARE_SYNC_H
+#define SIM_SHIM_HARDWARE_SYNC_H
 
-const char *control_js = R"(
-@CONTROL_JS_CONTENT@
-)";
+#include <atomic>
+#include <cstdint>
 
-const char *control_2_js = R"(
-@CONTROL_2_JS_CONTENT@
-)";
+static inline void __dmb() {
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+}
 
-const char *version_js = R"(
-@VERSION_JS_CONTENT@
-)";
+// The simulation has no interrupts to hold off.
+static inline uint32_t save_and_disable_interrupts() {
+   return 0;
+}
 
-const char *style_css = R"(
-@STYLE_CSS_CONTENT@
-)";
+static inline void restore_interrupts(uint32_t) {}
 
-const char *style_2_css = R"(
-@STYLE_2_CSS_CONTENT@
-)";
-const char *style_3_css = R"(
-@STYLE_3_CSS_CONTENT@
-)";
-const char *style_4_css = R"(
-@STYLE_4_CSS_CONTENT@
-)";
-const char *style_rhc_css = R"(
-@STYLE_rhc_CSS_CONTENT@
-)";
-#endif
\ No newline at end of file
+#endif
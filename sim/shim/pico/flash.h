@@ -0,0 +1,38 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_SHIM_PICO_FLASH_H
+#define SIM_SHIM_PICO_FLASH_H
+
+#include <cstdint>
+
+#include "hardware/flash.h"
+
+#define PICO_OK 0
+
+// The simulation runs one core with no interrupts, so the function is
+// simply called.
+static inline int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms) {
+   func(param);
+   return PICO_OK;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_SHIM_PICO_I2C_SLAVE_H
+#define SIM_SHIM_PICO_I2C_SLAVE_H
+
+#include "hardware/i2c.h"
+
+typedef enum i2c_slave_event_t {
+   I2C_SLAVE_RECEIVE,
+   I2C_SLAVE_REQUEST,
+   I2C_SLAVE_FINISH,
+} i2c_slave_event_t;
+
+typedef void (*i2c_slave_handler_t)(i2c_inst_t* i2c, i2c_slave_event_t event);
+
+void i2c_slave_init(i2c_inst_t* i2c, uint8_t address, i2c_slave_handler_t handler);
+
+#endif
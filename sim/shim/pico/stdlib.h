@@ -0,0 +1,45 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_SHIM_PICO_STDLIB_H
+#define SIM_SHIM_PICO_STDLIB_H
+
+// Host stand-in for the subset of the Pico SDK used by the I2C client.
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+#include "hardware/gpio.h"
+
+/**
+   Returns the simulated time in microseconds. The clock is driven by the
+   emulated I2C bus so timings reflect bus time rather than host speed.
+ */
+uint64_t time_us_64();
+
+static inline uint32_t time_us_32() {
+   return (uint32_t)time_us_64();
+}
+
+static inline void tight_loop_contents() {}
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SIM_SHIM_PICO_UTIL_QUEUE_H
+#define SIM_SHIM_PICO_UTIL_QUEUE_H
+
+// Single threaded equivalent of the Pico SDK queue. The emulated interrupt
+// handler runs synchronously with the main loop so no locking is needed.
+
+#include <cstdint>
+#include <sys/types.h>
+
+typedef struct {
+   uint8_t* data;
+   uint16_t wptr;
+   uint16_t rptr;
+   uint16_t element_size;
+   uint16_t element_count;
+   uint16_t max_level;
+} queue_t;
+
+void queue_init(queue_t* q, uint element_size, uint element_count);
+void queue_free(queue_t* q);
+uint queue_get_level(queue_t* q);
+bool queue_try_add(queue_t* q, const void* data);
+bool queue_try_remove(queue_t* q, void* data);
+bool queue_try_peek(queue_t* q, void* data);
+
+static inline uint queue_get_max_level(queue_t* q) {
+   return q->max_level;
+}
+
+static inline void queue_reset_max_level(queue_t* q) {
+   q->max_level = queue_get_level(q);
+}
+
+static inline bool queue_is_empty(queue_t* q) {
+   return queue_get_level(q) == 0;
+}
+
+static inline bool queue_is_full(queue_t* q) {
+   return queue_get_level(q) == q->element_count;
+}
+
+#endif
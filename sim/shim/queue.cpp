@@ -0,0 +1,91 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+// Host implementation of the Pico SDK queue used by the simulation shim.
+
+#include "pico/util/queue.h"
+
+#include <cstdlib>
+#include <cstring>
+
+void queue_init(queue_t* q, uint element_size, uint element_count) {
+   q->data = (uint8_t*)calloc(element_count + 1, element_size);
+   q->element_count = (uint16_t)element_count;
+   q->element_size = (uint16_t)element_size;
+   q->wptr = 0;
+   q->rptr = 0;
+   q->max_level = 0;
+}
+
+void queue_free(queue_t* q) {
+   free(q->data);
+   q->data = NULL;
+}
+
+uint queue_get_level(queue_t* q) {
+   int rc = (int)q->wptr - (int)q->rptr;
+   if (rc < 0) {
+      rc += q->element_count + 1;
+   }
+
+   return (uint)rc;
+}
+
+static uint16_t inc_index(queue_t* q, uint16_t index) {
+   if (++index > q->element_count) {
+      index = 0;
+   }
+
+   return index;
+}
+
+bool queue_try_add(queue_t* q, const void* data) {
+   if (queue_get_level(q) == q->element_count) {
+      return false;
+   }
+
+   memcpy(q->data + q->wptr * q->element_size, data, q->element_size);
+   q->wptr = inc_index(q, q->wptr);
+   uint level = queue_get_level(q);
+   if (level > q->max_level) {
+      q->max_level = (uint16_t)level;
+   }
+
+   return true;
+}
+
+bool queue_try_peek(queue_t* q, void* data) {
+   if (q->wptr == q->rptr) {
+      return false;
+   }
+
+   memcpy(data, q->data + q->rptr * q->element_size, q->element_size);
+   return true;
+}
+
+bool queue_try_remove(queue_t* q, void* data) {
+   if (!queue_try_peek(q, data)) {
+      return false;
+   }
+
+   q->rptr = inc_index(q, q->rptr);
+   return true;
+}
@@ -0,0 +1,141 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "CatalogSync.h"
+
+#include <hardware/sync.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "Log.h"
+
+namespace zuluide {
+
+CatalogSync::CatalogSync(ImageCatalog* catalog)
+    : catalog(catalog),
+      generation(0),
+      announced(0),
+      holding(false),
+      requested(false),
+      recheck(false),
+      diverged(false),
+      stats() {
+}
+
+void CatalogSync::Request(char* payload, size_t size) {
+   if (holding) {
+      snprintf(payload, size, "%lu", (unsigned long)generation);
+   } else {
+      payload[0] = 0;
+   }
+
+   requested = true;
+}
+
+void CatalogSync::Restore(uint32_t generation) {
+   this->generation = generation;
+   holding = true;
+}
+
+bool CatalogSync::Held(uint32_t* generation) const {
+   bool held = holding;
+   __dmb();
+   *generation = this->generation;
+   return held;
+}
+
+SyncResult CatalogSync::Apply(const uint8_t* message, size_t length) {
+   if (length == 0) {
+      return SyncResult::None;
+   }
+
+   const uint8_t* data = message + 1;
+   size_t dataLength = length - 1;
+   switch (message[0]) {
+      case '?':
+         // Messages are NUL terminated.
+         announced = strtoul((const char*)data, NULL, 10);
+         if (requested) {
+            // The diff on its way may be older, check once it has arrived.
+            recheck = true;
+            return SyncResult::None;
+         }
+
+         return holding && announced == generation ? SyncResult::None : SyncResult::Outdated;
+      case '*':
+         catalog->Clear();
+         diverged = false;
+         stats.fullSyncs++;
+         return SyncResult::None;
+      case '+':
+         if (catalog->IsComplete()) {
+            catalog->Reopen();
+         }
+
+         if (catalog->Append(data, dataLength)) {
+            stats.added++;
+         } else {
+            LOG_ERROR("Out of memory adding image %zu to the catalog.\n", catalog->Count());
+            diverged = true;
+         }
+
+         return SyncResult::None;
+      case '-':
+         if (catalog->IsComplete()) {
+            catalog->Reopen();
+         }
+
+         if (catalog->Remove((const char*)data, dataLength)) {
+            stats.removed++;
+         } else {
+            diverged = true;
+         }
+
+         return SyncResult::None;
+      case '=':
+         // Held before the catalog is complete again, so a reader that sees
+         // it complete sees the generation it matches.
+         holding = false;
+         __dmb();
+         generation = strtoul((const char*)data, NULL, 10);
+         __dmb();
+         holding = !diverged;
+         if (!catalog->IsComplete()) {
+            catalog->Finish();
+         }
+
+         requested = false;
+         stats.syncs++;
+         if (diverged || (recheck && announced != generation)) {
+            // Not holding, the next request asks for every record.
+            recheck = false;
+            return SyncResult::Outdated;
+         }
+
+         recheck = false;
+         return SyncResult::Finished;
+      default:
+         return SyncResult::None;
+   }
+}
+
+}  // namespace zuluide
@@ -0,0 +1,115 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef CATALOG_SYNC_H
+#define CATALOG_SYNC_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ImageCatalog.h"
+
+namespace zuluide {
+
+/**
+   What applying a catalog diff message calls for.
+ */
+enum class SyncResult { None,
+                        // The server's catalog changed, or a diff could not
+                        // be applied and every record is needed, request a diff.
+                        Outdated,
+                        // The catalog matches the server's generation again.
+                        Finished };
+
+/**
+   Counts of the changes applied by catalog diffs.
+ */
+typedef struct {
+   uint32_t syncs;
+   // Syncs where the server sent every record because it could not diff.
+   uint32_t fullSyncs;
+   uint32_t added;
+   uint32_t removed;
+} CatalogSyncStats;
+
+/**
+   Keeps an image catalog in step with the ZuluIDE's using catalog diffs.
+   The ZuluIDE numbers each version of its catalog and, when the SD card
+   changes, announces the new generation. The client then asks for the
+   changes since the generation it holds and the server replies with one
+   message per change:
+
+      ?<generation>   the server's catalog is now at generation
+      *<generation>   every record follows, the catalog is replaced
+      +<record>       a record was added
+      -<filename>     the record with the file name was removed
+      =<generation>   the catalog is now at generation
+
+   Records are added at the end, as the server lists them.
+ */
+class CatalogSync {
+  public:
+   explicit CatalogSync(ImageCatalog* catalog);
+
+   /**
+      Writes the payload of a diff request, the generation held or nothing
+      to ask for every record, and notes a diff is on its way.
+    */
+   void Request(char* payload, size_t size);
+
+   /**
+      Applies one message of a diff to the catalog.
+    */
+   SyncResult Apply(const uint8_t* message, size_t length);
+
+   /**
+      Takes the catalog as matching a generation of the server's, as when it
+      is restored from flash.
+    */
+   void Restore(uint32_t generation);
+
+   /**
+      Returns true and the server generation the catalog matches, if known.
+      May be called from another context while diffs are applied: read while
+      the catalog is complete, it gives the generation of those records.
+    */
+   bool Held(uint32_t* generation) const;
+
+   bool IsRequested() const { return requested; }
+
+   CatalogSyncStats Stats() const { return stats; }
+
+  private:
+   ImageCatalog* catalog;
+   volatile uint32_t generation;
+   uint32_t announced;
+   volatile bool holding;
+   bool requested;
+   // Set when a generation is announced while a diff is on its way.
+   bool recheck;
+   // Set when a change could not be applied, so the next diff replaces the catalog.
+   bool diverged;
+   CatalogSyncStats stats;
+};
+
+}  // namespace zuluide
+
+#endif
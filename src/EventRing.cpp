@@ -0,0 +1,98 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "EventRing.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace zuluide {
+
+EventRing::EventRing() : head(0) {
+}
+
+void EventRing::Write(const char *data, size_t length) {
+   while (length > 0) {
+      size_t offset = head % EVENTS_RING_SIZE;
+      size_t part = length < EVENTS_RING_SIZE - offset ? length : EVENTS_RING_SIZE - offset;
+      memcpy(ring + offset, data, part);
+      head += part;
+      data += part;
+      length -= part;
+   }
+}
+
+uint64_t EventRing::Publish(const char *type, uint32_t id, const char *data, size_t length) {
+   uint64_t position = head;
+
+   char header[64];
+   int headerLength = snprintf(header, sizeof(header), "id: %lu\nevent: %s\ndata: ", (unsigned long)id, type);
+   Write(header, headerLength);
+
+   const char *line = data;
+   const char *end = data + length;
+   while (line < end) {
+      const char *newline = (const char *)memchr(line, '\n', end - line);
+      if (newline == NULL) {
+         Write(line, end - line);
+         break;
+      }
+
+      Write(line, newline - line);
+      Write("\ndata: ", 7);
+      line = newline + 1;
+   }
+
+   Write("\n\n", 2);
+   return position;
+}
+
+void EventRing::PublishHeartbeat() {
+   Write(":\n\n", 3);
+}
+
+int EventRing::Read(uint64_t *cursor, char *buffer, int count) const {
+   if (!Holds(*cursor)) {
+      return -1;
+   }
+
+   uint64_t available = head - *cursor;
+   int length = available < (uint64_t)count ? (int)available : count;
+   for (int copied = 0; copied < length;) {
+      size_t offset = (*cursor + copied) % EVENTS_RING_SIZE;
+      int part = length - copied;
+      if ((size_t)part > EVENTS_RING_SIZE - offset) {
+         part = EVENTS_RING_SIZE - offset;
+      }
+
+      memcpy(buffer + copied, ring + offset, part);
+      copied += part;
+   }
+
+   *cursor += length;
+   return length;
+}
+
+bool EventRing::Holds(uint64_t position) const {
+   return position <= head && head - position <= EVENTS_RING_SIZE;
+}
+
+}  // namespace zuluide
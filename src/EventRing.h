@@ -0,0 +1,85 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Bytes of formatted events kept for subscribers that are behind.
+#define EVENTS_RING_SIZE 8192
+
+namespace zuluide {
+
+/**
+   A ring of Server-Sent Events shared by every /events subscriber. Each event
+   is formatted once when it is published. Subscribers read it from the ring
+   at their own pace, each keeping the position of the next byte it will
+   read. Positions count every byte ever published, so a subscriber that
+   falls a whole ring behind can tell it has missed events.
+
+   Publish and Read must not run at the same time. The web server serializes
+   them with the lwIP lock.
+ */
+class EventRing {
+  public:
+   EventRing();
+
+   /**
+      Publishes an event with the given type and id. Line breaks in data are
+      sent as separate data lines. Returns the position of the event.
+    */
+   uint64_t Publish(const char *type, uint32_t id, const char *data, size_t length);
+
+   /**
+      Publishes a comment, which subscribers ignore, to keep idle connections
+      open.
+    */
+   void PublishHeartbeat();
+
+   /**
+      Copies up to count bytes from cursor into buffer and advances cursor.
+      Returns the number of bytes copied, or -1 if the subscriber fell so far
+      behind that events it has not read were overwritten.
+    */
+   int Read(uint64_t *cursor, char *buffer, int count) const;
+
+   /**
+      Returns true if the event at position has not been overwritten.
+    */
+   bool Holds(uint64_t position) const;
+
+   /**
+      The position of the next event published.
+    */
+   uint64_t Head() const { return head; }
+
+  private:
+   void Write(const char *data, size_t length);
+
+   char ring[EVENTS_RING_SIZE];
+   uint64_t head;
+};
+
+}  // namespace zuluide
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "EventScheduler.h"
+
+#include <hardware/sync.h>
+#include <hardware/timer.h>
+
+namespace zuluide {
+
+EventScheduler::EventScheduler()
+    : pending{}, postedUs{}, windowStart(0), windowSleepUs(0), windowWakeups(0), windowLatencyUs(0), windowMaxLatencyUs(0),
+      windowHandled(0), stats{} {
+}
+
+void EventScheduler::Post(unsigned int event) {
+   if (!pending[event]) {
+      postedUs[event] = time_us_32();
+      // The time must be written before the owner can see the event.
+      __dmb();
+      pending[event] = true;
+   }
+
+   __dmb();
+   __sev();
+}
+
+bool EventScheduler::IsPending() const {
+   for (int i = 0; i < EVENT_SCHEDULER_EVENTS; i++) {
+      if (pending[i]) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+int EventScheduler::Take() {
+   for (int i = 0; i < EVENT_SCHEDULER_EVENTS; i++) {
+      if (pending[i]) {
+         uint32_t posted = postedUs[i];
+         __dmb();
+         // Cleared before it is handled, so a post from here on is handled again.
+         pending[i] = false;
+         __dmb();
+
+         uint32_t latency = time_us_32() - posted;
+         windowLatencyUs += latency;
+         if (latency > windowMaxLatencyUs) {
+            windowMaxLatencyUs = latency;
+         }
+
+         windowHandled++;
+         Measure(time_us_64());
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+unsigned int EventScheduler::Next() {
+   int event = Take();
+   if (event >= 0) {
+      return event;
+   }
+
+   // Time spent in interrupt handlers while asleep counts as sleeping.
+   uint64_t start = time_us_64();
+   while (!IsPending()) {
+      __wfe();
+      windowWakeups++;
+   }
+
+   windowSleepUs += time_us_64() - start;
+   return Take();
+}
+
+void EventScheduler::Measure(uint64_t now) {
+   uint64_t elapsed = now - windowStart;
+   if (elapsed < EVENT_SCHEDULER_WINDOW_US) {
+      return;
+   }
+
+   if (windowStart != 0) {
+      stats.wakeupsPerSecond = (uint64_t)windowWakeups * 1000000 / elapsed;
+      stats.loadPercent = windowSleepUs < elapsed ? 100 - windowSleepUs * 100 / elapsed : 0;
+      stats.latencyUs = windowHandled > 0 ? windowLatencyUs / windowHandled : 0;
+      stats.maxLatencyUs = windowMaxLatencyUs;
+      stats.handled += windowHandled;
+   }
+
+   windowStart = now;
+   windowSleepUs = 0;
+   windowWakeups = 0;
+   windowLatencyUs = 0;
+   windowMaxLatencyUs = 0;
+   windowHandled = 0;
+}
+
+}  // namespace zuluide
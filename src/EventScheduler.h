@@ -0,0 +1,101 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef EVENT_SCHEDULER_H
+#define EVENT_SCHEDULER_H
+
+#include <cstdint>
+
+// Number of distinct events a scheduler holds.
+#define EVENT_SCHEDULER_EVENTS 9
+// Wakeups, load and latency are measured over this window.
+#define EVENT_SCHEDULER_WINDOW_US 1000000
+
+namespace zuluide {
+
+/**
+   Measurements of an EventScheduler over the last whole window.
+ */
+typedef struct {
+   uint32_t wakeupsPerSecond;
+   // Percent of the window spent handling events rather than sleeping.
+   uint32_t loadPercent;
+   // Mean and worst time from posting an event until it was taken.
+   uint32_t latencyUs;
+   uint32_t maxLatencyUs;
+   // Events handled up to the end of the window.
+   uint32_t handled;
+} EventSchedulerStats;
+
+/**
+   Lets a core sleep until there is work for it. Interrupt handlers, lwIP
+   callbacks, timers and the other core post events, which wakes the core,
+   and its main loop takes and handles them.
+
+   Each event is a flag, so posting one that is already pending does
+   nothing. Posting writes the flag and then sends an event (SEV), so a core
+   that checked the flags just before going to sleep (WFE) wakes straight
+   away. Any context on either core may post, only the owning core may take.
+ */
+class EventScheduler {
+  public:
+   EventScheduler();
+
+   /**
+      Marks event as pending and wakes the owning core.
+    */
+   void Post(unsigned int event);
+
+   /**
+      Clears and returns the lowest numbered pending event, or returns -1 if
+      none is pending.
+    */
+   int Take();
+
+   /**
+      Returns the next event, sleeping until one is posted.
+    */
+   unsigned int Next();
+
+   /**
+      The measurements of the last whole window.
+    */
+   EventSchedulerStats Stats() const { return stats; }
+
+  private:
+   bool IsPending() const;
+   void Measure(uint64_t now);
+
+   volatile bool pending[EVENT_SCHEDULER_EVENTS];
+   volatile uint32_t postedUs[EVENT_SCHEDULER_EVENTS];
+
+   uint64_t windowStart;
+   uint64_t windowSleepUs;
+   uint32_t windowWakeups;
+   uint64_t windowLatencyUs;
+   uint32_t windowMaxLatencyUs;
+   uint32_t windowHandled;
+   EventSchedulerStats stats;
+};
+
+}  // namespace zuluide
+
+#endif
@@ -0,0 +1,347 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "FlashStore.h"
+
+#include <pico/flash.h>
+#include <pico/stdlib.h>
+
+#include <cstring>
+
+#define FLASH_STORE_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_STORE_SIZE)
+#define FLASH_STORE_MAGIC 0x5453555a  // "ZUST"
+#define FLASH_STORE_TIMEOUT_MS 100
+
+namespace zuluide {
+
+static const uint8_t* const storeBase = (const uint8_t*)(XIP_BASE + FLASH_STORE_OFFSET);
+
+/**
+   Defines __flash_store_start, the address the store starts at, for
+   FlashStore.ld to check the program image ends below it.
+ */
+[[gnu::used]] static void DefineStoreStart() {
+   __asm__(".global __flash_store_start\n.equ __flash_store_start, %c0\n" : : "i"(XIP_BASE + FLASH_STORE_OFFSET));
+}
+
+/**
+   CRC-32 (IEEE) a nibble at a time, which needs only a 16 entry table.
+ */
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t length) {
+   static const uint32_t table[16] = {
+       0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+       0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+   for (size_t i = 0; i < length; i++) {
+      crc ^= data[i];
+      crc = (crc >> 4) ^ table[crc & 0xF];
+      crc = (crc >> 4) ^ table[crc & 0xF];
+   }
+
+   return crc;
+}
+
+/**
+   Flash operations run through flash_safe_execute, which keeps anything else
+   from running from flash while it is busy.
+ */
+typedef struct {
+   uint32_t offset;
+   const uint8_t* data;
+} FlashJob;
+
+static void EraseSector(void* param) {
+   flash_range_erase(((FlashJob*)param)->offset, FLASH_SECTOR_SIZE);
+}
+
+static void ProgramPage(void* param) {
+   FlashJob* job = (FlashJob*)param;
+   flash_range_program(job->offset, job->data, FLASH_PAGE_SIZE);
+}
+
+FlashStore::FlashStore()
+    : records(),
+      head(0),
+      erased(0),
+      sequence(1),
+      writing(false),
+      pending(),
+      pendingOffset(0),
+      written(0),
+      pageFill(0),
+      relocatedLength(),
+      relocate(),
+      stats() {
+   stats.size = FLASH_STORE_SIZE;
+}
+
+size_t FlashStore::RecordBytes(size_t length) {
+   // The header page and the payload rounded up to whole pages.
+   return FLASH_PAGE_SIZE + (length + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+}
+
+void FlashStore::Mount() {
+   uint64_t start = time_us_64();
+   uint32_t newest = 0;
+   bool found = false;
+   head = 0;
+   for (size_t offset = 0; offset + FLASH_PAGE_SIZE <= FLASH_STORE_SIZE;) {
+      const Header* header = (const Header*)(storeBase + offset);
+      if (header->magic != FLASH_STORE_MAGIC || header->type == 0 || header->type >= FLASH_STORE_TYPES ||
+          RecordBytes(header->length) > FLASH_STORE_SIZE - offset) {
+         offset += FLASH_PAGE_SIZE;
+         continue;
+      }
+
+      uint32_t crc = Crc32(0xFFFFFFFF, (const uint8_t*)&header->sequence, 3 * sizeof(uint32_t));
+      if (~Crc32(crc, storeBase + offset + FLASH_PAGE_SIZE, header->length) != header->crc) {
+         offset += FLASH_PAGE_SIZE;
+         continue;
+      }
+
+      // Sequence numbers are compared so they may wrap.
+      Record& record = records[header->type];
+      if (!record.valid || (int32_t)(header->sequence - record.sequence) > 0) {
+         record = {(uint32_t)offset, header->length, header->sequence, true};
+      }
+
+      if (!found || (int32_t)(header->sequence - newest) > 0) {
+         newest = header->sequence;
+         head = offset + RecordBytes(header->length);
+         found = true;
+      }
+
+      stats.mounted++;
+      offset += RecordBytes(header->length);
+   }
+
+   sequence = newest + 1;
+
+   // The rest of the newest record's last sector may hold one abandoned part way.
+   erased = (head + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+   for (size_t offset = head; offset < erased; offset++) {
+      if (storeBase[offset] != 0xFF) {
+         head = erased;
+         break;
+      }
+   }
+
+   if (head >= FLASH_STORE_SIZE) {
+      head = 0;
+      erased = 0;
+   }
+
+   stats.mountUs = time_us_64() - start;
+}
+
+const uint8_t* FlashStore::Find(uint8_t type, size_t* length) const {
+   if (type >= FLASH_STORE_TYPES || !records[type].valid) {
+      *length = 0;
+      return NULL;
+   }
+
+   *length = records[type].length;
+   return storeBase + records[type].offset + FLASH_PAGE_SIZE;
+}
+
+bool FlashStore::EnsureErased(size_t offset) {
+   while (offset >= erased) {
+      FlashJob job = {(uint32_t)(FLASH_STORE_OFFSET + erased), NULL};
+      if (flash_safe_execute(EraseSector, &job, FLASH_STORE_TIMEOUT_MS) != PICO_OK) {
+         return false;
+      }
+
+      erased += FLASH_SECTOR_SIZE;
+      stats.erases++;
+   }
+
+   return true;
+}
+
+bool FlashStore::Program(size_t offset, const uint8_t* data) {
+   if (!EnsureErased(offset)) {
+      return false;
+   }
+
+   FlashJob job = {(uint32_t)(FLASH_STORE_OFFSET + offset), data};
+   return flash_safe_execute(ProgramPage, &job, FLASH_STORE_TIMEOUT_MS) == PICO_OK;
+}
+
+void FlashStore::Release(size_t start, size_t end, uint8_t type) {
+   for (uint8_t t = 1; t < FLASH_STORE_TYPES; t++) {
+      Record& record = records[t];
+      if (!record.valid || record.offset >= end || record.offset + RecordBytes(record.length) <= start) {
+         continue;
+      }
+
+      // The record about to be written replaces one of its own type.
+      if (t != type) {
+         if (record.length <= FLASH_STORE_RELOCATE_MAX) {
+            memcpy(relocated[t], storeBase + record.offset + FLASH_PAGE_SIZE, record.length);
+            relocatedLength[t] = record.length;
+            relocate[t] = true;
+         } else {
+            stats.dropped++;
+         }
+      }
+
+      record.valid = false;
+   }
+}
+
+bool FlashStore::Relocate() {
+   bool moved = false;
+   for (uint8_t t = 1; t < FLASH_STORE_TYPES; t++) {
+      if (relocate[t]) {
+         relocate[t] = false;
+         moved = true;
+         if (!records[t].valid && !WriteRecord(t, relocated[t], relocatedLength[t])) {
+            stats.dropped++;
+         }
+      }
+   }
+
+   return moved;
+}
+
+bool FlashStore::Begin(uint8_t type, size_t length) {
+   size_t bytes = RecordBytes(length);
+   if (writing || type == 0 || type >= FLASH_STORE_TYPES || bytes > FLASH_STORE_SIZE - FLASH_SECTOR_SIZE) {
+      return false;
+   }
+
+   // Small records in the sectors still to be erased are written again
+   // ahead of this one, so they survive it being aborted or cut short by a
+   // reset. Doing so moves the head, which may reach further sectors.
+   do {
+      if (head + bytes > FLASH_STORE_SIZE) {
+         head = 0;
+         erased = 0;
+      }
+
+      size_t end = (head + bytes + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+      if (end > erased) {
+         Release(erased, end, type);
+      }
+   } while (Relocate());
+
+   // The header page is programmed last but must be erased before the payload follows it.
+   if (!EnsureErased(head)) {
+      return false;
+   }
+
+   pending = {FLASH_STORE_MAGIC, sequence, type, (uint32_t)length, 0};
+   pending.crc = Crc32(0xFFFFFFFF, (const uint8_t*)&pending.sequence, 3 * sizeof(uint32_t));
+   pendingOffset = head;
+   written = 0;
+   pageFill = 0;
+   writing = true;
+   return true;
+}
+
+bool FlashStore::Write(const uint8_t* data, size_t length) {
+   if (!writing || written + length > pending.length) {
+      return false;
+   }
+
+   pending.crc = Crc32(pending.crc, data, length);
+   written += length;
+   while (length > 0) {
+      size_t count = length < FLASH_PAGE_SIZE - pageFill ? length : FLASH_PAGE_SIZE - pageFill;
+      memcpy(page + pageFill, data, count);
+      pageFill += count;
+      data += count;
+      length -= count;
+      if (pageFill == FLASH_PAGE_SIZE) {
+         if (!Program(head + FLASH_PAGE_SIZE, page)) {
+            Abort();
+            return false;
+         }
+
+         head += FLASH_PAGE_SIZE;
+         pageFill = 0;
+      }
+   }
+
+   return true;
+}
+
+bool FlashStore::Commit() {
+   if (!writing || written != pending.length) {
+      return false;
+   }
+
+   if (pageFill > 0) {
+      memset(page + pageFill, 0xFF, FLASH_PAGE_SIZE - pageFill);
+      if (!Program(head + FLASH_PAGE_SIZE, page)) {
+         Abort();
+         return false;
+      }
+   }
+
+   pending.crc = ~pending.crc;
+   memset(page, 0xFF, FLASH_PAGE_SIZE);
+   memcpy(page, &pending, sizeof(pending));
+   if (!Program(pendingOffset, page)) {
+      Abort();
+      return false;
+   }
+
+   writing = false;
+   records[pending.type] = {(uint32_t)pendingOffset, pending.length, pending.sequence, true};
+   head = pendingOffset + RecordBytes(pending.length);
+   sequence++;
+   stats.writes++;
+   return true;
+}
+
+void FlashStore::Abort() {
+   if (!writing) {
+      return;
+   }
+
+   // The pages programmed so far cannot be used again until their sector is
+   // erased, so the next record starts on a fresh sector.
+   writing = false;
+   pageFill = 0;
+   head = erased;
+   if (head >= FLASH_STORE_SIZE) {
+      head = 0;
+      erased = 0;
+   }
+}
+
+bool FlashStore::WriteRecord(uint8_t type, const uint8_t* data, size_t length) {
+   return Begin(type, length) && Write(data, length) && Commit();
+}
+
+FlashStoreStats FlashStore::Stats() const {
+   FlashStoreStats result = stats;
+   result.liveBytes = 0;
+   for (uint8_t t = 1; t < FLASH_STORE_TYPES; t++) {
+      if (records[t].valid) {
+         result.liveBytes += RecordBytes(records[t].length);
+      }
+   }
+
+   return result;
+}
+
+}  // namespace zuluide
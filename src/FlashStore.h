@@ -0,0 +1,163 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include <hardware/flash.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Bytes at the end of flash kept for the store, a whole number of sectors.
+// The program image must end below them, which FlashStore.ld checks when the
+// firmware is linked.
+#ifndef FLASH_STORE_SIZE
+#define FLASH_STORE_SIZE (256 * 1024)
+#endif
+
+// Record types run from 1 to FLASH_STORE_TYPES - 1.
+#define FLASH_STORE_TYPES 4
+
+// Records up to this size are written again, ahead of the record that wraps
+// the log around onto them, larger ones are dropped.
+#define FLASH_STORE_RELOCATE_MAX 256
+
+namespace zuluide {
+
+/**
+   Usage and wear of the flash store.
+ */
+typedef struct {
+   size_t size;
+   // Bytes taken by the newest record of each type.
+   size_t liveBytes;
+   // Valid records found when the store was mounted, and the time it took.
+   uint32_t mounted;
+   uint32_t mountUs;
+   uint32_t writes;
+   uint32_t erases;
+   // Records lost because the log wrapped around onto them.
+   uint32_t dropped;
+} FlashStoreStats;
+
+/**
+   A log of typed records in the last FLASH_STORE_SIZE bytes of flash. Each
+   record starts on a page of its own holding its type, sequence number,
+   length and CRC, followed by the payload. New records are written after the
+   newest one, wrapping around to the start of the store, and the newest
+   valid record of each type is the one read back. The header is programmed
+   last, so a record cut short by a reset is never read.
+
+   Interrupts are disabled while a page is programmed or a sector erased, so
+   payload is written a piece at a time and the caller decides how to spread
+   the pieces out. On the Pico W's flash a sector erase stalls both cores for
+   45 ms typically and 400 ms at worst, and a page program for up to 3 ms. A
+   call erases at most one sector, so it stalls for about half a second at
+   worst, except a Begin that first writes small records back, which may
+   erase one more for each.
+ */
+class FlashStore {
+  public:
+   FlashStore();
+
+   /**
+      Scans the flash for the newest record of each type.
+    */
+   void Mount();
+
+   /**
+      Returns the payload of the newest record of a type, read in place from
+      flash, or NULL if there is none.
+    */
+   const uint8_t* Find(uint8_t type, size_t* length) const;
+
+   /**
+      Starts a record holding length bytes, returning false if it cannot fit
+      in the store.
+    */
+   bool Begin(uint8_t type, size_t length);
+
+   /**
+      Adds to the payload of the record being written, programming each page
+      as it fills.
+    */
+   bool Write(const uint8_t* data, size_t length);
+
+   /**
+      Writes the header once the whole payload has been written, making the
+      record the newest of its type.
+    */
+   bool Commit();
+
+   /**
+      Abandons the record being written.
+    */
+   void Abort();
+
+   bool IsWriting() const { return writing; }
+
+   FlashStoreStats Stats() const;
+
+  private:
+   typedef struct {
+      uint32_t magic;
+      uint32_t sequence;
+      uint32_t type;
+      uint32_t length;
+      uint32_t crc;
+   } Header;
+
+   typedef struct {
+      uint32_t offset;
+      uint32_t length;
+      uint32_t sequence;
+      bool valid;
+   } Record;
+
+   static size_t RecordBytes(size_t length);
+   bool EnsureErased(size_t offset);
+   bool Program(size_t offset, const uint8_t* data);
+   void Release(size_t start, size_t end, uint8_t type);
+   bool Relocate();
+   bool WriteRecord(uint8_t type, const uint8_t* data, size_t length);
+
+   Record records[FLASH_STORE_TYPES];
+   // Offset of the next free page, and of the end of the erased space after it.
+   size_t head;
+   size_t erased;
+   uint32_t sequence;
+   bool writing;
+   Header pending;
+   size_t pendingOffset;
+   size_t written;
+   uint8_t page[FLASH_PAGE_SIZE];
+   size_t pageFill;
+   // Small records the record being started overwrites, to write again before it.
+   uint8_t relocated[FLASH_STORE_TYPES][FLASH_STORE_RELOCATE_MAX];
+   size_t relocatedLength[FLASH_STORE_TYPES];
+   bool relocate[FLASH_STORE_TYPES];
+   FlashStoreStats stats;
+};
+
+}  // namespace zuluide
+
+#endif
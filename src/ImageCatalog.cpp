@@ -0,0 +1,525 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "ImageCatalog.h"
+
+#include <hardware/sync.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#define CATALOG_INITIAL_ARENA 4096
+#define CATALOG_INITIAL_ENTRIES 64
+
+namespace zuluide {
+
+ImageCatalog::ImageCatalog()
+    : arena(NULL),
+      used(0),
+      capacity(0),
+      offsets(NULL),
+      names(NULL),
+      sizes(NULL),
+      count(0),
+      offsetCapacity(0),
+      orders{NULL, NULL},
+      orderCapacity{0, 0},
+      sortedCount{0, 0},
+      sortedGeneration{0, 0},
+      peak(0),
+      generation(0),
+      complete(false),
+      version(0) {
+}
+
+ImageCatalog::~ImageCatalog() {
+   free(arena);
+   free(offsets);
+   free(names);
+   free(sizes);
+   free(orders[0]);
+   free(orders[1]);
+}
+
+void ImageCatalog::BeginChange() {
+   version = version + 1;
+   __dmb();
+}
+
+void ImageCatalog::EndChange() {
+   __dmb();
+   version = version + 1;
+}
+
+uint32_t ImageCatalog::ReadBegin() const {
+   uint32_t begun = version;
+   // A change takes no longer than moving the records, so wait it out.
+   while (begun & 1) {
+      begun = version;
+   }
+
+   __dmb();
+   return begun;
+}
+
+bool ImageCatalog::ReadValid(uint32_t begun) const {
+   __dmb();
+   return version == begun;
+}
+
+void ImageCatalog::Clear() {
+   BeginChange();
+   used = 0;
+   count = 0;
+   generation = generation + 1;
+   complete = false;
+   EndChange();
+}
+
+size_t ImageCatalog::IndexBytes() const {
+   return offsetCapacity * (sizeof(NameSpan) + sizeof(uint64_t)) + (orderCapacity[0] + orderCapacity[1]) * sizeof(uint32_t);
+}
+
+size_t ImageCatalog::Allocated() const {
+   return capacity + offsetCapacity * sizeof(uint32_t) + IndexBytes();
+}
+
+bool ImageCatalog::Reserve(size_t arenaSize, size_t entries) {
+   if (arenaSize <= capacity && entries <= offsetCapacity) {
+      return true;
+   }
+
+   // The records may move, so readers must not take what they read meanwhile.
+   BeginChange();
+   bool grown = Grow(arenaSize, entries);
+   EndChange();
+   return grown;
+}
+
+bool ImageCatalog::Grow(size_t arenaSize, size_t entries) {
+   if (arenaSize > capacity) {
+      size_t newCapacity = capacity > 0 ? capacity : CATALOG_INITIAL_ARENA;
+      // Grow by half to limit the slack left in a large catalog.
+      while (newCapacity < arenaSize) {
+         newCapacity += newCapacity / 2;
+      }
+
+      char* newArena = (char*)realloc(arena, newCapacity);
+      if (newArena == NULL) {
+         return false;
+      }
+
+      arena = newArena;
+      __dmb();
+      capacity = newCapacity;
+   }
+
+   if (entries > offsetCapacity) {
+      size_t newCapacity = offsetCapacity > 0 ? offsetCapacity + offsetCapacity / 2 : CATALOG_INITIAL_ENTRIES;
+      uint32_t* newOffsets = (uint32_t*)realloc(offsets, newCapacity * sizeof(uint32_t));
+      if (newOffsets == NULL) {
+         return false;
+      }
+
+      offsets = newOffsets;
+      NameSpan* newNames = (NameSpan*)realloc(names, newCapacity * sizeof(NameSpan));
+      if (newNames == NULL) {
+         return false;
+      }
+
+      names = newNames;
+      uint64_t* newSizes = (uint64_t*)realloc(sizes, newCapacity * sizeof(uint64_t));
+      if (newSizes == NULL) {
+         return false;
+      }
+
+      sizes = newSizes;
+      __dmb();
+      offsetCapacity = newCapacity;
+   }
+
+   peak = std::max(peak, Allocated());
+   return true;
+}
+
+bool ImageCatalog::Append(const uint8_t* record, size_t length) {
+   if (complete) {
+      // Writing over the closing bracket would leave readers unterminated JSON.
+      Reopen();
+   }
+
+   // Room for the separator (or opening bracket), the record, the closing
+   // bracket and NUL, and for where the record after it would start.
+   size_t entry = count;
+   if (!Reserve(used + length + 3, entry + 2)) {
+      return false;
+   }
+
+   arena[used] = entry == 0 ? '[' : ',';
+   size_t start = used + 1;
+   memcpy(arena + start, record, length);
+   used = start + length;
+   Index(entry, arena + start, length);
+   offsets[entry] = start;
+   offsets[entry + 1] = used + 1;
+
+   // Readers only see the record once it and its index are written.
+   __dmb();
+   count = entry + 1;
+   return true;
+}
+
+/**
+   Returns the text following key in the record, or NULL if the record does
+   not contain it.
+ */
+static const char* FindKey(const char* record, size_t length, const char* key) {
+   size_t keyLength = strlen(key);
+   for (size_t i = 0; i + keyLength <= length; i++) {
+      if (memcmp(record + i, key, keyLength) == 0) {
+         return record + i + keyLength;
+      }
+   }
+
+   return NULL;
+}
+
+void ImageCatalog::Index(size_t entry, const char* record, size_t length) {
+   const char* end = record + length;
+   names[entry] = {0, 0};
+   sizes[entry] = 0;
+
+   // The ZuluIDE sends the size after the name, so the search for it resumes there.
+   const char* rest = record;
+   const char* name = FindKey(record, length, "\"filename\":\"");
+   if (name != NULL) {
+      // The name ends at the first quote that is not escaped.
+      const char* c = name;
+      while (c < end && *c != '"') {
+         c += *c == '\\' ? 2 : 1;
+      }
+
+      if (c < end) {
+         names[entry] = {(uint16_t)(name - record), (uint16_t)(c - name)};
+         rest = c;
+      }
+   }
+
+   const char* size = FindKey(rest, end - rest, "\"size\":");
+   if (size == NULL && rest != record) {
+      size = FindKey(record, length, "\"size\":");
+   }
+
+   if (size != NULL) {
+      for (const char* c = size; c < end && isdigit(*c); c++) {
+         sizes[entry] = sizes[entry] * 10 + (*c - '0');
+      }
+   }
+}
+
+void ImageCatalog::Finish() {
+   if (complete) {
+      return;
+   }
+
+   if (count == 0 && !Reserve(3, 0)) {
+      return;
+   }
+
+   if (count == 0) {
+      arena[0] = '[';
+      used = 1;
+   }
+
+   arena[used] = ']';
+   arena[used + 1] = 0;
+   __dmb();
+   complete = true;
+}
+
+void ImageCatalog::Reopen() {
+   BeginChange();
+   if (count == 0) {
+      // Drop the opening bracket so the next record writes it again.
+      used = 0;
+   }
+
+   generation = generation + 1;
+   complete = false;
+   EndChange();
+}
+
+bool ImageCatalog::Remove(const char* name, size_t length) {
+   size_t entry = 0;
+   while (entry < count && !(names[entry].length == length && memcmp(arena + offsets[entry] + names[entry].start, name, length) == 0)) {
+      entry++;
+   }
+
+   if (entry == count) {
+      return false;
+   }
+
+   // Take the record out along with the comma before it, or after it for the
+   // first record, keeping the opening bracket in place.
+   size_t recordLength;
+   Entry(entry, &recordLength);
+   size_t start = entry > 0 ? offsets[entry] - 1 : offsets[entry];
+   size_t end = offsets[entry] + recordLength + (entry == 0 && count > 1 ? 1 : 0);
+   BeginChange();
+   memmove(arena + start, arena + end, used - end);
+   used = used - (end - start);
+   if (count == 1) {
+      // The next record writes the opening bracket again.
+      used = 0;
+   }
+
+   for (size_t i = entry + 1; i <= count; i++) {
+      offsets[i - 1] = offsets[i] - (end - start);
+      if (i < count) {
+         names[i - 1] = names[i];
+         sizes[i - 1] = sizes[i];
+      }
+   }
+
+   count = count - 1;
+   generation = generation + 1;
+   EndChange();
+   return true;
+}
+
+void ImageCatalog::Truncate(size_t entries) {
+   if (entries >= count) {
+      return;
+   }
+
+   BeginChange();
+   // The record kept last ends just before where the next one starts.
+   used = entries > 0 ? offsets[entries] - 1 : 0;
+   count = entries;
+   generation = generation + 1;
+   EndChange();
+}
+
+const char* ImageCatalog::Json() const {
+   return complete ? arena : "[]";
+}
+
+size_t ImageCatalog::JsonLength() const {
+   return complete ? used + 1 : 2;
+}
+
+const char* ImageCatalog::Json(size_t* length) const {
+   if (!complete) {
+      *length = 2;
+      return "[]";
+   }
+
+   size_t size = capacity;
+   const char* base = arena;
+   size_t jsonLength = used + 1;
+   if (jsonLength >= size) {
+      // Only while the catalog changes under a reader, which reads again.
+      *length = 0;
+      return "";
+   }
+
+   *length = jsonLength;
+   return base;
+}
+
+/**
+   Finds where the records from index to last lie in the arena, returning
+   false if the index does not add up, as may happen while the catalog
+   changes under a reader. Positions are checked against the capacity read
+   before the memory they point into.
+ */
+bool ImageCatalog::Locate(size_t index, size_t last, const char** base, size_t* start, size_t* end) const {
+   size_t entries = offsetCapacity;
+   size_t size = capacity;
+   const uint32_t* starts = offsets;
+   *base = arena;
+   if (last + 1 >= entries) {
+      return false;
+   }
+
+   // Records are separated by a single comma.
+   *start = starts[index];
+   *end = starts[last + 1] - 1;
+   return *start <= *end && *end <= size;
+}
+
+const char* ImageCatalog::Entry(size_t index, size_t* length) const {
+   if (index >= count) {
+      *length = 0;
+      return NULL;
+   }
+
+   const char* base;
+   size_t start;
+   size_t end;
+   if (!Locate(index, index, &base, &start, &end)) {
+      *length = 0;
+      return "";
+   }
+
+   *length = end - start;
+   return base + start;
+}
+
+const char* ImageCatalog::Range(size_t first, size_t count, size_t* length) const {
+   size_t entries = this->count;
+   const char* base;
+   size_t start;
+   size_t end;
+   size_t last = first + count < entries ? first + count - 1 : entries - 1;
+   if (first >= entries || count == 0 || !Locate(first, last, &base, &start, &end)) {
+      *length = 0;
+      return "";
+   }
+
+   *length = end - start;
+   return base + start;
+}
+
+/**
+   Returns the file name of a record and its length, empty if it does not
+   fit in the record.
+ */
+const char* ImageCatalog::Name(size_t entry, size_t* length) const {
+   const char* base;
+   size_t start;
+   size_t end;
+   if (!Locate(entry, entry, &base, &start, &end)) {
+      *length = 0;
+      return "";
+   }
+
+   NameSpan name = names[entry];
+   if (name.start + name.length > end - start) {
+      *length = 0;
+      return "";
+   }
+
+   *length = name.length;
+   return base + start + name.start;
+}
+
+/**
+   Compares two names ignoring case.
+ */
+static int CompareNames(const char* a, size_t aLength, const char* b, size_t bLength) {
+   int result = strncasecmp(a, b, std::min(aLength, bLength));
+   return result != 0 ? result : (int)aLength - (int)bLength;
+}
+
+const uint32_t* ImageCatalog::Order(CatalogSort sort, size_t entries) {
+   int order = sort == CatalogSort::Name ? 0 : 1;
+   uint32_t begun = ReadBegin();
+   uint32_t current = generation;
+   if (sortedCount[order] == entries && sortedGeneration[order] == current) {
+      return orders[order];
+   }
+
+   if (orderCapacity[order] < entries) {
+      uint32_t* newOrder = (uint32_t*)realloc(orders[order], entries * sizeof(uint32_t));
+      if (newOrder == NULL) {
+         return NULL;
+      }
+
+      orders[order] = newOrder;
+      orderCapacity[order] = entries;
+   }
+
+   uint32_t* indices = orders[order];
+   for (size_t i = 0; i < entries; i++) {
+      indices[i] = i;
+   }
+
+   // A heap sort stays within the indices even if the records change part
+   // way through and the comparisons stop adding up.
+   if (sort == CatalogSort::Name) {
+      auto byName = [this](uint32_t a, uint32_t b) {
+         size_t aLength;
+         size_t bLength;
+         const char* aName = Name(a, &aLength);
+         const char* bName = Name(b, &bLength);
+         int result = CompareNames(aName, aLength, bName, bLength);
+         return result != 0 ? result < 0 : a < b;
+      };
+      std::make_heap(indices, indices + entries, byName);
+      std::sort_heap(indices, indices + entries, byName);
+   } else {
+      const uint64_t* bySize = sizes;
+      auto bySizeThenIndex = [bySize](uint32_t a, uint32_t b) {
+         return bySize[a] != bySize[b] ? bySize[a] < bySize[b] : a < b;
+      };
+      std::make_heap(indices, indices + entries, bySizeThenIndex);
+      std::sort_heap(indices, indices + entries, bySizeThenIndex);
+   }
+
+   // An order built while the records changed is built again next time.
+   sortedCount[order] = ReadValid(begun) ? entries : 0;
+   sortedGeneration[order] = current;
+   return indices;
+}
+
+bool ImageCatalog::NameContains(size_t entry, const char* query, size_t length) const {
+   size_t nameLength;
+   const char* name = Name(entry, &nameLength);
+   for (size_t start = 0; start + length <= nameLength; start++) {
+      if (strncasecmp(name + start, query, length) == 0) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+size_t ImageCatalog::Search(const char* query, CatalogSort sort, size_t skip, uint32_t* matches, size_t max) {
+   // Falls back to catalog order if there is not enough memory to sort.
+   size_t entries = count;
+   const uint32_t* order = sort == CatalogSort::None ? NULL : Order(sort, entries);
+   size_t queryLength = strlen(query);
+   size_t found = 0;
+   for (size_t i = 0; i < entries; i++) {
+      size_t entry = order ? order[i] : i;
+      if (!NameContains(entry, query, queryLength)) {
+         continue;
+      }
+
+      if (found >= skip && found - skip < max) {
+         matches[found - skip] = entry;
+      }
+
+      found++;
+   }
+
+   return found;
+}
+
+CatalogStats ImageCatalog::Stats() const {
+   return {count, used, Allocated(), peak, IndexBytes()};
+}
+
+}  // namespace zuluide
@@ -0,0 +1,222 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef IMAGE_CATALOG_H
+#define IMAGE_CATALOG_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Records in a page of the catalog when the client does not ask for a number,
+// and the most it may ask for.
+#define CATALOG_PAGE_DEFAULT 50
+#define CATALOG_PAGE_MAX 200
+
+namespace zuluide {
+
+/**
+   Memory used by the image catalog.
+ */
+typedef struct {
+   size_t entries;
+   size_t bytes;
+   size_t capacity;
+   // Largest arena plus index allocation held at any time the records grew.
+   size_t peakBytes;
+   // Allocated for the name, size and sort order index.
+   size_t indexBytes;
+} CatalogStats;
+
+/**
+   Orders in which search results can be returned.
+ */
+enum class CatalogSort { None,
+                         Name,
+                         Size };
+
+/**
+   Stores the image records received from the I2C server in one contiguous
+   arena laid out as the JSON array served to clients ("[rec,rec,...]"), with
+   an index of where each record starts. Appending is amortized constant time
+   and the finished document needs no further copying. Records already
+   received can be read in pages while the rest are still arriving.
+
+   The file name and size of each record are indexed as it is appended, so
+   records can be searched by name and sorted without parsing the JSON again.
+   The sort orders are built when first asked for and kept until the records
+   change.
+
+   Only one context changes the catalog. Others, such as the other core, read
+   it under a sequence lock: they bracket their reads with ReadBegin and
+   ReadValid and read again if a change overlapped them. Appending a record
+   that fits leaves readers undisturbed, as its index entry is written before
+   the count that makes it visible. Growing the memory and moving, removing
+   or replacing records mark the catalog as changing while they run. Within
+   a read the accessors stay inside the memory they read from, but may return
+   records part way through a change until ReadValid confirms them.
+ */
+class ImageCatalog {
+  public:
+   ImageCatalog();
+   ~ImageCatalog();
+
+   /**
+      Empties the catalog, keeping the allocated memory for the next fetch.
+    */
+   void Clear();
+
+   /**
+      Appends a record, returning false if there is not enough memory. A
+      complete catalog is reopened first.
+    */
+   bool Append(const uint8_t* record, size_t length);
+
+   /**
+      Removes the record with the given file name, as it appears in the
+      record's JSON. Returns false if there is no such record.
+    */
+   bool Remove(const char* name, size_t length);
+
+   /**
+      Drops the records from index entries on.
+    */
+   void Truncate(size_t entries);
+
+   /**
+      Closes the JSON array once the last record is received. Does nothing if
+      the catalog is already complete.
+    */
+   void Finish();
+
+   /**
+      Opens a complete catalog for changes, which are visible once it is
+      finished again.
+    */
+   void Reopen();
+
+   bool IsComplete() const { return complete; }
+
+   /**
+      Changes whenever the catalog is cleared, reopened or records are
+      removed, so a reader can tell the records it started reading have been
+      replaced. Within a generation records are only ever appended.
+    */
+   uint32_t Generation() const { return generation; }
+
+   /**
+      The JSON array of all records, only valid once the catalog is complete.
+    */
+   const char* Json() const;
+
+   size_t JsonLength() const;
+
+   /**
+      The JSON array and its length, read together so a reader in another
+      context gets a length that fits the memory it points to.
+    */
+   const char* Json(size_t* length) const;
+
+   size_t Count() const { return count; }
+
+   /**
+      Returns the record at the given index and its length, NULL if there is
+      no such record.
+    */
+   const char* Entry(size_t index, size_t* length) const;
+
+   /**
+      Returns up to count records starting at index first, comma separated as
+      in the JSON array, and their total length. The memory holding the
+      records may move when more are appended, so the pointer is only valid
+      until the next Append.
+    */
+   const char* Range(size_t first, size_t count, size_t* length) const;
+
+   /**
+      Finds the records whose file name contains query, ignoring case, in the
+      given order. Skips the first skip matches and writes the indices of up
+      to max of the rest to matches. Returns the total number of matches. The
+      sort orders belong to the searching context, so only one may search.
+    */
+   size_t Search(const char* query, CatalogSort sort, size_t skip, uint32_t* matches, size_t max);
+
+   /**
+      Starts a read from another context than the one changing the catalog,
+      waiting out a change under way. Returns the value to pass to ReadValid.
+    */
+   uint32_t ReadBegin() const;
+
+   /**
+      True if the catalog did not change since ReadBegin returned begun, so
+      what was read in between can be used.
+    */
+   bool ReadValid(uint32_t begun) const;
+
+   CatalogStats Stats() const;
+
+  private:
+   /**
+      Where a record's file name starts, relative to the record, and its
+      length.
+    */
+   typedef struct {
+      uint16_t start;
+      uint16_t length;
+   } NameSpan;
+
+   void BeginChange();
+   void EndChange();
+   bool Reserve(size_t arenaSize, size_t entries);
+   bool Grow(size_t arenaSize, size_t entries);
+   size_t IndexBytes() const;
+   size_t Allocated() const;
+   void Index(size_t entry, const char* record, size_t length);
+   bool Locate(size_t index, size_t last, const char** base, size_t* start, size_t* end) const;
+   const char* Name(size_t entry, size_t* length) const;
+   const uint32_t* Order(CatalogSort sort, size_t entries);
+   bool NameContains(size_t entry, const char* query, size_t length) const;
+
+   // Written before the capacity that covers them, and read after it.
+   char* volatile arena;
+   volatile size_t used;
+   volatile size_t capacity;
+   // Where each record starts, and past the last one where the next would.
+   uint32_t* volatile offsets;
+   NameSpan* volatile names;
+   uint64_t* volatile sizes;
+   volatile size_t count;
+   volatile size_t offsetCapacity;
+   // Owned by the searching context. Record indices sorted by name and by
+   // size, valid for the first sortedCount[] records of sortedGeneration[].
+   uint32_t* orders[2];
+   size_t orderCapacity[2];
+   size_t sortedCount[2];
+   uint32_t sortedGeneration[2];
+   size_t peak;
+   volatile uint32_t generation;
+   volatile bool complete;
+   // Odd while a change is under way.
+   volatile uint32_t version;
+};
+
+}  // namespace zuluide
+
+#endif
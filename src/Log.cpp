@@ -0,0 +1,132 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "Log.h"
+
+#include <hardware/sync.h>
+#include <pico/platform.h>
+#include <pico/stdlib.h>
+#include <stdio.h>
+
+namespace zuluide::log {
+
+/**
+   The messages logged on one core. Only that core claims records, with
+   interrupts held off just long enough to take the slot so its interrupt
+   handlers may log too. Drain frees them from core 0.
+ */
+typedef struct {
+   Record records[LOG_RING_RECORDS];
+   volatile uint32_t head;
+   volatile uint32_t tail;
+   volatile uint32_t dropped;
+} Ring;
+
+static Ring rings[2];
+static uint32_t droppedReported;
+
+Record *Claim(uint8_t level, const char *format, uint32_t *slot) {
+   Ring *ring = &rings[get_core_num()];
+   uint32_t interrupts = save_and_disable_interrupts();
+   *slot = ring->head;
+   if (*slot - ring->tail >= LOG_RING_RECORDS) {
+      ring->dropped++;
+      restore_interrupts(interrupts);
+      return NULL;
+   }
+
+   ring->head = *slot + 1;
+   restore_interrupts(interrupts);
+
+   Record *record = &ring->records[*slot & (LOG_RING_RECORDS - 1)];
+   record->format = format;
+   record->strings = 0;
+   record->level = level;
+   record->timeUs = time_us_32();
+   return record;
+}
+
+void Commit(Record *record, uint32_t slot) {
+   // The contents must be visible before the record is.
+   __dmb();
+   record->sequence = slot + 1;
+}
+
+/**
+   Returns the oldest complete record on ring, or NULL if there is none.
+ */
+static Record *Oldest(Ring *ring) {
+   uint32_t tail = ring->tail;
+   Record *record = &ring->records[tail & (LOG_RING_RECORDS - 1)];
+   return record->sequence == tail + 1 ? record : NULL;
+}
+
+bool Drain(int count) {
+   uint32_t dropped = Dropped();
+   if (dropped != droppedReported) {
+      printf("%lu log messages dropped.\n", (unsigned long)(dropped - droppedReported));
+      droppedReported = dropped;
+   }
+
+   for (; count > 0; count--) {
+      Ring *ring = NULL;
+      Record *oldest = NULL;
+      for (auto &candidate : rings) {
+         Record *record = Oldest(&candidate);
+         if (record && (!oldest || (int32_t)(record->timeUs - oldest->timeUs) < 0)) {
+            ring = &candidate;
+            oldest = record;
+         }
+      }
+
+      if (!oldest) {
+         return false;
+      }
+
+      __dmb();
+      Record message = *oldest;
+      // Frees the slot for the logging core.
+      __dmb();
+      ring->tail = ring->tail + 1;
+
+      for (int i = 0; i < LOG_MAX_ARGS; i++) {
+         if (message.strings & (1 << i)) {
+            message.args[i] = (uintptr_t)(message.text + message.args[i]);
+         }
+      }
+
+      printf(message.format, message.args[0], message.args[1], message.args[2], message.args[3]);
+   }
+
+   for (auto &ring : rings) {
+      if (Oldest(&ring)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+uint32_t Dropped() {
+   return rings[0].dropped + rings[1].dropped;
+}
+
+}  // namespace zuluide::log
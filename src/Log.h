@@ -0,0 +1,198 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out (set by CMake).
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Records kept per core until they are drained, a power of two.
+#ifndef LOG_RING_RECORDS
+#define LOG_RING_RECORDS 32
+#endif
+
+// Arguments a message may take.
+#define LOG_MAX_ARGS 4
+// Bytes of each record holding copies of its string arguments, shared by
+// all of them. A string that does not fit ends in LOG_TRUNCATED.
+#ifndef LOG_TEXT_SIZE
+#define LOG_TEXT_SIZE 64
+#endif
+#define LOG_TRUNCATED "..."
+
+namespace zuluide::log {
+
+/**
+   A message waiting to be printed: its format and the raw arguments. String
+   arguments are copied into text, as the caller's buffer may be gone by the
+   time the message is printed.
+ */
+typedef struct {
+   const char *format;
+   uintptr_t args[LOG_MAX_ARGS];
+   // Bit i is set when args[i] is an offset into text.
+   uint8_t strings;
+   uint8_t level;
+   uint32_t timeUs;
+   char text[LOG_TEXT_SIZE];
+   // The slot number plus one once the record is complete.
+   volatile uint32_t sequence;
+} Record;
+
+/**
+   Claims the next record on the calling core's ring and stamps it. Returns
+   NULL, counting a dropped message, when the ring is full.
+ */
+Record *Claim(uint8_t level, const char *format, uint32_t *slot);
+
+/**
+   Hands a filled record to Drain.
+ */
+void Commit(Record *record, uint32_t slot);
+
+/**
+   Prints up to count waiting messages to stdio, oldest first across both
+   cores. Returns true if more are waiting. Only core 0's main loop may
+   drain.
+ */
+bool Drain(int count);
+
+/**
+   Messages dropped because a ring was full.
+ */
+uint32_t Dropped();
+
+template <typename T>
+static inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+Store(Record *record, int index, size_t &textUsed, T value) {
+   static_assert(sizeof(T) <= sizeof(uintptr_t), "Log arguments wider than a pointer would be truncated");
+   record->args[index] = (uintptr_t)value;
+}
+
+static inline void Store(Record *record, int index, size_t &textUsed, const char *value) {
+   if (textUsed >= LOG_TEXT_SIZE) {
+      // Out of room, the literal is printed in place of the string.
+      record->args[index] = (uintptr_t)LOG_TRUNCATED;
+      return;
+   }
+
+   size_t start = textUsed;
+   record->args[index] = start;
+   record->strings |= 1 << index;
+   while (*value && textUsed < LOG_TEXT_SIZE - 1) {
+      record->text[textUsed++] = *value++;
+   }
+
+   if (*value) {
+      // Cut short, so the tail says so.
+      size_t mark = textUsed - start < sizeof(LOG_TRUNCATED) - 1 ? start : textUsed - (sizeof(LOG_TRUNCATED) - 1);
+      memcpy(record->text + mark, LOG_TRUNCATED, textUsed - mark);
+   }
+
+   record->text[textUsed++] = '\0';
+}
+
+/**
+   Never called, only named in dead code by the LOG_ macros so the compiler
+   checks each format against its arguments as it would for printf.
+ */
+static inline void __attribute__((format(printf, 2, 3))) CheckFormat(uint8_t level, const char *format, ...) {}
+
+/**
+   Queues a message for Drain to print with printf. It takes no locks and
+   does no formatting or I/O, so it is safe from interrupt handlers and
+   either core. format must be a string literal, integer and string
+   arguments are stored by value.
+ */
+template <typename... Args>
+static inline void Write(uint8_t level, const char *format, Args... args) {
+   static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many arguments to log");
+
+   uint32_t slot;
+   Record *record = Claim(level, format, &slot);
+   if (record) {
+      [[maybe_unused]] int index = 0;
+      [[maybe_unused]] size_t textUsed = 0;
+      (Store(record, index++, textUsed, args), ...);
+      Commit(record, slot);
+   }
+}
+
+}  // namespace zuluide::log
+
+// Checks the format against the arguments and queues the message.
+#define LOG_WRITE(level, ...)                           \
+   do {                                                 \
+      if (0) {                                          \
+         zuluide::log::CheckFormat(level, __VA_ARGS__); \
+      }                                                 \
+      zuluide::log::Write(level, __VA_ARGS__);          \
+   } while (0)
+
+// Compiles out a message while still checking its arguments, so values only
+// logged are not reported as unused.
+#define LOG_DISCARD(level, ...)                         \
+   do {                                                 \
+      if (0) {                                          \
+         zuluide::log::CheckFormat(level, __VA_ARGS__); \
+         zuluide::log::Write(level, __VA_ARGS__);       \
+      }                                                 \
+   } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISCARD(LOG_LEVEL_ERROR, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISCARD(LOG_LEVEL_WARN, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISCARD(LOG_LEVEL_INFO, __VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISCARD(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+
+#endif
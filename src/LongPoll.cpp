@@ -0,0 +1,57 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "LongPoll.h"
+
+namespace zuluide::web {
+
+LongPoll::LongPoll() : held(false), sequence(0), deadline(0) {
+}
+
+void LongPoll::Hold(uint32_t sequence, uint64_t deadline) {
+   held = true;
+   this->sequence = sequence;
+   this->deadline = deadline;
+}
+
+bool LongPoll::IsDue(uint32_t sequence, uint64_t now) const {
+   return !held || sequence != this->sequence || now >= deadline;
+}
+
+LongPoll::Readiness LongPoll::Poll(uint32_t sequence, uint64_t now) {
+   if (!IsDue(sequence, now)) {
+      return Readiness::Waiting;
+   }
+
+   return Release() ? Readiness::Released : Readiness::Ready;
+}
+
+bool LongPoll::ShouldResume(uint32_t sequence, uint64_t now) const {
+   return held && IsDue(sequence, now);
+}
+
+bool LongPoll::Release() {
+   bool wasHeld = held;
+   held = false;
+   return wasHeld;
+}
+
+}  // namespace zuluide::web
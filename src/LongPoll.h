@@ -0,0 +1,95 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef LONG_POLL_H
+#define LONG_POLL_H
+
+#include <cstdint>
+
+namespace zuluide::web {
+
+/**
+   Holds a response until the status moves past a sequence number or a
+   deadline passes. lwIP httpd asks whether a response can be read before
+   every read and, while it cannot, waits to be resumed, so the check that
+   lets a held response continue and the check that resumes it must agree.
+   Both go through IsDue: httpd's read path calls Poll and the main loop
+   calls ShouldResume.
+ */
+class LongPoll {
+  public:
+   /**
+      What a read of the response finds.
+    */
+   enum class Readiness {
+      // Still held, the read is delayed.
+      Waiting,
+      // Released by this read, the response must be filled before sending.
+      Released,
+      // Not held, send as usual.
+      Ready
+   };
+
+   LongPoll();
+
+   /**
+      Holds the response while the status is at sequence, until deadline.
+    */
+   void Hold(uint32_t sequence, uint64_t deadline);
+
+   /**
+      Returns true while the response is held.
+    */
+   bool IsHeld() const { return held; }
+
+   /**
+      Returns true if the response can be sent: it is not held, the status
+      has moved past the sequence number it was held at, or the deadline has
+      passed.
+    */
+   bool IsDue(uint32_t sequence, uint64_t now) const;
+
+   /**
+      Called before each read of the response with the current status
+      sequence number. Releases the response once it is due.
+    */
+   Readiness Poll(uint32_t sequence, uint64_t now);
+
+   /**
+      Returns true if a read delayed by Poll should be resumed, as the next
+      Poll would release the response.
+    */
+   bool ShouldResume(uint32_t sequence, uint64_t now) const;
+
+   /**
+      Stops holding the response. Returns true if it was held.
+    */
+   bool Release();
+
+  private:
+   bool held;
+   uint32_t sequence;
+   uint64_t deadline;
+};
+
+}  // namespace zuluide::web
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "Metrics.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+static const uint32_t latencyBoundsMs[METRICS_LATENCY_BUCKETS] = METRICS_LATENCY_BOUNDS_MS;
+
+namespace zuluide {
+
+LatencyHistogram::LatencyHistogram() : buckets{}, count(0), sumUs(0) {
+}
+
+void LatencyHistogram::Observe(uint32_t us) {
+   int bucket = 0;
+   while (bucket < METRICS_LATENCY_BUCKETS && us > latencyBoundsMs[bucket] * 1000) {
+      bucket++;
+   }
+
+   buckets[bucket]++;
+   sumUs += us;
+   count++;
+}
+
+uint32_t LatencyHistogram::Cumulative(int bucket) const {
+   uint32_t total = 0;
+   for (int i = 0; i <= bucket; i++) {
+      total += buckets[i];
+   }
+
+   return total;
+}
+
+MetricsWriter::MetricsWriter(char *buffer, size_t size) : buffer(buffer), size(size), length(0), truncated(false) {
+   if (size > 0) {
+      buffer[0] = 0;
+   }
+}
+
+void MetricsWriter::Line(const char *format, ...) {
+   if (truncated) {
+      return;
+   }
+
+   va_list args;
+   va_start(args, format);
+   int written = vsnprintf(buffer + length, size - length, format, args);
+   va_end(args);
+
+   if (written < 0 || (size_t)written >= size - length) {
+      // Keep the output to whole lines.
+      buffer[length] = 0;
+      truncated = true;
+      return;
+   }
+
+   length += written;
+}
+
+void MetricsWriter::Family(const char *name, const char *type, const char *help) {
+   Line("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsWriter::Sample(const char *name, const char *labels, uint64_t value) {
+   if (labels == NULL) {
+      Line("%s %llu\n", name, (unsigned long long)value);
+   } else {
+      Line("%s{%s} %llu\n", name, labels, (unsigned long long)value);
+   }
+}
+
+void MetricsWriter::Histogram(const char *name, const char *labels, const LatencyHistogram &histogram) {
+   const char *separator = labels == NULL ? "" : ",";
+   if (labels == NULL) {
+      labels = "";
+   }
+
+   for (int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+      uint32_t bound = latencyBoundsMs[i];
+      Line("%s_bucket{%s%sle=\"%lu.%03lu\"} %lu\n", name, labels, separator, (unsigned long)(bound / 1000),
+           (unsigned long)(bound % 1000), (unsigned long)histogram.Cumulative(i));
+   }
+
+   Line("%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, separator, (unsigned long)histogram.Cumulative(METRICS_LATENCY_BUCKETS));
+
+   uint64_t sum = histogram.SumUs();
+   const char *open = *labels == 0 ? "" : "{";
+   const char *close = *labels == 0 ? "" : "}";
+   Line("%s_sum%s%s%s %llu.%06llu\n", name, open, labels, close, (unsigned long long)(sum / 1000000),
+        (unsigned long long)(sum % 1000000));
+   Line("%s_count%s%s%s %lu\n", name, open, labels, close, (unsigned long)histogram.Count());
+}
+
+}  // namespace zuluide
@@ -0,0 +1,102 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Upper bounds of the latency histogram buckets in milliseconds, below +Inf.
+#define METRICS_LATENCY_BUCKETS 7
+#define METRICS_LATENCY_BOUNDS_MS {5, 25, 100, 500, 2500, 10000, 30000}
+
+namespace zuluide {
+
+/**
+   Counts observed latencies in buckets, as a Prometheus histogram. Only one
+   context may observe. A reader may see one observation counted in some
+   fields and not yet in others.
+ */
+class LatencyHistogram {
+  public:
+   LatencyHistogram();
+
+   void Observe(uint32_t us);
+
+   /**
+      Observations no slower than the upper bound of bucket, or all of them
+      for bucket METRICS_LATENCY_BUCKETS (+Inf).
+    */
+   uint32_t Cumulative(int bucket) const;
+
+   uint32_t Count() const { return count; }
+   uint64_t SumUs() const { return sumUs; }
+
+  private:
+   uint32_t buckets[METRICS_LATENCY_BUCKETS + 1];
+   uint32_t count;
+   uint64_t sumUs;
+};
+
+/**
+   Formats metrics in the Prometheus text exposition format into a buffer. A
+   line that does not fit is dropped whole, and the rest are skipped.
+ */
+class MetricsWriter {
+  public:
+   MetricsWriter(char *buffer, size_t size);
+
+   /**
+      Starts a metric family with its type ("counter", "gauge" or
+      "histogram") and help text.
+    */
+   void Family(const char *name, const char *type, const char *help);
+
+   /**
+      Writes a sample. labels is a list such as route="/status.json", or NULL.
+    */
+   void Sample(const char *name, const char *labels, uint64_t value);
+
+   /**
+      Writes the buckets, sum and count of a histogram in seconds.
+    */
+   void Histogram(const char *name, const char *labels, const LatencyHistogram &histogram);
+
+   size_t Length() const { return length; }
+
+   /**
+      True if some lines did not fit.
+    */
+   bool Truncated() const { return truncated; }
+
+  private:
+   void Line(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+   char *buffer;
+   size_t size;
+   size_t length;
+   bool truncated;
+};
+
+}  // namespace zuluide
+
+#endif
@@ -0,0 +1,302 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "RequestHeaders.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+
+#include "lwip/apps/httpd.h"
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/tcp.h"
+
+namespace zuluide::web {
+
+/**
+   The headers of interest seen on one connection, for its latest request.
+ */
+typedef struct {
+   const struct tcp_pcb *pcb;
+   // The path of the request line, without the query.
+   char path[REQUEST_PATH_MAX];
+   bool acceptsGzip;
+   char ifNoneMatch[REQUEST_LINE_MAX];
+   char cookie[REQUEST_LINE_MAX];
+   // The line being received, carried over when a segment ends within it.
+   char line[REQUEST_LINE_MAX];
+   size_t lineLength;
+   // Set from the request line until the blank line ending the headers.
+   bool inHeaders;
+   // Orders the requests whose headers have all arrived and that have not
+   // been selected yet, 0 for none.
+   uint32_t ready;
+} RequestState;
+
+static RequestState requests[MEMP_NUM_TCP_PCB];
+static unsigned int nextRequest = 0;
+static uint32_t readyCount = 0;
+static RequestState *currentRequest = NULL;
+
+static void ResetRequest(RequestState *request) {
+   request->path[0] = 0;
+   request->acceptsGzip = false;
+   request->ifNoneMatch[0] = 0;
+   request->cookie[0] = 0;
+   request->inHeaders = false;
+   request->ready = 0;
+}
+
+/**
+   True if the slot holds nothing httpd may still ask for: no connection, or
+   one between requests with no unread headers.
+ */
+static bool IsIdle(const RequestState *request) {
+   return request->pcb == NULL ||
+      (!request->inHeaders && request->ready == 0 && request->lineLength == 0 && request != currentRequest);
+}
+
+static void ClaimRequest(RequestState *request, const struct tcp_pcb *pcb) {
+   if (request == currentRequest) {
+      currentRequest = NULL;
+   }
+
+   request->pcb = pcb;
+   request->lineLength = 0;
+   ResetRequest(request);
+}
+
+static RequestState *FindRequest(const struct tcp_pcb *pcb) {
+   for (auto &request : requests) {
+      if (request.pcb == pcb) {
+         return &request;
+      }
+   }
+
+   // Take a free slot, then an idle one, and only when every slot is mid
+   // request evict the one round robin reaches next.
+   RequestState *request = NULL;
+   for (auto &candidate : requests) {
+      if (candidate.pcb == NULL) {
+         request = &candidate;
+         break;
+      }
+   }
+
+   for (size_t i = 0; request == NULL && i < MEMP_NUM_TCP_PCB; i++) {
+      RequestState *candidate = &requests[(nextRequest + i) % MEMP_NUM_TCP_PCB];
+      if (IsIdle(candidate)) {
+         request = candidate;
+      }
+   }
+
+   if (request == NULL) {
+      request = &requests[nextRequest];
+   }
+
+   nextRequest = (request - requests + 1) % MEMP_NUM_TCP_PCB;
+   ClaimRequest(request, pcb);
+   return request;
+}
+
+/**
+   Returns true if line starts with the given header name, ignoring case,
+   and points value at the text after the colon.
+ */
+static bool IsHeader(const char *line, const char *name, const char **value) {
+   size_t length = strlen(name);
+   if (strncasecmp(line, name, length) != 0 || line[length] != ':') {
+      return false;
+   }
+
+   *value = line + length + 1;
+   while (**value == ' ') {
+      (*value)++;
+   }
+
+   return true;
+}
+
+static void ScanLine(RequestState *request, char *line) {
+   const char *value;
+   if (!request->inHeaders && strstr(line, " HTTP/") != NULL) {
+      // A new request on this connection, "METHOD /path?query HTTP/1.x".
+      ResetRequest(request);
+      request->inHeaders = true;
+      const char *path = strchr(line, ' ') + 1;
+      size_t length = strcspn(path, " ?");
+      if (length >= sizeof(request->path)) {
+         length = sizeof(request->path) - 1;
+      }
+
+      memcpy(request->path, path, length);
+      request->path[length] = 0;
+   } else if (!request->inHeaders) {
+      // Body text or stray bytes between requests, not headers.
+   } else if (IsHeader(line, "If-None-Match", &value)) {
+      strncpy(request->ifNoneMatch, value, sizeof(request->ifNoneMatch) - 1);
+      request->ifNoneMatch[sizeof(request->ifNoneMatch) - 1] = 0;
+   } else if (IsHeader(line, "Cookie", &value)) {
+      strncpy(request->cookie, value, sizeof(request->cookie) - 1);
+      request->cookie[sizeof(request->cookie) - 1] = 0;
+   } else if (IsHeader(line, "Accept-Encoding", &value)) {
+      for (char *c = line; *c; c++) {
+         *c = tolower(*c);
+      }
+
+      request->acceptsGzip = strstr(value, "gzip") != NULL;
+   }
+}
+
+/**
+   Returns true if httpd opening name serves a request for path: the same
+   path, or the default file of a directory.
+ */
+static bool ServesPath(const char *path, const char *name) {
+   size_t length = strlen(path);
+   if (length > 0 && path[length - 1] == '/') {
+      return strncmp(name, path, length) == 0 && strchr(name + length, '/') == NULL;
+   }
+
+   return strcmp(name, path) == 0;
+}
+
+void SelectRequest(const char *path) {
+   RequestState *oldest = NULL;
+   for (auto &request : requests) {
+      if (request.ready != 0 && ServesPath(request.path, path) &&
+          (!oldest || (int32_t)(request.ready - oldest->ready) < 0)) {
+         oldest = &request;
+      }
+   }
+
+   if (oldest) {
+      oldest->ready = 0;
+      currentRequest = oldest;
+   }
+}
+
+bool RequestAcceptsGzip() {
+   return currentRequest && currentRequest->acceptsGzip;
+}
+
+bool RequestMatchesETag(const char *etag) {
+   if (!currentRequest || currentRequest->ifNoneMatch[0] == 0) {
+      return false;
+   }
+
+   // Either the wildcard or a list of (possibly weak) tags.
+   return strcmp(currentRequest->ifNoneMatch, "*") == 0 || strstr(currentRequest->ifNoneMatch, etag) != NULL;
+}
+
+bool RequestCookie(const char *name, char *value, size_t size) {
+   if (!currentRequest) {
+      return false;
+   }
+
+   // Cookies are sent as "name=value; name=value".
+   size_t length = strlen(name);
+   for (const char *cookie = currentRequest->cookie; *cookie; cookie++) {
+      while (*cookie == ' ') {
+         cookie++;
+      }
+
+      if (strncmp(cookie, name, length) == 0 && cookie[length] == '=') {
+         const char *start = cookie + length + 1;
+         size_t valueLength = strcspn(start, ";");
+         if (valueLength >= size) {
+            valueLength = size - 1;
+         }
+
+         memcpy(value, start, valueLength);
+         value[valueLength] = 0;
+         return true;
+      }
+
+      cookie += strcspn(cookie, ";");
+      if (*cookie == 0) {
+         break;
+      }
+   }
+
+   return false;
+}
+
+/**
+   Feeds in order segment data through the line scanner.
+ */
+static void ScanSegment(RequestState *request, const struct pbuf *p) {
+   for (const struct pbuf *q = p; q != NULL; q = q->next) {
+      const char *data = (const char *)q->payload;
+      for (u16_t i = 0; i < q->len; i++) {
+         if (data[i] == '\n') {
+            if (request->lineLength > 0) {
+               request->line[request->lineLength] = 0;
+               ScanLine(request, request->line);
+               request->lineLength = 0;
+            } else if (request->inHeaders) {
+               // The blank line, the request is complete.
+               request->inHeaders = false;
+               request->ready = ++readyCount;
+            }
+         } else if (data[i] != '\r' && request->lineLength < sizeof(request->line) - 1) {
+            request->line[request->lineLength++] = data[i];
+         }
+      }
+   }
+}
+
+}  // namespace zuluide::web
+
+using namespace zuluide::web;
+
+err_t zuluide_web_scan_request(struct tcp_pcb *pcb, const struct tcp_hdr *hdr, struct pbuf *p) {
+   // The hook sees every TCP segment; only httpd's connections are scanned,
+   // not the WebSocket port or the listening PCB itself.
+   if (pcb->local_port != HTTPD_SERVER_PORT || pcb->state == LISTEN) {
+      return ERR_OK;
+   }
+
+   // A PCB still in SYN_RCVD is a new connection, possibly at the address of
+   // a closed one, so it never inherits that connection's slot state.
+   RequestState *request = FindRequest(pcb);
+   if (pcb->state == SYN_RCVD) {
+      ClaimRequest(request, pcb);
+   }
+
+   // Only new data in order is scanned, so a retransmission is not seen
+   // twice and a line split across segments joins up. tcp_input has already
+   // converted the header to host byte order.
+   if (p != NULL && p->tot_len > 0 && hdr->seqno == pcb->rcv_nxt) {
+      ScanSegment(request, p);
+   }
+
+   // Once the peer closes or resets, the slot is freed unless it still holds
+   // a request httpd has yet to open.
+   if ((TCPH_FLAGS(hdr) & (TCP_FIN | TCP_RST)) != 0 && request->ready == 0 && request != currentRequest) {
+      request->pcb = NULL;
+   }
+
+   return ERR_OK;
+}
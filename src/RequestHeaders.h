@@ -0,0 +1,70 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef REQUEST_HEADERS_H
+#define REQUEST_HEADERS_H
+
+#include <cstddef>
+
+#include "lwip_hooks.h"
+
+// Longest header line that is examined, longer lines are truncated.
+#define REQUEST_LINE_MAX 128
+// Longest request path that is matched against the file httpd opens.
+#define REQUEST_PATH_MAX 64
+
+namespace zuluide::web {
+
+/**
+   Makes the request for path the one the functions below answer for.
+
+   lwIP's httpd does not pass the request headers, or the connection, to
+   fs_open_custom or the CGI handlers, so the headers are picked out of the
+   TCP segments as they arrive, a line at a time even when a line is split
+   across segments. A request is ready once its blank line arrives. This
+   picks the oldest ready request for path, or for a directory path the
+   default file httpd opens for it, and marks it served. When there is none,
+   as for the error page or a CGI handler's response file, the request
+   selected last stays selected.
+ */
+void SelectRequest(const char *path);
+
+/**
+   Returns true if the selected request accepts a gzip encoded response.
+ */
+bool RequestAcceptsGzip();
+
+/**
+   Returns true if the If-None-Match header of the selected request
+   lists the given quoted entity tag, meaning the client's copy is current.
+ */
+bool RequestMatchesETag(const char *etag);
+
+/**
+   Copies the value of the named cookie sent with the selected request
+   into value as a NUL terminated string. Returns false if the request did
+   not send it.
+ */
+bool RequestCookie(const char *name, char *value, size_t size);
+
+}  // namespace zuluide::web
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "SpscRing.h"
+
+#include <cstring>
+
+static_assert((SPSC_RING_SIZE & (SPSC_RING_SIZE - 1)) == 0, "SPSC_RING_SIZE must be a power of two");
+
+namespace zuluide {
+
+SpscRing::SpscRing() : head(0), tail(0), stats{} {
+}
+
+bool SpscRing::Push(uint8_t command, const uint8_t *data, size_t length) {
+   uint32_t position = head.load(std::memory_order_relaxed);
+   uint32_t used = position - tail.load(std::memory_order_acquire);
+   if (length > UINT16_MAX || used + SPSC_HEADER_SIZE + length > SPSC_RING_SIZE) {
+      stats.dropped++;
+      return false;
+   }
+
+   uint8_t header[SPSC_HEADER_SIZE] = {command, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+   const uint8_t *parts[2] = {header, data};
+   size_t lengths[2] = {SPSC_HEADER_SIZE, length};
+   for (int i = 0; i < 2; i++) {
+      for (size_t written = 0; written < lengths[i];) {
+         size_t offset = (position + written) & (SPSC_RING_SIZE - 1);
+         size_t part = lengths[i] - written;
+         if (part > SPSC_RING_SIZE - offset) {
+            part = SPSC_RING_SIZE - offset;
+         }
+
+         memcpy(ring + offset, parts[i] + written, part);
+         written += part;
+      }
+
+      position += lengths[i];
+   }
+
+   // Releases the message bytes to the consumer.
+   head.store(position, std::memory_order_release);
+
+   stats.pushed++;
+   used += SPSC_HEADER_SIZE + length;
+   if (used > stats.highWater) {
+      stats.highWater = used;
+   }
+
+   return true;
+}
+
+bool SpscRing::Fits(size_t length) const {
+   uint32_t used = head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire);
+   return length <= UINT16_MAX && used + SPSC_HEADER_SIZE + length <= SPSC_RING_SIZE;
+}
+
+void SpscRing::Copy(uint32_t position, uint8_t *data, size_t length) const {
+   for (size_t copied = 0; copied < length;) {
+      size_t offset = (position + copied) & (SPSC_RING_SIZE - 1);
+      size_t part = length - copied;
+      if (part > SPSC_RING_SIZE - offset) {
+         part = SPSC_RING_SIZE - offset;
+      }
+
+      memcpy(data + copied, ring + offset, part);
+      copied += part;
+   }
+}
+
+bool SpscRing::Pop(uint8_t *command, uint8_t *buffer, size_t size, size_t *length) {
+   uint32_t position = tail.load(std::memory_order_relaxed);
+   if (position == head.load(std::memory_order_acquire)) {
+      return false;
+   }
+
+   uint8_t header[SPSC_HEADER_SIZE];
+   Copy(position, header, SPSC_HEADER_SIZE);
+   size_t messageLength = header[1] | (header[2] << 8);
+   *command = header[0];
+   *length = messageLength < size ? messageLength : size;
+   Copy(position + SPSC_HEADER_SIZE, buffer, *length);
+
+   // Hands the space back to the producer once the message is copied out.
+   tail.store(position + SPSC_HEADER_SIZE + messageLength, std::memory_order_release);
+   return true;
+}
+
+bool SpscRing::IsEmpty() const {
+   return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+}
+
+SpscRingStats SpscRing::Stats() const {
+   return stats;
+}
+
+}  // namespace zuluide
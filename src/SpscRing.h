@@ -0,0 +1,98 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bytes of messages in flight between the cores, a power of two with room
+// for two of the largest I2C messages.
+#define SPSC_RING_SIZE 8192
+
+// Command and length bytes in front of each message.
+#define SPSC_HEADER_SIZE 3
+
+namespace zuluide {
+
+/**
+   Counters kept by an SpscRing.
+ */
+typedef struct {
+   uint32_t pushed;
+   uint32_t dropped;
+   uint32_t highWater;
+} SpscRingStats;
+
+/**
+   Passes messages from one core to the other without locks. Each message is
+   a command byte and up to 65535 bytes of data, framed by a two byte length.
+
+   Exactly one context may push and exactly one may pop. The head is only
+   written by the producer and the tail only by the consumer. Positions count
+   every byte ever pushed, so the ring is full when they are a ring apart.
+   The producer publishes the head after the message bytes are written and
+   the consumer publishes the tail after they are copied out, so neither
+   side ever sees a partial message.
+ */
+class SpscRing {
+  public:
+   SpscRing();
+
+   /**
+      Adds a message, returning false (and counting it dropped) if the ring
+      does not have room for it. Producer only.
+    */
+   bool Push(uint8_t command, const uint8_t *data, size_t length);
+
+   /**
+      True if a message of length bytes would fit now. Producer only.
+    */
+   bool Fits(size_t length) const;
+
+   /**
+      Takes the oldest message, copying up to size bytes of its data into
+      buffer and setting length to the number copied. Returns false if the
+      ring is empty. Consumer only.
+    */
+   bool Pop(uint8_t *command, uint8_t *buffer, size_t size, size_t *length);
+
+   /**
+      True if there are no messages waiting.
+    */
+   bool IsEmpty() const;
+
+   SpscRingStats Stats() const;
+
+  private:
+   void Copy(uint32_t position, uint8_t *data, size_t length) const;
+
+   uint8_t ring[SPSC_RING_SIZE];
+   std::atomic<uint32_t> head;
+   std::atomic<uint32_t> tail;
+   SpscRingStats stats;
+};
+
+}  // namespace zuluide
+
+#endif
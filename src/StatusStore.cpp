@@ -0,0 +1,77 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "StatusStore.h"
+
+#include <hardware/sync.h>
+
+#include <cstring>
+
+namespace zuluide {
+
+StatusStore::StatusStore() : lengths{0, 0}, sequence(0), writing(0) {
+   buffers[0][0] = 0;
+   buffers[1][0] = 0;
+}
+
+void StatusStore::Publish(const uint8_t *status, size_t length) {
+   if (length > MAX_MSG_SIZE - 1) {
+      length = MAX_MSG_SIZE - 1;
+   }
+
+   uint32_t next = sequence + 1;
+   writing = next;
+   __dmb();
+
+   char *buffer = buffers[next % 2];
+   memcpy(buffer, status, length);
+   buffer[length] = 0;
+   lengths[next % 2] = length;
+
+   __dmb();
+   sequence = next;
+}
+
+size_t StatusStore::Read(char *buffer, size_t size, uint32_t *output) const {
+   while (true) {
+      uint32_t current = sequence;
+      __dmb();
+
+      size_t length = lengths[current % 2];
+      if (length < size) {
+         memcpy(buffer, buffers[current % 2], length);
+         buffer[length] = 0;
+      }
+
+      __dmb();
+      // The buffer is next written for sequence current + 2.
+      if (writing - current < 2) {
+         *output = current;
+         return length;
+      }
+   }
+}
+
+size_t StatusStore::Length() const {
+   return lengths[sequence % 2];
+}
+
+}  // namespace zuluide
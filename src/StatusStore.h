@@ -0,0 +1,78 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef STATUS_STORE_H
+#define STATUS_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ZuluControlI2CClient.h"
+
+namespace zuluide {
+
+/**
+   Holds the latest system status received from the I2C server so the web
+   server can read it while a newer status is being stored.
+
+   The status is double buffered. Publish writes the buffer readers are not
+   using and then advances the sequence number, which selects the buffer to
+   read. A reader checks afterwards that no write into the buffer it copied
+   has started, and retries if one has, so it always gets a whole status.
+ */
+class StatusStore {
+  public:
+   StatusStore();
+
+   /**
+      Stores a new status. Only one context may publish.
+    */
+   void Publish(const uint8_t *status, size_t length);
+
+   /**
+      Copies the latest status into buffer as a NUL terminated string and sets
+      sequence to its sequence number. Returns the length of the status, which
+      is larger than size - 1 if it did not fit (and was not copied).
+    */
+   size_t Read(char *buffer, size_t size, uint32_t *sequence) const;
+
+   /**
+      The length of the latest status.
+    */
+   size_t Length() const;
+
+   /**
+      Incremented by every Publish, 0 until the first status arrives.
+    */
+   uint32_t Sequence() const { return sequence; }
+
+  private:
+   char buffers[2][MAX_MSG_SIZE];
+   size_t lengths[2];
+   // The latest status is in buffers[sequence % 2].
+   volatile uint32_t sequence;
+   // The sequence number being written.
+   volatile uint32_t writing;
+};
+
+}  // namespace zuluide
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "Trace.h"
+
+#if ZULUIDE_TRACE
+
+#include <cstdio>
+#include <cstring>
+
+static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0, "TRACE_RING_EVENTS must be a power of two");
+
+// Export stages: the opening and thread names, each core's events, the closing.
+#define EXPORT_HEADER 0
+#define EXPORT_EVENTS 1
+#define EXPORT_FOOTER 2
+#define EXPORT_DONE 3
+
+namespace zuluide::trace {
+
+Ring rings[2];
+volatile bool paused = false;
+
+static const char *const pointNames[POINT_COUNT] = {"i2c_received", "i2c_sent", "enqueued", "dispatch",
+                                                    "cgi", "fs_open", "http_opened", "http_closed"};
+
+// Exports open, recording resumes when the last one closes.
+static int exports = 0;
+
+Export::Export() : core(0), next(0), end(0), stage(EXPORT_HEADER), lineLength(0), lineSent(0) {
+   exports++;
+   paused = true;
+}
+
+Export::~Export() {
+   if (--exports == 0) {
+      paused = false;
+   }
+}
+
+/**
+   Formats the next piece of the JSON into line. Returns false at the end.
+ */
+bool Export::Format() {
+   while (true) {
+      switch (stage) {
+         case EXPORT_HEADER:
+            lineLength = snprintf(line, sizeof(line),
+                                  "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"core 0\"}},\n"
+                                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"core 1\"}}");
+            stage = EXPORT_EVENTS;
+            core = 0;
+            end = rings[0].head;
+            next = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+            return true;
+         case EXPORT_EVENTS:
+            if (next == end) {
+               if (++core == 2) {
+                  stage = EXPORT_FOOTER;
+                  break;
+               }
+
+               end = rings[core].head;
+               next = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+               break;
+            }
+
+            {
+               const Event *event = &rings[core].events[next++ & (TRACE_RING_EVENTS - 1)];
+               const char *name = event->point < POINT_COUNT ? pointNames[event->point] : "unknown";
+               lineLength = snprintf(line, sizeof(line),
+                                     ",\n{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%lu,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%lu}}", name,
+                                     event->phase, event->phase == TRACE_PHASE_INSTANT ? "\"s\":\"t\"," : "",
+                                     (unsigned long)event->timeUs, core, (unsigned long)event->arg);
+               return true;
+            }
+         case EXPORT_FOOTER:
+            lineLength = snprintf(line, sizeof(line), "\n]}\n");
+            stage = EXPORT_DONE;
+            return true;
+         default:
+            return false;
+      }
+   }
+}
+
+int Export::Read(char *buffer, int count) {
+   int copied = 0;
+   while (copied < count) {
+      if (lineSent == lineLength) {
+         if (!Format()) {
+            break;
+         }
+
+         lineSent = 0;
+      }
+
+      int part = lineLength - lineSent;
+      if (part > count - copied) {
+         part = count - copied;
+      }
+
+      memcpy(buffer + copied, line + lineSent, part);
+      lineSent += part;
+      copied += part;
+   }
+
+   return copied;
+}
+
+}  // namespace zuluide::trace
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+
+// Records trace events for /trace (set by CMake).
+#ifndef ZULUIDE_TRACE
+#define ZULUIDE_TRACE 0
+#endif
+
+// Events kept per core, a power of two.
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 512
+#endif
+
+#if ZULUIDE_TRACE
+#include <hardware/sync.h>
+#include <hardware/timer.h>
+#include <pico/platform.h>
+#endif
+
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+namespace zuluide::trace {
+
+/**
+   Places in the firmware that record trace events, and what their argument
+   holds.
+ */
+enum Point : uint8_t {
+   // The I2C interrupt received a whole message: command << 16 | length.
+   I2C_RECEIVED,
+   // The I2C interrupt sent a command, length or payload chunk: command << 16 | bytes.
+   I2C_SENT,
+   // A request was queued for the server: command.
+   ENQUEUED,
+   // ProcessMessages handling a message: command.
+   DISPATCH,
+   // A CGI handler: its index in the handler table.
+   CGI,
+   // fs_open_custom opening a response.
+   FS_OPEN,
+   // A response was opened for a route: its index, or the route count for a web page resource.
+   HTTP_OPENED,
+   // A response was closed: as HTTP_OPENED.
+   HTTP_CLOSED,
+   POINT_COUNT
+};
+
+#if ZULUIDE_TRACE
+
+typedef struct {
+   uint32_t timeUs;
+   uint32_t arg;
+   uint8_t point;
+   uint8_t phase;
+} Event;
+
+typedef struct {
+   Event events[TRACE_RING_EVENTS];
+   // Counts every event ever recorded on the core.
+   volatile uint32_t head;
+} Ring;
+
+extern Ring rings[2];
+extern volatile bool paused;
+
+/**
+   Adds an event to the ring of the calling core. Interrupts are held off
+   only while a slot is claimed, so an interrupt handler tracing on the same
+   core gets the next one.
+ */
+static inline void Record(Point point, uint8_t phase, uint32_t arg) {
+   if (paused) {
+      return;
+   }
+
+   Ring *ring = &rings[get_core_num()];
+   uint32_t interrupts = save_and_disable_interrupts();
+   uint32_t slot = ring->head++;
+   restore_interrupts(interrupts);
+
+   Event *event = &ring->events[slot & (TRACE_RING_EVENTS - 1)];
+   event->timeUs = time_us_32();
+   event->arg = arg;
+   event->point = point;
+   event->phase = phase;
+}
+
+/**
+   Records the beginning of a span when created and its end when destroyed.
+ */
+class Scope {
+  public:
+   Scope(Point point, uint32_t arg) : point(point), arg(arg) { Record(point, TRACE_PHASE_BEGIN, arg); }
+   ~Scope() { Record(point, TRACE_PHASE_END, arg); }
+
+  private:
+   Point point;
+   uint32_t arg;
+};
+
+/**
+   Streams the rings as Chrome trace JSON (chrome://tracing, Perfetto), a
+   piece at a time. Recording is paused while an export is open so the rings
+   hold still.
+ */
+class Export {
+  public:
+   Export();
+   ~Export();
+
+   /**
+      Copies up to count bytes of the JSON into buffer. Returns the number
+      copied, 0 once it is all sent.
+    */
+   int Read(char *buffer, int count);
+
+  private:
+   bool Format();
+
+   int core;
+   uint32_t next;
+   uint32_t end;
+   int stage;
+   char line[192];
+   int lineLength;
+   int lineSent;
+};
+
+#define TRACE_SCOPE_NAME2(line) traceScope##line
+#define TRACE_SCOPE_NAME(line) TRACE_SCOPE_NAME2(line)
+#define TRACE_SCOPE(point, arg) zuluide::trace::Scope TRACE_SCOPE_NAME(__LINE__)(zuluide::trace::point, arg)
+#define TRACE_INSTANT(point, arg) zuluide::trace::Record(zuluide::trace::point, TRACE_PHASE_INSTANT, arg)
+
+#else
+
+#define TRACE_SCOPE(point, arg) ((void)0)
+#define TRACE_INSTANT(point, arg) ((void)0)
+
+#endif
+
+}  // namespace zuluide::trace
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "WebAssets.h"
+
+#include <cstring>
+
+// Generated by cmake/EmbedWebAssets.cmake.
+#include "web_assets.h"
+
+namespace zuluide::web {
+
+const Asset *FindAsset(const char *path) {
+   size_t low = 0;
+   size_t high = sizeof(assets) / sizeof(assets[0]);
+   while (low < high) {
+      size_t middle = (low + high) / 2;
+      int order = strcmp(path, assets[middle].path);
+      if (order == 0) {
+         return &assets[middle];
+      } else if (order < 0) {
+         high = middle;
+      } else {
+         low = middle + 1;
+      }
+   }
+
+   return NULL;
+}
+
+}  // namespace zuluide::web
@@ -0,0 +1,58 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <cstdint>
+
+namespace zuluide::web {
+
+/**
+   One encoding of a web page resource, as complete HTTP responses.
+ */
+typedef struct {
+   const char *response;
+   uint32_t length;
+   // Sent when the client already has this version.
+   const char *notModified;
+   uint32_t notModifiedLength;
+   // Quoted content hash.
+   const char *etag;
+} AssetVariant;
+
+/**
+   A web page resource embedded in flash at build time.
+ */
+typedef struct {
+   const char *path;
+   AssetVariant plain;
+   AssetVariant gzip;
+} Asset;
+
+/**
+   Returns the embedded asset served at path, or NULL if there is none.
+ */
+const Asset *FindAsset(const char *path);
+
+}  // namespace zuluide::web
+
+#endif
@@ -0,0 +1,592 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#include "WebSocketServer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+#include "Log.h"
+#include "lwip/def.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+// Appended to the client's key to prove the server understood the handshake (RFC 6455).
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define OPCODE_CONTINUATION 0x0
+#define OPCODE_TEXT 0x1
+#define OPCODE_BINARY 0x2
+#define OPCODE_CLOSE 0x8
+#define OPCODE_PING 0x9
+#define OPCODE_PONG 0xA
+
+#define CLOSE_PROTOCOL_ERROR 1002
+#define CLOSE_UNSUPPORTED_DATA 1003
+#define CLOSE_TOO_BIG 1009
+#define CLOSE_INTERNAL_ERROR 1011
+
+namespace zuluide::web {
+
+static uint32_t RotateLeft(uint32_t value, int bits) {
+   return (value << bits) | (value >> (32 - bits));
+}
+
+/**
+   Computes the SHA-1 digest of data, which the handshake requires.
+ */
+static void Sha1(const uint8_t *data, size_t length, uint8_t digest[20]) {
+   uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+   // The message is padded with 0x80, zeros and its length in bits to a multiple of 64 bytes.
+   size_t padded = ((length + 8) / 64 + 1) * 64;
+   for (size_t block = 0; block < padded; block += 64) {
+      uint32_t w[80];
+      for (int i = 0; i < 64; i++) {
+         size_t index = block + i;
+         uint8_t byte;
+         if (index < length) {
+            byte = data[index];
+         } else if (index == length) {
+            byte = 0x80;
+         } else if (index >= padded - 8) {
+            byte = (uint8_t)(((uint64_t)length * 8) >> (8 * (padded - 1 - index)));
+         } else {
+            byte = 0;
+         }
+
+         if (i % 4 == 0) {
+            w[i / 4] = 0;
+         }
+         w[i / 4] |= (uint32_t)byte << (8 * (3 - i % 4));
+      }
+
+      for (int i = 16; i < 80; i++) {
+         w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+      }
+
+      uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+      for (int i = 0; i < 80; i++) {
+         uint32_t f, k;
+         if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+         } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+         } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+         } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+         }
+
+         uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+         e = d;
+         d = c;
+         c = RotateLeft(b, 30);
+         b = a;
+         a = temp;
+      }
+
+      h[0] += a;
+      h[1] += b;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+   }
+
+   for (int i = 0; i < 20; i++) {
+      digest[i] = (uint8_t)(h[i / 4] >> (8 * (3 - i % 4)));
+   }
+}
+
+/**
+   Writes data base64 encoded and NUL terminated to output, which must hold
+   4 * ((length + 2) / 3) + 1 characters.
+ */
+static void Base64(const uint8_t *data, size_t length, char *output) {
+   static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+   for (size_t i = 0; i < length; i += 3) {
+      uint32_t group = data[i] << 16;
+      if (i + 1 < length) {
+         group |= data[i + 1] << 8;
+      }
+      if (i + 2 < length) {
+         group |= data[i + 2];
+      }
+
+      *output++ = alphabet[(group >> 18) & 0x3F];
+      *output++ = alphabet[(group >> 12) & 0x3F];
+      *output++ = i + 1 < length ? alphabet[(group >> 6) & 0x3F] : '=';
+      *output++ = i + 2 < length ? alphabet[group & 0x3F] : '=';
+   }
+
+   *output = 0;
+}
+
+/**
+   Writes the header of an unmasked, final frame to header, which must hold
+   10 bytes. Returns the length of the header.
+ */
+static size_t FrameHeader(uint8_t *header, uint8_t opcode, size_t length) {
+   header[0] = 0x80 | opcode;
+   if (length < 126) {
+      header[1] = length;
+      return 2;
+   }
+
+   if (length <= 0xFFFF) {
+      header[1] = 126;
+      header[2] = length >> 8;
+      header[3] = length;
+      return 4;
+   }
+
+   header[1] = 127;
+   for (int i = 0; i < 8; i++) {
+      header[2 + i] = (uint8_t)((uint64_t)length >> (8 * (7 - i)));
+   }
+
+   return 10;
+}
+
+WebSocketServer::WebSocketServer() : clientCount(0), status(NULL), catalog(NULL), handler(NULL) {
+   for (auto &client : clients) {
+      client.server = this;
+      client.state = ClientState::Free;
+      client.pcb = NULL;
+   }
+}
+
+bool WebSocketServer::Start(uint16_t port, const StatusStore *status, const ImageCatalog *catalog, CommandHandler handler) {
+   this->status = status;
+   this->catalog = catalog;
+   this->handler = handler;
+
+   struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+   if (pcb == NULL) {
+      return false;
+   }
+
+   if (tcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
+      tcp_close(pcb);
+      return false;
+   }
+
+   struct tcp_pcb *listener = tcp_listen(pcb);
+   if (listener == NULL) {
+      tcp_close(pcb);
+      return false;
+   }
+
+   tcp_arg(listener, this);
+   tcp_accept(listener, Accept);
+   return true;
+}
+
+err_t WebSocketServer::Accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+   auto server = (WebSocketServer *)arg;
+   if (err != ERR_OK || pcb == NULL) {
+      return ERR_VAL;
+   }
+
+   for (auto &client : server->clients) {
+      if (client.state == ClientState::Free) {
+         client.state = ClientState::Handshake;
+         client.pcb = pcb;
+         client.inputLength = 0;
+         client.repliesLength = 0;
+         client.statusSequence = 0;
+         client.listPending = false;
+         client.sendingCatalog = false;
+         server->clientCount++;
+
+         // Commands and replies are small, send them without waiting to fill a segment.
+         tcp_nagle_disable(pcb);
+         tcp_arg(pcb, &client);
+         tcp_recv(pcb, Receive);
+         tcp_sent(pcb, Sent);
+         tcp_err(pcb, Error);
+         return ERR_OK;
+      }
+   }
+
+   LOG_WARN("Refusing WebSocket connection, %d already connected.\n", server->clientCount);
+   tcp_abort(pcb);
+   return ERR_ABRT;
+}
+
+err_t WebSocketServer::Receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+   auto client = (Client *)arg;
+   auto server = client->server;
+   if (p == NULL) {
+      // The client closed the connection.
+      return server->Close(client);
+   }
+
+   if (client->inputLength + p->tot_len > WEBSOCKET_MESSAGE_MAX) {
+      LOG_WARN("WebSocket message too long.\n");
+      tcp_recved(pcb, p->tot_len);
+      pbuf_free(p);
+      return server->Fail(client, CLOSE_TOO_BIG);
+   }
+
+   pbuf_copy_partial(p, client->input + client->inputLength, p->tot_len, 0);
+   client->inputLength += p->tot_len;
+   tcp_recved(pcb, p->tot_len);
+   pbuf_free(p);
+
+   if (client->state == ClientState::Handshake) {
+      err_t result = server->Handshake(client);
+      if (result != ERR_OK || client->state != ClientState::Open) {
+         return result;
+      }
+   }
+
+   if (client->state == ClientState::Open) {
+      err_t result = server->ProcessFrames(client);
+      if (result != ERR_OK || client->state != ClientState::Open) {
+         return result;
+      }
+
+      return server->Flush(client);
+   }
+
+   return ERR_OK;
+}
+
+err_t WebSocketServer::Sent(void *arg, struct tcp_pcb *pcb, u16_t length) {
+   auto client = (Client *)arg;
+   if (client->state != ClientState::Open) {
+      return ERR_OK;
+   }
+
+   return client->server->Flush(client);
+}
+
+void WebSocketServer::Error(void *arg, err_t err) {
+   auto client = (Client *)arg;
+   if (client != NULL) {
+      // lwIP has already freed the connection.
+      client->server->Release(client);
+   }
+}
+
+err_t WebSocketServer::Handshake(Client *client) {
+   client->input[client->inputLength] = 0;
+   char *end = strstr(client->input, "\r\n\r\n");
+   if (end == NULL) {
+      if (client->inputLength == WEBSOCKET_MESSAGE_MAX) {
+         return Close(client);
+      }
+
+      // Wait for the rest of the request.
+      return ERR_OK;
+   }
+
+   end[2] = 0;
+   char *key = NULL;
+   for (char *line = strstr(client->input, "\r\n"); line != NULL && line < end; line = strstr(line, "\r\n")) {
+      line += 2;
+      if (strncasecmp(line, "Sec-WebSocket-Key:", 18) == 0) {
+         key = line + 18;
+         while (*key == ' ') {
+            key++;
+         }
+         *strchr(key, '\r') = 0;
+         break;
+      }
+   }
+
+   if (key == NULL || strlen(key) > 32) {
+      static const char badRequest[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+      tcp_write(client->pcb, badRequest, sizeof(badRequest) - 1, 0);
+      return Close(client);
+   }
+
+   char challenge[sizeof(WEBSOCKET_GUID) + 32];
+   snprintf(challenge, sizeof(challenge), "%s%s", key, WEBSOCKET_GUID);
+   uint8_t digest[20];
+   Sha1((const uint8_t *)challenge, strlen(challenge), digest);
+   char accept[29];
+   Base64(digest, sizeof(digest), accept);
+
+   char response[160];
+   int length = snprintf(response, sizeof(response),
+                         "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n",
+                         accept);
+   if (tcp_write(client->pcb, response, length, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+      return Close(client);
+   }
+
+   // Keep anything the client sent after the handshake.
+   size_t used = end + 4 - client->input;
+   client->inputLength -= used;
+   memmove(client->input, client->input + used, client->inputLength);
+   client->state = ClientState::Open;
+   return ERR_OK;
+}
+
+err_t WebSocketServer::ProcessFrames(Client *client) {
+   while (client->inputLength >= 2) {
+      auto input = (uint8_t *)client->input;
+      bool final = input[0] & 0x80;
+      uint8_t opcode = input[0] & 0x0F;
+      bool masked = input[1] & 0x80;
+      size_t length = input[1] & 0x7F;
+      size_t header = 2;
+      if (length == 126) {
+         if (client->inputLength < 4) {
+            return ERR_OK;
+         }
+
+         length = (input[2] << 8) | input[3];
+         header = 4;
+      } else if (length == 127) {
+         return Fail(client, CLOSE_TOO_BIG);
+      }
+
+      // Frames from clients are always masked.
+      if (!masked) {
+         return Fail(client, CLOSE_PROTOCOL_ERROR);
+      }
+
+      header += 4;
+      if (header + length > WEBSOCKET_MESSAGE_MAX) {
+         return Fail(client, CLOSE_TOO_BIG);
+      }
+
+      if (client->inputLength < header + length) {
+         // Wait for the rest of the frame.
+         return ERR_OK;
+      }
+
+      char *payload = client->input + header;
+      const uint8_t *mask = input + header - 4;
+      for (size_t i = 0; i < length; i++) {
+         payload[i] ^= mask[i % 4];
+      }
+
+      if (!final || opcode == OPCODE_CONTINUATION || opcode == OPCODE_BINARY) {
+         // Commands are short text messages, which are never fragmented.
+         return Fail(client, CLOSE_UNSUPPORTED_DATA);
+      }
+
+      if (opcode == OPCODE_CLOSE) {
+         SendFrame(client, OPCODE_CLOSE, payload, length < 2 ? length : 2);
+         return Close(client);
+      }
+
+      if (opcode == OPCODE_PING) {
+         SendFrame(client, OPCODE_PONG, payload, length);
+      } else if (opcode == OPCODE_TEXT) {
+         // The byte after the payload may belong to the next frame.
+         char next = payload[length];
+         payload[length] = 0;
+         Dispatch(client, payload);
+         payload[length] = next;
+      }
+
+      client->inputLength -= header + length;
+      memmove(client->input, client->input + header + length, client->inputLength);
+   }
+
+   return ERR_OK;
+}
+
+void WebSocketServer::Dispatch(Client *client, char *message) {
+   char *argument = strchr(message, ' ');
+   if (argument != NULL) {
+      *argument++ = 0;
+   } else {
+      argument = message + strlen(message);
+   }
+
+   const char *result = handler ? handler(message, argument) : NULL;
+   if (result != NULL && strcmp(message, "list") == 0) {
+      client->listPending = true;
+   }
+
+   char reply[64];
+   int length;
+   if (result != NULL) {
+      length = snprintf(reply, sizeof(reply), "{\"reply\": \"%s\", \"status\": \"%s\"}", message, result);
+   } else {
+      length = snprintf(reply, sizeof(reply), "{\"reply\": \"unknown\", \"status\": \"error\"}");
+   }
+
+   // Replies are queued as frames so they are not sent in the middle of the catalog.
+   uint8_t header[10];
+   size_t headerLength = FrameHeader(header, OPCODE_TEXT, length);
+   if (client->repliesLength + headerLength + length > sizeof(client->replies)) {
+      LOG_WARN("Dropping WebSocket reply, %zu bytes of replies waiting.\n", client->repliesLength);
+      return;
+   }
+
+   memcpy(client->replies + client->repliesLength, header, headerLength);
+   memcpy(client->replies + client->repliesLength + headerLength, reply, length);
+   client->repliesLength += headerLength + length;
+}
+
+bool WebSocketServer::SendFrame(Client *client, uint8_t opcode, const char *payload, size_t length) {
+   uint8_t header[10];
+   size_t headerLength = FrameHeader(header, opcode, length);
+   if (tcp_sndbuf(client->pcb) < headerLength + length) {
+      return false;
+   }
+
+   if (tcp_write(client->pcb, header, headerLength, TCP_WRITE_FLAG_COPY | (length > 0 ? TCP_WRITE_FLAG_MORE : 0)) != ERR_OK) {
+      return false;
+   }
+
+   return length == 0 || tcp_write(client->pcb, payload, length, TCP_WRITE_FLAG_COPY) == ERR_OK;
+}
+
+err_t WebSocketServer::Flush(Client *client) {
+   struct tcp_pcb *pcb = client->pcb;
+
+   if (!client->sendingCatalog && client->repliesLength > 0) {
+      if (tcp_sndbuf(pcb) < client->repliesLength ||
+          tcp_write(pcb, client->replies, client->repliesLength, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+         tcp_output(pcb);
+         return ERR_OK;
+      }
+
+      client->repliesLength = 0;
+   }
+
+   if (!client->sendingCatalog && client->listPending && catalog->IsComplete()) {
+      size_t jsonLength;
+      uint32_t generation;
+      uint32_t begun;
+      do {
+         begun = catalog->ReadBegin();
+         catalog->Json(&jsonLength);
+         generation = catalog->Generation();
+      } while (!catalog->ReadValid(begun));
+
+      uint8_t header[10];
+      size_t headerLength = FrameHeader(header, OPCODE_TEXT, jsonLength);
+      if (tcp_sndbuf(pcb) >= headerLength && tcp_write(pcb, header, headerLength, TCP_WRITE_FLAG_COPY) == ERR_OK) {
+         client->listPending = false;
+         client->sendingCatalog = true;
+         client->catalogGeneration = generation;
+         client->catalogLength = jsonLength;
+         client->catalogSent = 0;
+      }
+   }
+
+   if (client->sendingCatalog) {
+      // The catalog may change on the other core, so it is copied through
+      // scratch and only sent once the copy is known to be whole.
+      while (client->catalogSent < client->catalogLength) {
+         size_t length = LWIP_MIN(LWIP_MIN(client->catalogLength - client->catalogSent, (size_t)tcp_sndbuf(pcb)), sizeof(scratch));
+         if (length == 0) {
+            break;
+         }
+
+         bool current;
+         uint32_t begun;
+         do {
+            begun = catalog->ReadBegin();
+            size_t jsonLength;
+            const char *json = catalog->Json(&jsonLength);
+            current = catalog->Generation() == client->catalogGeneration && jsonLength == client->catalogLength;
+            if (current) {
+               memcpy(scratch, json + client->catalogSent, length);
+            }
+         } while (!catalog->ReadValid(begun));
+
+         // The catalog frame cannot be finished if the catalog was fetched again part way through.
+         if (!current) {
+            LOG_WARN("Image catalog changed while it was being sent.\n");
+            return Fail(client, CLOSE_INTERNAL_ERROR);
+         }
+
+         if (tcp_write(pcb, scratch, length, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+            break;
+         }
+
+         client->catalogSent += length;
+      }
+
+      if (client->catalogSent < client->catalogLength) {
+         tcp_output(pcb);
+         return ERR_OK;
+      }
+
+      client->sendingCatalog = false;
+   }
+
+   uint32_t sequence = status->Sequence();
+   if (sequence != 0 && sequence != client->statusSequence) {
+      size_t length = status->Read(scratch, sizeof(scratch), &sequence);
+      if (length < sizeof(scratch) && SendFrame(client, OPCODE_TEXT, scratch, length)) {
+         client->statusSequence = sequence;
+      }
+   }
+
+   tcp_output(pcb);
+   return ERR_OK;
+}
+
+void WebSocketServer::Service() {
+   for (auto &client : clients) {
+      if (client.state == ClientState::Open) {
+         Flush(&client);
+      }
+   }
+}
+
+err_t WebSocketServer::Fail(Client *client, uint16_t code) {
+   char payload[2] = {(char)(code >> 8), (char)code};
+   SendFrame(client, OPCODE_CLOSE, payload, sizeof(payload));
+   return Close(client);
+}
+
+err_t WebSocketServer::Close(Client *client) {
+   struct tcp_pcb *pcb = client->pcb;
+   tcp_arg(pcb, NULL);
+   tcp_recv(pcb, NULL);
+   tcp_sent(pcb, NULL);
+   tcp_err(pcb, NULL);
+   Release(client);
+
+   if (tcp_close(pcb) != ERR_OK) {
+      tcp_abort(pcb);
+      return ERR_ABRT;
+   }
+
+   return ERR_OK;
+}
+
+void WebSocketServer::Release(Client *client) {
+   if (client->state != ClientState::Free) {
+      client->state = ClientState::Free;
+      client->pcb = NULL;
+      clientCount--;
+   }
+}
+
+}  // namespace zuluide::web
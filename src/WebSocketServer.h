@@ -0,0 +1,137 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef WEB_SOCKET_SERVER_H
+#define WEB_SOCKET_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ImageCatalog.h"
+#include "StatusStore.h"
+#include "lwip/err.h"
+
+// Port the WebSocket control channel listens on (set by CMake).
+#ifndef WEBSOCKET_PORT
+#define WEBSOCKET_PORT 81
+#endif
+
+// Connections allowed on the control channel at once.
+#define WEBSOCKET_MAX_CLIENTS 2
+
+// Largest message accepted from a client, enough for a load command with an
+// image document from the catalog.
+#define WEBSOCKET_MESSAGE_MAX (MAX_MSG_SIZE + 16)
+
+struct tcp_pcb;
+struct pbuf;
+
+namespace zuluide::web {
+
+/**
+   Carries out a command received on the control channel. The argument is
+   the text after the command name and may be modified. Returns the status
+   sent back in the reply ("ok", "wait", ...), or NULL if the command is not
+   known.
+ */
+typedef const char *(*CommandHandler)(const char *command, char *argument);
+
+/**
+   A persistent WebSocket control channel. Clients send text messages of the
+   form "<command> <argument>", such as "load <image JSON>", "eject" or
+   "list", and get a {"reply": ..., "status": ...} message back for each one.
+   Every status update is pushed to them as the status document, and after a
+   list command the image catalog follows as a JSON array once it is complete.
+
+   Connections are served from lwIP callbacks, Service must be called with
+   the lwIP lock held.
+ */
+class WebSocketServer {
+  public:
+   WebSocketServer();
+
+   /**
+      Listens for connections on port. Returns false if the port could not be
+      opened.
+    */
+   bool Start(uint16_t port, const StatusStore *status, const ImageCatalog *catalog, CommandHandler handler);
+
+   /**
+      Pushes the latest status and any pending catalog to each client as
+      there is room to send it.
+    */
+   void Service();
+
+   /**
+      The number of connected clients.
+    */
+   int Clients() const { return clientCount; }
+
+  private:
+   enum class ClientState { Free,
+                            Handshake,
+                            Open };
+
+   typedef struct {
+      WebSocketServer *server;
+      ClientState state;
+      struct tcp_pcb *pcb;
+      char input[WEBSOCKET_MESSAGE_MAX + 1];
+      size_t inputLength;
+      // Reply frames waiting for room to be sent.
+      uint8_t replies[256];
+      size_t repliesLength;
+      uint32_t statusSequence;
+      // Set after a list command until the catalog has been sent.
+      bool listPending;
+      // Progress through the catalog frame being sent, which status frames
+      // must not interrupt.
+      bool sendingCatalog;
+      uint32_t catalogGeneration;
+      size_t catalogLength;
+      size_t catalogSent;
+   } Client;
+
+   static err_t Accept(void *arg, struct tcp_pcb *pcb, err_t err);
+   static err_t Receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+   static err_t Sent(void *arg, struct tcp_pcb *pcb, u16_t length);
+   static void Error(void *arg, err_t err);
+
+   err_t Handshake(Client *client);
+   err_t ProcessFrames(Client *client);
+   void Dispatch(Client *client, char *message);
+   bool SendFrame(Client *client, uint8_t opcode, const char *payload, size_t length);
+   err_t Flush(Client *client);
+   err_t Fail(Client *client, uint16_t code);
+   err_t Close(Client *client);
+   void Release(Client *client);
+
+   Client clients[WEBSOCKET_MAX_CLIENTS];
+   int clientCount;
+   const StatusStore *status;
+   const ImageCatalog *catalog;
+   CommandHandler handler;
+   char scratch[MAX_MSG_SIZE];
+};
+
+}  // namespace zuluide::web
+
+#endif
@@ -21,126 +21,421 @@
 
 #include "ZuluControlI2CClient.h"
 
+#include <pico/platform.h>
+
+#include "Log.h"
+#include "SpscRing.h"
+#include "Trace.h"
+
+// Runs the client on core 1 while core 0 runs the network (set by CMake).
+#ifndef ZULUIDE_DUAL_CORE
+#define ZULUIDE_DUAL_CORE 0
+#endif
+
 namespace zuluide::i2c::client {
 
-static volatile Packet* current = NULL;
+// Requests waiting for the I2C interrupt. Only the client's own core adds to
+// it, so it is shared with the interrupt but never with the other core.
 static queue_t outputQueue;
-static queue_t inputQueue;
-static queue_t availInputQueue;
+
+#if ZULUIDE_DUAL_CORE
+// The core the client runs on, and the requests made on the other core on
+// their way to it. Pushes hold that core's interrupts off, so its main loop
+// and the lwIP callbacks run from interrupts make a single producer.
+static uint clientCore;
+static zuluide::SpscRing requestRing;
+// A request taken from the ring that the output queue had no room for yet.
+static uint8_t forwarded[MAX_MSG_SIZE + 1];
+static uint8_t forwardedCommand;
+static size_t forwardedLength;
+static bool forwardedPending = false;
+#endif
+
+// Payload bytes sent per master read, raised from BUFFER_LENGTH when the server supports it.
+static volatile uint16_t txChunk = BUFFER_LENGTH;
+static volatile uint16_t pendingTxChunk = BUFFER_LENGTH;
+static int txDmaChannel;
+static uint16_t txStaging[I2C_TX_CHUNK_MAX];
+static volatile uint32_t txAborts = 0;
+
+// Bus speeds the client can run at: standard mode, Fast-mode and Fast-mode Plus.
+static const uint supportedSpeeds[I2C_SPEED_COUNT] = {100000, 400000, 1000000};
+static uint baseBaudrate;
+static uint maxBaudrate;
+static uint serverSpeeds = 0;
+static bool catalogDiffs = false;
+static volatile uint currentBaudrate;
+static volatile uint pendingBaudrate;
+static volatile bool applyBaudrate = false;
+static volatile uint32_t framingErrors = 0;
+static uint32_t fallbacks = 0;
+static uint32_t holdOffs = 0;
+static uint64_t errorWindowStart = 0;
+static uint32_t errorWindowCount = 0;
+static uint errorWindowBaudrate = 0;
+
+// Bytes moved in each direction and the throughput measured over the last window.
+static volatile uint32_t rxBytes = 0;
+static volatile uint32_t txBytes = 0;
+static uint64_t throughputWindowStart = 0;
+static uint32_t throughputWindowBytes = 0;
+static uint32_t throughput = 0;
+
+// Received messages are counted by the I2C interrupt and sent ones when they
+// finish, so each of those counters has a single writer. Failed requests are
+// counted by whichever context made them, without a lock, as they are rare.
+static CommandStats commandStats = {};
+
+static void CountCommand(CommandCounters* counters, uint8_t command, uint bytes) {
+   CommandCounters* counter = &counters[command < I2C_COMMAND_IDS ? command : I2C_COMMAND_IDS - 1];
+   counter->messages++;
+   counter->bytes += bytes;
+}
+
+/**
+   Each received message is stored in the ring as a header followed by the
+   payload and a NUL terminator, padded to a word boundary. A frame never
+   wraps; when one does not fit at the end a wrap marker sends the reader back
+   to the start of the ring.
+ */
+typedef struct {
+   uint8_t command;
+   uint8_t flags;
+   uint16_t length;
+} FrameHeader;
+
+#define FRAME_WRAP 0x1
+#define FRAME_SIZE(length) ((sizeof(FrameHeader) + (length) + 1 + 3) & ~3u)
+
+static uint8_t rxRing[RX_RING_SIZE] __attribute__((aligned(4)));
+// Written only by the I2C interrupt.
+static volatile uint32_t rxHead = 0;
+static volatile uint32_t rxCommitted = 0;
+static volatile uint32_t rxDropped = 0;
+static uint32_t rxHighWater = 0;
+static uint32_t rxMaxPending = 0;
+// Written only by the main loop.
+static volatile uint32_t rxTail = 0;
+static volatile uint32_t rxConsumed = 0;
+// Set by the I2C interrupt when the ring has no room for a message of the
+// largest size, which stops the client answering until the main loop frees some.
+static volatile bool rxFull = false;
+static uint32_t rxHolds = 0;
+// Set by a handler that cannot take the message it was given yet.
+static bool retryMessage = false;
+
+// The frame currently being received by the I2C interrupt, also read by HoldOff.
+static volatile SendState rxState = SendState::None;
+static uint8_t rxCommand;
+static uint8_t rxLengthBytes[2];
+static uint16_t rxLength;
+static uint16_t rxPos;
+static uint32_t rxFrame;
+static bool rxDiscard;
+
+/**
+   A size class of outbound packets. Free packets are kept in a queue so the
+   I2C interrupt can return them without touching the heap.
+ */
+typedef struct {
+   uint16_t payloadSize;
+   uint16_t count;
+   OutboundPacket* packets;
+   uint8_t* buffers;
+   queue_t free;
+   volatile uint16_t minFree;
+   volatile uint32_t exhausted;
+} PacketPool;
+
+static OutboundPacket smallPackets[SMALL_PACKET_COUNT];
+static OutboundPacket mediumPackets[MEDIUM_PACKET_COUNT];
+static OutboundPacket largePackets[LARGE_PACKET_COUNT];
+static uint8_t smallBuffers[SMALL_PACKET_COUNT * SMALL_PACKET_PAYLOAD];
+static uint8_t mediumBuffers[MEDIUM_PACKET_COUNT * MEDIUM_PACKET_PAYLOAD];
+static uint8_t largeBuffers[LARGE_PACKET_COUNT * LARGE_PACKET_PAYLOAD];
+
+static PacketPool outputPools[OUTPUT_POOL_CLASSES] = {
+    {SMALL_PACKET_PAYLOAD, SMALL_PACKET_COUNT, smallPackets, smallBuffers},
+    {MEDIUM_PACKET_PAYLOAD, MEDIUM_PACKET_COUNT, mediumPackets, mediumBuffers},
+    {LARGE_PACKET_PAYLOAD, LARGE_PACKET_COUNT, largePackets, largeBuffers}};
+
+/**
+   Takes a free packet from the smallest size class that fits the payload.
+ */
+static OutboundPacket* AcquirePacket(size_t payloadLength) {
+   for (uint8_t i = 0; i < OUTPUT_POOL_CLASSES; i++) {
+      PacketPool* pool = &outputPools[i];
+      if (payloadLength > pool->payloadSize) {
+         continue;
+      }
+
+      OutboundPacket* p;
+      if (queue_try_remove(&pool->free, &p)) {
+         uint16_t level = queue_get_level(&pool->free);
+         if (level < pool->minFree) {
+            pool->minFree = level;
+         }
+
+         return p;
+      }
+
+      pool->exhausted++;
+   }
+
+   return NULL;
+}
+
+/**
+   Returns a packet to its size class, safe to call from the I2C interrupt.
+ */
+static void ReleasePacket(OutboundPacket* p) {
+   queue_try_add(&outputPools[p->sizeClass].free, &p);
+}
+
+static uint32_t RingUsed(uint32_t head, uint32_t tail) {
+   return head >= tail ? head - tail : RX_RING_SIZE - tail + head;
+}
+
+/**
+   Finds contiguous space in the receive ring for a frame with the given payload
+   length, returning false if the ring is too full.
+ */
+static bool ReserveFrame(uint16_t length, uint32_t* frame) {
+   uint32_t head = rxHead;
+   uint32_t tail = rxTail;
+   uint32_t size = FRAME_SIZE(length);
+   if (head >= tail) {
+      // The new head must not land on the tail or the ring would look empty.
+      if (size < RX_RING_SIZE - head || (size == RX_RING_SIZE - head && tail != 0)) {
+         *frame = head;
+         return true;
+      } else if (size < tail) {
+         *frame = 0;
+         return true;
+      }
+   } else if (size < tail - head) {
+      *frame = head;
+      return true;
+   }
+
+   return false;
+}
+
+/**
+   Publishes the frame that was just received so the main loop can process it.
+ */
+static void CommitFrame() {
+   CountCommand(commandStats.received, rxCommand, 3 + rxLength);
+   TRACE_INSTANT(I2C_RECEIVED, rxCommand << 16 | rxLength);
+   if (rxDiscard) {
+      rxDropped++;
+      return;
+   }
+
+   uint32_t head = rxHead;
+   if (rxFrame != head) {
+      // The frame did not fit at the end of the ring.
+      ((FrameHeader*)(rxRing + head))->flags = FRAME_WRAP;
+   }
+
+   FrameHeader* header = (FrameHeader*)(rxRing + rxFrame);
+   header->command = rxCommand;
+   header->flags = 0;
+   header->length = rxLength;
+   rxRing[rxFrame + sizeof(FrameHeader) + rxLength] = 0;
+
+   uint32_t next = rxFrame + FRAME_SIZE(rxLength);
+   if (next == RX_RING_SIZE) {
+      next = 0;
+   }
+
+   // Make sure the frame is written before the main loop can see it.
+   __dmb();
+   rxHead = next;
+   rxCommitted++;
+
+   uint32_t used = RingUsed(next, rxTail);
+   if (used > rxHighWater) {
+      rxHighWater = used;
+   }
+
+   uint32_t pending = rxCommitted - rxConsumed;
+   if (pending > rxMaxPending) {
+      rxMaxPending = pending;
+   }
+
+   uint32_t frame;
+   if (!ReserveFrame(MAX_MSG_SIZE, &frame)) {
+      // The next message might not fit, refuse the server once this
+      // transaction finishes rather than drop it.
+      rxFull = true;
+   }
+
+   NotifyMessageReceived();
+}
+
+/**
+   Starts the DMA transfer of a payload chunk into the I2C TX FIFO. The bytes
+   are widened first because the data register treats the upper bits as
+   command bits, which must be zero when transmitting as a slave.
+ */
+static void SendChunk(const uint8_t* data, uint16_t count) {
+   if (dma_channel_is_busy(txDmaChannel)) {
+      // The master stopped reading part way through the previous chunk.
+      dma_channel_abort(txDmaChannel);
+      txAborts++;
+      framingErrors++;
+   }
+
+   txBytes += count;
+
+   for (uint16_t i = 0; i < count; i++) {
+      txStaging[i] = data[i];
+   }
+
+   dma_channel_transfer_from_buffer_now(txDmaChannel, txStaging, count);
+}
+
+/**
+   Removes the packet at the head of the output queue once it is fully sent.
+   A capabilities packet switches to the negotiated settings, which the server
+   adopts after receiving it.
+ */
+static void FinishPacket() {
+   OutboundPacket* sent;
+   if (!queue_try_remove(&outputQueue, &sent)) {
+      LOG_ERROR("Unable to remove from queue.\n");
+      return;
+   }
+
+   CountCommand(commandStats.sent, sent->command, 3 + sent->length);
+   if (sent->command == I2C_CLIENT_CAPABILITIES) {
+      txChunk = pendingTxChunk;
+      // The master is still clocking out this transaction, switch speed once it stops.
+      applyBaudrate = pendingBaudrate != currentBaudrate;
+   }
+
+   ReleasePacket(sent);
+}
 
 static void i2c_slave_handler(i2c_inst_t* i2c, i2c_slave_event_t event) {
    switch (event) {
       case I2C_SLAVE_RECEIVE: {
-         if (current == NULL) {
-            // Get a buffer.
-            if (!queue_try_remove(&availInputQueue, &current)) {
-               printf("UNABLE TO GET A FREE BUFFER\n");
-            }
-         }
+         while (i2c_get_read_available(i2c0) > 0) {
+            if (rxState == SendState::None) {
+               rxBytes++;
+               rxCommand = i2c_read_byte_raw(i2c0);
+               rxPos = 0;
+               rxState = SendState::SentCommand;
+            } else if (rxState == SendState::SentCommand) {
+               rxBytes++;
+               rxLengthBytes[rxPos++] = i2c_read_byte_raw(i2c0);
+               if (rxPos == 2) {
+                  rxLength = (rxLengthBytes[0] << 8) | rxLengthBytes[1];
+                  rxPos = 0;
+                  if (rxLength > MAX_MSG_SIZE) {
+                     framingErrors++;
+                  }
 
-         if (current->state == SendState::None) {
-            if (i2c_get_read_available(i2c0) > 0) {
-               current->command = i2c_read_byte_raw(i2c0);
-               current->state = SendState::SentCommand;
-            }
-         } else if (current->state == SendState::SentCommand) {
-            if (current->pos == 0) {
-               if (i2c_get_read_available(i2c0) > 1) {
-                  // Both length bytes at once.
-                  current->lengthBytes[0] = i2c_read_byte_raw(i2c0);
-                  current->lengthBytes[1] = i2c_read_byte_raw(i2c0);
-                  current->state = SendState::SentLength;
-                  current->pos = 0;
-                  current->length = (current->lengthBytes[0] << 8) | current->lengthBytes[1];
-                  if (current->length == 0) {
+                  rxDiscard = rxLength > MAX_MSG_SIZE || !ReserveFrame(rxLength, &rxFrame);
+                  if (rxLength == 0) {
                      // We have now received the entire message.
-                     queue_try_add(&inputQueue, &current);
-                     current = NULL;
+                     CommitFrame();
+                     rxState = SendState::None;
+                  } else {
+                     rxState = SendState::SentLength;
                   }
-               } else if (i2c_get_read_available(i2c0) > 0) {
-                  // Received the first length byte.
-                  current->lengthBytes[0] = i2c_read_byte_raw(i2c0);
-                  current->pos++;
                }
-            } else if (i2c_get_read_available(i2c0) > 0) {
-               // Received the second length byte.
-               current->lengthBytes[1] = i2c_read_byte_raw(i2c0);
-               current->state = SendState::SentLength;
-               current->pos = 0;
-               current->length = (current->lengthBytes[0] << 8) | current->lengthBytes[1];
-
-               if (current->length == 0) {
-                  // We have now received the entire message.
-                  queue_try_add(&inputQueue, &current);
-                  current = NULL;
+            } else if (rxState == SendState::SentLength) {
+               // Read string data straight into the ring.
+               uint8_t* payload = rxRing + rxFrame + sizeof(FrameHeader);
+               while (rxPos < rxLength && i2c_get_read_available(i2c0) > 0) {
+                  rxBytes++;
+                  uint8_t value = i2c_read_byte_raw(i2c0);
+                  if (!rxDiscard) {
+                     payload[rxPos] = value;
+                  }
+
+                  rxPos++;
                }
-            }
-         } else if (current->state == SendState::SentLength) {
-            // Read string data.
-            while (current->pos < current->length && i2c_get_read_available(i2c0) > 0) {
-               current->buffer[current->pos++] = i2c_read_byte_raw(i2c0);
-            }
 
-            if (current->pos == current->length) {
-               // We have now received the entire message.
-               queue_try_add(&inputQueue, &current);
-               current = NULL;
+               if (rxPos == rxLength) {
+                  // We have now received the entire message.
+                  CommitFrame();
+                  rxState = SendState::None;
+               }
             }
          }
 
          break;
       }
       case I2C_SLAVE_REQUEST: {
-         if (current != NULL) {
-            // Reset if a message wasn't receved.
-            current->length = 0;
-            current->pos = 0;
-            current->state = SendState::None;
-
-            memset((void*)current->buffer, 0, MAX_MSG_SIZE);
-            queue_try_add(&availInputQueue, &current);
-            current = NULL;
+         // Reset if a message wasn't receved.
+         if (rxState != SendState::None) {
+            framingErrors++;
+            rxState = SendState::None;
          }
 
-         Packet* toSend;
+         OutboundPacket* toSend;
          if (queue_try_peek(&outputQueue, &toSend)) {
             if (toSend->state == SendState::None) {
                i2c_write_raw_blocking(i2c0, &toSend->command, 1);
+               txBytes++;
+               TRACE_INSTANT(I2C_SENT, toSend->command << 16 | 1);
                toSend->state = SendState::SentCommand;
             } else if (toSend->state == SendState::SentCommand) {
                i2c_write_raw_blocking(i2c0, toSend->lengthBytes, 2);
+               txBytes += 2;
+               TRACE_INSTANT(I2C_SENT, toSend->command << 16 | 2);
                if (toSend->length > 0) {
                   toSend->state = SendState::SentLength;
                } else {
                   // Cleanup, sent a request without a string payload.
-                  if (!queue_try_remove(&outputQueue, &toSend)) {
-                     printf("Unable to remove from queue.");
-                  }
-
-                  delete toSend;
+                  FinishPacket();
                }
             } else if (toSend->state == SendState::SentLength) {
-               // Send out the message.
-               if ((toSend->length - toSend->pos) > BUFFER_LENGTH) {
-                  i2c_write_raw_blocking(i2c0, toSend->buffer + toSend->pos, BUFFER_LENGTH);
-                  toSend->pos += BUFFER_LENGTH;
-                  // Leave at the top of the queue for the next I2C_SLAVE_REQUEST
-               } else {
-                  i2c_write_raw_blocking(i2c0, toSend->buffer + toSend->pos, toSend->length - toSend->pos);
+               // Send out the next chunk of the message, the DMA feeds the TX FIFO as the master reads.
+               uint16_t count = toSend->length - toSend->pos;
+               if (count > txChunk) {
+                  count = txChunk;
+               }
 
-                  // Cleanup.
-                  queue_try_remove(&outputQueue, &toSend);
-                  delete toSend;
+               SendChunk(toSend->buffer + toSend->pos, count);
+               TRACE_INSTANT(I2C_SENT, toSend->command << 16 | count);
+               toSend->pos += count;
+               if (toSend->pos == toSend->length) {
+                  FinishPacket();
                }
+
+               // Otherwise leave at the top of the queue for the next I2C_SLAVE_REQUEST
             }
          } else {
             // Send NOOP for the
             i2c_write_byte_raw(i2c0, I2C_CLIENT_NOOP);
+            CountCommand(commandStats.sent, I2C_CLIENT_NOOP, 1);
          }
 
          break;
       }
       case I2C_SLAVE_FINISH: {
+         if (rxState == SendState::SentLength && rxLength > MAX_MSG_SIZE) {
+            // The length was garbled, resynchronize on the next transaction.
+            rxState = SendState::None;
+         }
+
+         if (rxFull && rxState == SendState::None) {
+            // Between messages the master's address is not acknowledged, it
+            // takes the client as busy and tries again, until Cleanup makes room.
+            i2c_get_hw(i2c0)->enable = 0;
+            rxHolds++;
+         }
+
+         if (applyBaudrate) {
+            i2c_set_baudrate(i2c0, pendingBaudrate);
+            currentBaudrate = pendingBaudrate;
+            applyBaudrate = false;
+         }
+
          break;
       }
       default:
@@ -148,28 +443,89 @@ static void i2c_slave_handler(i2c_inst_t* i2c, i2c_slave_event_t event) {
    }
 }
 
-bool EnqueueRequest(uint8_t request) {
-   Packet* p = new Packet();
-   p->length = 0;
-   p->command = request;
-   p->pos = 0;
-   p->state = SendState::None;
-   return queue_try_add(&outputQueue, &p);
-}
+/**
+   Adds a request to the output queue, returning false if there is no packet
+   or queue slot free for it. Client core only.
+ */
+static bool AddRequest(uint8_t request, const uint8_t* payload, size_t length) {
+   OutboundPacket* p = AcquirePacket(length);
+   if (p == NULL) {
+      return false;
+   }
 
-bool EnqueueRequest(uint8_t request, const char* toSend) {
-   Packet* p = new Packet();
    p->command = request;
-   p->length = strlen(toSend);
+   p->length = length;
    p->lengthBytes[0] = p->length >> 8;
    p->lengthBytes[1] = p->length;
    p->pos = 0;
    p->state = SendState::None;
-   memcpy(p->buffer, toSend, p->length);
-   return queue_try_add(&outputQueue, &p);
+   memcpy(p->buffer, payload, p->length);
+   if (!queue_try_add(&outputQueue, &p)) {
+      ReleasePacket(p);
+      return false;
+   }
+
+   TRACE_INSTANT(ENQUEUED, request);
+   return true;
+}
+
+#if ZULUIDE_DUAL_CORE
+/**
+   Passes a request made on the other core to the client's core, which adds
+   it to the output queue the next time it processes messages.
+ */
+static bool ForwardRequest(uint8_t request, const uint8_t* payload, size_t length) {
+   uint32_t interrupts = save_and_disable_interrupts();
+   bool pushed = requestRing.Push(request, payload, length);
+   restore_interrupts(interrupts);
+   if (pushed) {
+      NotifyMessageReceived();
+   }
+
+   return pushed;
+}
+
+/**
+   Moves the requests forwarded from the other core into the output queue,
+   keeping the first that does not fit until there is room.
+ */
+static void TakeForwardedRequests() {
+   while (forwardedPending || requestRing.Pop(&forwardedCommand, forwarded, MAX_MSG_SIZE, &forwardedLength)) {
+      forwardedPending = true;
+      if (!AddRequest(forwardedCommand, forwarded, forwardedLength)) {
+         return;
+      }
+
+      forwardedPending = false;
+   }
+}
+#endif
+
+bool EnqueueRequest(uint8_t request) {
+   return EnqueueRequest(request, "");
 }
 
-void Init(uint sdaPin, uint sclPin, uint addr, uint baudrate) {
+bool EnqueueRequest(uint8_t request, const char* toSend) {
+   size_t length = strlen(toSend);
+   if (length > MAX_MSG_SIZE) {
+      commandStats.enqueueFailures++;
+      return false;
+   }
+
+#if ZULUIDE_DUAL_CORE
+   bool added = get_core_num() != clientCore ? ForwardRequest(request, (const uint8_t*)toSend, length)
+                                             : AddRequest(request, (const uint8_t*)toSend, length);
+#else
+   bool added = AddRequest(request, (const uint8_t*)toSend, length);
+#endif
+   if (!added) {
+      commandStats.enqueueFailures++;
+   }
+
+   return added;
+}
+
+void Init(uint sdaPin, uint sclPin, uint addr, uint baudrate, uint maxSupportedBaudrate) {
    // Configure pins and I2C.
    gpio_init(sdaPin);
    gpio_set_function(sdaPin, GPIO_FUNC_I2C);
@@ -183,56 +539,327 @@ void Init(uint sdaPin, uint sclPin, uint addr, uint baudrate) {
    gpio_pull_up(sclPin);
    gpio_set_drive_strength(sclPin, GPIO_DRIVE_STRENGTH_12MA);
 
+   baseBaudrate = baudrate;
+   maxBaudrate = maxSupportedBaudrate;
+   currentBaudrate = baudrate;
+   pendingBaudrate = baudrate;
    i2c_init(i2c0, baudrate);
    i2c_slave_init(i2c0, addr, &i2c_slave_handler);
 
    // Initalize data structures for synchronizing between I2C interrupt and the main process.
-   queue_init(&outputQueue, sizeof(Packet*), 20);
-   queue_init(&inputQueue, sizeof(zuluide::i2c::client::Packet*), 20);
-   queue_init(&availInputQueue, sizeof(zuluide::i2c::client::Packet*), INPUT_BUFFER_COUNT);
+   queue_init(&outputQueue, sizeof(OutboundPacket*), OUTPUT_QUEUE_DEPTH);
+#if ZULUIDE_DUAL_CORE
+   clientCore = get_core_num();
+#endif
+
+   // DMA feeds outbound payload chunks into the TX FIFO at the pace the master reads them.
+   txDmaChannel = dma_claim_unused_channel(true);
+   dma_channel_config config = dma_channel_get_default_config(txDmaChannel);
+   channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+   channel_config_set_read_increment(&config, true);
+   channel_config_set_write_increment(&config, false);
+   channel_config_set_dreq(&config, i2c_get_dreq(i2c0, true));
+   dma_channel_configure(txDmaChannel, &config, &i2c_get_hw(i2c0)->data_cmd, txStaging, 0, false);
+
+   for (uint8_t i = 0; i < OUTPUT_POOL_CLASSES; i++) {
+      PacketPool* pool = &outputPools[i];
+      queue_init(&pool->free, sizeof(OutboundPacket*), pool->count);
+      for (uint16_t j = 0; j < pool->count; j++) {
+         OutboundPacket* p = &pool->packets[j];
+         p->sizeClass = i;
+         p->buffer = pool->buffers + j * pool->payloadSize;
+         queue_try_add(&pool->free, &p);
+      }
+
+      pool->minFree = pool->count;
+      pool->exhausted = 0;
+   }
+}
 
-   for (int i = 0; i < INPUT_BUFFER_COUNT; i++) {
-      auto p = new Packet();
-      Cleanup(p);
+void Cleanup(Message* message) {
+   // Release the frame's space in the ring.
+   rxTail = message->end;
+   rxConsumed++;
+
+   uint32_t frame;
+   if (rxFull && ReserveFrame(MAX_MSG_SIZE, &frame)) {
+      rxFull = false;
+      i2c_get_hw(i2c0)->enable = I2C_IC_ENABLE_ENABLE_BITS;
    }
 }
 
-void Cleanup(Packet* packet) {
-   // Cleanup buffer and put back into service.
-   packet->length = 0;
-   packet->pos = 0;
-   packet->state = SendState::None;
-   memset(packet->buffer, 0, MAX_MSG_SIZE);
-   queue_try_add(&availInputQueue, &packet);
+void RetryLater() {
+   retryMessage = true;
 }
 
-bool Is(Packet* toCheck, uint8_t messageID) {
+bool Is(const Message* toCheck, uint8_t messageID) {
    return toCheck->command == messageID;
 }
 
-bool TryReceive(Packet** toRecv) {
-   return queue_try_remove(&inputQueue, toRecv);
+bool TryReceive(Message* message) {
+   uint32_t tail = rxTail;
+   uint32_t head = rxHead;
+   if (tail == head) {
+      return false;
+   }
+
+   FrameHeader* header = (FrameHeader*)(rxRing + tail);
+   if (header->flags & FRAME_WRAP) {
+      tail = 0;
+      header = (FrameHeader*)rxRing;
+   }
+
+   message->command = header->command;
+   message->length = header->length;
+   message->data = rxRing + tail + sizeof(FrameHeader);
+   message->end = tail + FRAME_SIZE(header->length);
+   if (message->end == RX_RING_SIZE) {
+      message->end = 0;
+   }
+
+   return true;
+}
+
+/**
+   Splits the capabilities the server appends to its API version (separated by
+   ';') off the version string and agrees on the settings both sides support.
+ */
+static void NegotiateCapabilities(Message* message) {
+   // The server starts every handshake from the default settings.
+   txChunk = BUFFER_LENGTH;
+
+   catalogDiffs = false;
+
+   char* options = (char*)memchr(message->data, ';', message->length);
+   if (options == NULL) {
+      return;
+   }
+
+   // Only pass the version itself on to ProcessServerAPIVersion.
+   *options++ = 0;
+   message->length = options - 1 - (const char*)message->data;
+
+   uint chunk = BUFFER_LENGTH;
+   serverSpeeds = 0;
+   for (char* option = strtok(options, ";"); option != NULL; option = strtok(NULL, ";")) {
+      if (strncmp(option, "chunk=", sizeof("chunk=") - 1) == 0) {
+         chunk = strtoul(option + sizeof("chunk=") - 1, NULL, 10);
+      } else if (strncmp(option, "speeds=", sizeof("speeds=") - 1) == 0) {
+         // Comma separated list of speeds in kHz.
+         char* speed = option + sizeof("speeds=") - 1;
+         while (*speed != 0) {
+            uint hz = strtoul(speed, &speed, 10) * 1000;
+            for (int i = 0; i < I2C_SPEED_COUNT; i++) {
+               if (supportedSpeeds[i] == hz) {
+                  serverSpeeds |= 1 << i;
+               }
+            }
+
+            if (*speed == ',') {
+               speed++;
+            } else {
+               break;
+            }
+         }
+      } else if (strcmp(option, "catalog=diff") == 0) {
+         catalogDiffs = true;
+      }
+   }
+
+   if (chunk > I2C_TX_CHUNK_MAX) {
+      chunk = I2C_TX_CHUNK_MAX;
+   }
+
+   if (chunk == 0) {
+      chunk = BUFFER_LENGTH;
+   }
+
+   // Pick the fastest speed both sides support.
+   uint speed = currentBaudrate;
+   for (int i = 0; i < I2C_SPEED_COUNT; i++) {
+      if ((serverSpeeds & (1 << i)) && supportedSpeeds[i] <= maxBaudrate) {
+         speed = supportedSpeeds[i];
+      }
+   }
+
+   if (chunk != BUFFER_LENGTH || speed != currentBaudrate || catalogDiffs) {
+      char confirm[64];
+      int length = snprintf(confirm, sizeof(confirm), "chunk=%u;speed=%u;speeds=", chunk, speed / 1000);
+      for (int i = 0; i < I2C_SPEED_COUNT && supportedSpeeds[i] <= maxBaudrate; i++) {
+         length += snprintf(confirm + length, sizeof(confirm) - length, i > 0 ? ",%u" : "%u", supportedSpeeds[i] / 1000);
+      }
+
+      if (catalogDiffs) {
+         // Asks the server to announce changes to its catalog.
+         snprintf(confirm + length, sizeof(confirm) - length, ";catalog=diff");
+      }
+
+      pendingTxChunk = chunk;
+      pendingBaudrate = speed;
+      if (!EnqueueRequest(I2C_CLIENT_CAPABILITIES, confirm)) {
+         LOG_ERROR("Failed to add capabilities to output queue.\n");
+      }
+   }
+}
+
+/**
+   Drops to the next slower negotiated speed when framing errors pile up and
+   refreshes the measured bus throughput.
+ */
+static void CheckLink() {
+   uint64_t now = time_us_64();
+
+   uint32_t bytes = rxBytes + txBytes;
+   if (now - throughputWindowStart >= I2C_THROUGHPUT_WINDOW_US) {
+      throughput = (uint64_t)(bytes - throughputWindowBytes) * 1000000 / (now - throughputWindowStart);
+      throughputWindowStart = now;
+      throughputWindowBytes = bytes;
+   }
+
+   // Errors from before a speed change say nothing about the new speed, so that also starts a new window.
+   uint32_t errors = framingErrors;
+   if (now - errorWindowStart >= I2C_FALLBACK_WINDOW_US || errorWindowBaudrate != currentBaudrate) {
+      errorWindowBaudrate = currentBaudrate;
+      errorWindowStart = now;
+      errorWindowCount = errors;
+   } else if (errors - errorWindowCount >= I2C_FALLBACK_ERRORS && !applyBaudrate && pendingBaudrate == currentBaudrate) {
+      errorWindowStart = now;
+      errorWindowCount = errors;
+
+      uint slower = baseBaudrate;
+      for (int i = 0; i < I2C_SPEED_COUNT; i++) {
+         if ((serverSpeeds & (1 << i)) && supportedSpeeds[i] < currentBaudrate && supportedSpeeds[i] > slower) {
+            slower = supportedSpeeds[i];
+         }
+      }
+
+      if (slower < currentBaudrate) {
+         char confirm[32];
+         snprintf(confirm, sizeof(confirm), "speed=%u", slower / 1000);
+         pendingTxChunk = txChunk;
+         pendingBaudrate = slower;
+         if (EnqueueRequest(I2C_CLIENT_CAPABILITIES, confirm)) {
+            fallbacks++;
+            LOG_WARN("I2C framing errors, falling back to %u Hz.\n", slower);
+         } else {
+            pendingBaudrate = currentBaudrate;
+         }
+      }
+   }
 }
 
 void ProcessMessages() {
-   zuluide::i2c::client::Packet* toRecv;
+#if ZULUIDE_DUAL_CORE
+   TakeForwardedRequests();
+#endif
+   CheckLink();
+
+   zuluide::i2c::client::Message toRecv;
    if (TryReceive(&toRecv)) {
-      if (Is(toRecv, I2C_SERVER_API_VERSION)) {
-         ProcessServerAPIVersion(toRecv->buffer, toRecv->length);
-      } else if (Is(toRecv, I2C_SERVER_SYSTEM_STATUS_JSON)) {
-         ProcessSystemStatus(toRecv->buffer, toRecv->length);
-      } else if (Is(toRecv, I2C_SERVER_IMAGE_JSON)) {
-         ProcessImage(toRecv->buffer, toRecv->length);
-      } else if (Is(toRecv, I2C_SERVER_SSID)) {
-         ProcessSSID(toRecv->buffer, toRecv->length);
-      } else if (Is(toRecv, I2C_SERVER_SSID_PASS)) {
-         ProcessPassword(toRecv->buffer, toRecv->length);
-      } else if (Is(toRecv, I2C_SERVER_RESET)) {
+      TRACE_SCOPE(DISPATCH, toRecv.command);
+      if (Is(&toRecv, I2C_SERVER_API_VERSION)) {
+         NegotiateCapabilities(&toRecv);
+         ProcessServerAPIVersion(toRecv.data, toRecv.length);
+      } else if (Is(&toRecv, I2C_SERVER_SYSTEM_STATUS_JSON)) {
+         ProcessSystemStatus(toRecv.data, toRecv.length);
+      } else if (Is(&toRecv, I2C_SERVER_IMAGE_JSON)) {
+         ProcessImage(toRecv.data, toRecv.length);
+      } else if (Is(&toRecv, I2C_SERVER_CATALOG_DIFF)) {
+         ProcessCatalogDiff(toRecv.data, toRecv.length);
+      } else if (Is(&toRecv, I2C_SERVER_SSID)) {
+         ProcessSSID(toRecv.data, toRecv.length);
+      } else if (Is(&toRecv, I2C_SERVER_SSID_PASS)) {
+         ProcessPassword(toRecv.data, toRecv.length);
+      } else if (Is(&toRecv, I2C_SERVER_RESET)) {
          ProcessReset();
       }
 
-      // Cleanup buffer and put back into service.
-      Cleanup(toRecv);
+      if (retryMessage) {
+         // Keep the message, and those behind it, in the ring for the next call.
+         retryMessage = false;
+         return;
+      }
+
+      // Release the message's space in the ring.
+      Cleanup(&toRecv);
+   }
+}
+
+bool HoldOff() {
+   i2c_hw_t* hw = i2c_get_hw(i2c0);
+   // Only between whole messages, with nothing in flight either way. A full
+   // ring already holds the link off, and only Cleanup may resume it then.
+   if (rxFull || rxState != SendState::None || !queue_is_empty(&outputQueue) || dma_channel_is_busy(txDmaChannel) ||
+       (hw->status & I2C_IC_STATUS_SLV_ACTIVITY_BITS) || i2c_get_read_available(i2c0) > 0) {
+      return false;
+   }
+
+   // A start seen after the check is still in its address byte, which takes
+   // far longer than getting here, so the address is not acknowledged.
+   hw->enable = 0;
+   while (hw->enable_status & I2C_IC_ENABLE_STATUS_IC_EN_BITS) {
+      tight_loop_contents();
+   }
+
+   if (hw->enable_status & I2C_IC_ENABLE_STATUS_SLV_DISABLED_WHILE_BUSY_BITS) {
+      // The master was refused part way in and tries again.
+      hw->enable = I2C_IC_ENABLE_ENABLE_BITS;
+      return false;
+   }
+
+   holdOffs++;
+   return true;
+}
+
+void ResumeLink() {
+   i2c_get_hw(i2c0)->enable = I2C_IC_ENABLE_ENABLE_BITS;
+}
+
+static void FillQueueStats(queue_t* queue, QueueStats* stats) {
+   stats->level = queue_get_level(queue);
+   stats->maxLevel = queue_get_max_level(queue);
+   stats->capacity = queue->element_count;
+}
+
+void GetQueueStats(QueueStats* output) {
+   FillQueueStats(&outputQueue, output);
+}
+
+void GetLinkStats(LinkStats* stats) {
+   stats->baudrate = currentBaudrate;
+   stats->txChunk = txChunk;
+   stats->txAborts = txAborts;
+   stats->framingErrors = framingErrors;
+   stats->fallbacks = fallbacks;
+   stats->rxBytes = rxBytes;
+   stats->txBytes = txBytes;
+   stats->throughput = throughput;
+   stats->catalogDiffs = catalogDiffs;
+   stats->holdOffs = holdOffs;
+}
+
+void GetCommandStats(CommandStats* stats) {
+   *stats = commandStats;
+}
+
+void GetReceiveStats(RingStats* stats) {
+   stats->size = RX_RING_SIZE;
+   stats->used = RingUsed(rxHead, rxTail);
+   stats->highWater = rxHighWater;
+   stats->pending = rxCommitted - rxConsumed;
+   stats->maxPending = rxMaxPending;
+   stats->dropped = rxDropped;
+   stats->holds = rxHolds;
+}
+
+void GetOutputPoolStats(PoolStats stats[OUTPUT_POOL_CLASSES]) {
+   for (int i = 0; i < OUTPUT_POOL_CLASSES; i++) {
+      PacketPool* pool = &outputPools[i];
+      stats[i].payloadSize = pool->payloadSize;
+      stats[i].capacity = pool->count;
+      stats[i].inUse = pool->count - queue_get_level(&pool->free);
+      stats[i].highWater = pool->count - pool->minFree;
+      stats[i].exhausted = pool->exhausted;
    }
 }
 }  // namespace zuluide::i2c::client
@@ -22,15 +22,39 @@
 #ifndef ZULU_CONTROL_I2C_CLIENT
 #define ZULU_CONTROL_I2C_CLIENT
 
-#define I2C_API_VERSION "2.0.0"
+#define I2C_API_VERSION "2.1.0"
 
 #define MAX_MSG_SIZE 2048
 #define BUFFER_LENGTH 8
-#define INPUT_BUFFER_COUNT 5
+#define OUTPUT_QUEUE_DEPTH 20
+
+// Largest payload chunk sent per master read once negotiated with the server.
+#define I2C_TX_CHUNK_MAX MAX_MSG_SIZE
+
+// Number of bus speeds (100 kHz, 400 kHz and 1 MHz) that can be negotiated.
+#define I2C_SPEED_COUNT 3
+// Framing errors within the window that make the client drop to a slower speed.
+#define I2C_FALLBACK_ERRORS 3
+#define I2C_FALLBACK_WINDOW_US 1000000
+#define I2C_THROUGHPUT_WINDOW_US 1000000
+
+// Received messages are framed back to back in a byte ring. It must hold at
+// least two maximum size frames so one always fits contiguously once drained.
+#define RX_RING_SIZE (3 * MAX_MSG_SIZE)
+
+// Outbound packets come from fixed size classes so enqueueing never allocates.
+#define OUTPUT_POOL_CLASSES 3
+#define SMALL_PACKET_PAYLOAD 32
+#define SMALL_PACKET_COUNT OUTPUT_QUEUE_DEPTH
+#define MEDIUM_PACKET_PAYLOAD 256
+#define MEDIUM_PACKET_COUNT 4
+#define LARGE_PACKET_PAYLOAD MAX_MSG_SIZE
+#define LARGE_PACKET_COUNT 1
 
 #define I2C_SERVER_API_VERSION  0x1
 #define I2C_SERVER_SYSTEM_STATUS_JSON 0xA
 #define I2C_SERVER_IMAGE_JSON 0xB
+#define I2C_SERVER_CATALOG_DIFF 0xC
 #define I2C_SERVER_SSID 0xD
 #define I2C_SERVER_SSID_PASS 0xE
 #define I2C_SERVER_RESET 0xF
@@ -46,8 +70,12 @@
 #define I2C_CLIENT_FETCH_ITR_IMAGE 0x10
 #define I2C_CLIENT_IP_ADDRESS 0x11
 #define I2C_CLIENT_NET_DOWN 0x12
+#define I2C_CLIENT_CAPABILITIES 0x13
+#define I2C_CLIENT_FETCH_CATALOG_DIFF 0x14
 
 
+#include <hardware/dma.h>
+#include <hardware/sync.h>
 #include <pico/i2c_slave.h>
 #include <pico/stdlib.h>
 #include <pico/util/queue.h>
@@ -63,20 +91,115 @@ enum class SendState { None,
                        SentLength };
 
 /**
-   Stores the messages received from the I2C server along with the meta data
-   used to track the receive progress.
+   A message received from the I2C server. The data points into the receive
+   ring, is NUL terminated and stays valid until the message is cleaned up.
+ */
+typedef struct {
+   uint8_t command;
+   uint16_t length;
+   const uint8_t* data;
+   // Ring offset of the frame following this message.
+   uint32_t end;
+} Message;
+
+/**
+   A request waiting to be sent to the I2C server. The payload buffer belongs
+   to the pool size class the packet was taken from.
  */
 typedef struct {
    uint16_t pos;
    uint8_t command;
+   uint8_t sizeClass;
    uint16_t length;
    uint8_t lengthBytes[2];
-   uint8_t buffer[MAX_MSG_SIZE];
+   uint8_t* buffer;
    SendState state;
-} Packet;
+} OutboundPacket;
+
+/**
+   Occupancy of one outbound packet size class.
+ */
+typedef struct {
+   uint payloadSize;
+   uint capacity;
+   uint inUse;
+   uint highWater;
+   // Requests that found the class empty (and moved up to a larger class or failed).
+   uint exhausted;
+} PoolStats;
+
+/**
+   Occupancy of the receive ring.
+ */
+typedef struct {
+   uint size;
+   uint used;
+   uint highWater;
+   uint pending;
+   uint maxPending;
+   // Messages discarded because the ring was full or the length was invalid.
+   uint dropped;
+   // Times the server was refused until the main loop made room.
+   uint holds;
+} RingStats;
+
+/**
+   Settings negotiated with the I2C server and transmit health.
+ */
+typedef struct {
+   uint baudrate;
+   uint txChunk;
+   // Chunks abandoned because the master stopped reading part way through.
+   uint txAborts;
+   // Invalid lengths, truncated frames and aborted chunks.
+   uint framingErrors;
+   // Times the client dropped to a slower speed.
+   uint fallbacks;
+   uint rxBytes;
+   uint txBytes;
+   // Bytes per second moved over the bus during the last measurement window.
+   uint throughput;
+   // Whether the server sends the changes to its image catalog as diffs.
+   bool catalogDiffs;
+   // Times the link was held off with HoldOff.
+   uint holdOffs;
+} LinkStats;
+
+// Command IDs counted separately by GetCommandStats, higher ones are counted with the last.
+#define I2C_COMMAND_IDS 0x20
+
+/**
+   Messages and bytes, including the command and length, moved with one command ID.
+ */
+typedef struct {
+   uint messages;
+   uint bytes;
+} CommandCounters;
+
+/**
+   Traffic per command ID. An idle poll answered with I2C_CLIENT_NOOP counts
+   as a message sent.
+ */
+typedef struct {
+   CommandCounters received[I2C_COMMAND_IDS];
+   CommandCounters sent[I2C_COMMAND_IDS];
+   // Requests that could not be queued because no packet or queue slot was free.
+   uint enqueueFailures;
+} CommandStats;
+
+/**
+   Current depth, high-water mark and capacity of a queue shared with the I2C interrupt.
+ */
+typedef struct {
+   uint level;
+   uint maxLevel;
+   uint capacity;
+} QueueStats;
 
 /**
    Enqueues a request to send to the I2C server with an empty string argument.
+   In dual core mode a request made on the other core is passed to the
+   client's core through a lock-free ring and queued there.
  */
 bool EnqueueRequest(uint8_t request);
 
@@ -100,6 +223,11 @@ void ProcessSystemStatus(const uint8_t* message, size_t length);
 */
 void ProcessImage(const uint8_t* message, size_t length);
 
+/**
+   Called with each message of a catalog diff received from the I2C server.
+ */
+void ProcessCatalogDiff(const uint8_t* message, size_t length);
+
 /**
    Called when the WiFi SSID is received from the server.
 */
@@ -116,29 +244,85 @@ void ProcessPassword(const uint8_t* message, size_t length);
 void ProcessReset();
 
 /**
-   Configures the I2C communication parameters.
+   Called from the I2C interrupt when a message has been received, or from the
+   other core when it forwards a request, so the client's main loop can wake
+   up and call ProcessMessages.
+ */
+void NotifyMessageReceived();
+
+/**
+   Configures the I2C communication parameters. The bus starts at buad and can
+   be raised up to maxBuad if the server supports it.
 */
-void Init(unsigned int sdaPin, unsigned int sclPin, unsigned int addr, unsigned int buad);
+void Init(unsigned int sdaPin, unsigned int sclPin, unsigned int addr, unsigned int buad, unsigned int maxBuad);
 
 /**
-   Utility method to cleanup a packet and place it back in the available queue.
+   Utility method to release a message's space in the receive ring.
 */
-void Cleanup(Packet* packet);
+void Cleanup(Message* message);
+
+/**
+   Called by a message handler that cannot take its message yet. The message
+   stays in the receive ring and is handed to the handler again by a later
+   ProcessMessages, with the messages behind it waiting their turn. Once the
+   ring fills the server is refused until there is room.
+ */
+void RetryLater();
 
 /**
    Predicate for detecting the tyope of message/command received from the I2C server.
 */
-bool Is(Packet* toCheck, uint8_t messageID);
+bool Is(const Message* toCheck, uint8_t messageID);
 
 /**
-   Pulls the next message received from the I2C server, returning true if one is available and false if not.
+   Peeks at the next message received from the I2C server, returning true if one is available and false if not.
  */
-bool TryReceive(Packet** packet);
+bool TryReceive(Message* message);
 
 /**
    Executes the message processing and dispatching loop.
  */
 void ProcessMessages();
+
+/**
+   Stops answering the I2C server so a flash operation, which stalls the I2C
+   interrupt, cannot overrun the receive FIFO or stretch the clock past the
+   master's timeout. Only succeeds between whole messages while the bus is
+   idle. Until ResumeLink the master's address is not acknowledged, which it
+   takes as busy and tries again, the way it polls an EEPROM that is writing.
+   Returns false if the link is busy.
+ */
+bool HoldOff();
+
+/**
+   Answers the I2C server again after HoldOff.
+ */
+void ResumeLink();
+
+/**
+   Reports the state of the output queue.
+ */
+void GetQueueStats(QueueStats* output);
+
+/**
+   Reports the negotiated link settings.
+ */
+void GetLinkStats(LinkStats* stats);
+
+/**
+   Reports the messages and bytes moved per command ID.
+ */
+void GetCommandStats(CommandStats* stats);
+
+/**
+   Reports the state of the receive ring.
+ */
+void GetReceiveStats(RingStats* stats);
+
+/**
+   Reports the occupancy of each outbound packet size class, smallest first.
+ */
+void GetOutputPoolStats(PoolStats stats[OUTPUT_POOL_CLASSES]);
 }  // namespace zuluide::i2c::client
 
 #endif
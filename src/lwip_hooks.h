@@ -0,0 +1,51 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ **/
+
+#ifndef LWIP_HOOKS_H
+#define LWIP_HOOKS_H
+
+/**
+   lwIP hooks, included by the lwIP sources through LWIP_HOOK_FILENAME.
+ */
+
+#include "lwip/err.h"
+
+struct tcp_pcb;
+struct tcp_hdr;
+struct pbuf;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   Records the request headers the web server needs from each TCP segment
+   received, before httpd parses the request.
+ */
+err_t zuluide_web_scan_request(struct tcp_pcb *pcb, const struct tcp_hdr *hdr, struct pbuf *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define LWIP_HOOK_TCP_INPACKET_PCB(pcb, hdr, optlen, opt1len, opt2, p) zuluide_web_scan_request(pcb, hdr, p)
+
+#endif
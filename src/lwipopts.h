@@ -36,9 +36,10 @@
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
-#define MEM_STATS                   0
+// Heap and pool usage, reported by /metrics.
+#define MEM_STATS                   1
 #define SYS_STATS                   0
-#define MEMP_STATS                  0
+#define MEMP_STATS                  1
 #define LINK_STATS                  0
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM       3
@@ -55,6 +56,9 @@
 #define LWIP_HTTPD_CUSTOM_FILES     1
 #define LWIP_HTTPD_DYNAMIC_HEADERS  1
 #define LWIP_HTTPD_FILE_EXTENSION   1
+#define LWIP_HTTPD_DYNAMIC_FILE_READ 1
+#define LWIP_HTTPD_FS_ASYNC_READ    1
+#define LWIP_HOOK_FILENAME          "lwip_hooks.h"
 
 #ifndef NDEBUG
 #define LWIP_DEBUG                  1
@@ -20,48 +20,282 @@
  **/
 
 #include <hardware/watchdog.h>
+#include <pico/flash.h>
 #include <pico/i2c_slave.h>
+#include <pico/multicore.h>
+#include <pico/rand.h>
 #include <pico/stdlib.h>
 #include <pico/util/queue.h>
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <string>
-#include <vector>
 
+#include "CatalogSync.h"
+#include "EventRing.h"
+#include "EventScheduler.h"
+#include "FlashStore.h"
+#include "ImageCatalog.h"
+#include "Log.h"
+#include "LongPoll.h"
+#include "Metrics.h"
+#include "RequestHeaders.h"
+#include "SpscRing.h"
+#include "StatusStore.h"
+#include "Trace.h"
+#include "WebAssets.h"
+#include "WebSocketServer.h"
 #include "ZuluControlI2CClient.h"
-#include "index_html.h"
 #include "lwip/apps/fs.h"
 #include "lwip/apps/httpd.h"
 #include "lwip/def.h"
-#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/netif.h"
 #include "lwip/opt.h"
+#include "lwip/stats.h"
 #include "pico/cyw43_arch.h"
 #include "url_decode.h"
 
 static const uint I2C_SLAVE_ADDRESS = 0x45;
-static const uint I2C_BAUDRATE = 100000;  // 100 kHz
+
+// Bus speed at boot and the fastest speed that may be negotiated with the ZuluIDE (set by CMake).
+#ifndef I2C_BAUDRATE
+#define I2C_BAUDRATE 100000
+#endif
+#ifndef I2C_MAX_BAUDRATE
+#define I2C_MAX_BAUDRATE 1000000
+#endif
+
+// Runs the I2C client on core 1 while core 0 runs the network (set by CMake).
+#ifndef ZULUIDE_DUAL_CORE
+#define ZULUIDE_DUAL_CORE 0
+#endif
 
 static const uint I2C_SLAVE_SDA_PIN = 0;  // PICO_DEFAULT_I2C_SDA_PIN; // 4
 static const uint I2C_SLAVE_SCL_PIN = 1;  // PICO_DEFAULT_I2C_SCL_PIN; // 5
 
 enum class ImageCacheState { Idle,
                              Fetching,
-                             Full,
-                             Iterating,
-                             IteratingFinished };
+                             Full };
 
 static volatile ImageCacheState imageState = ImageCacheState::Idle;
 
 static char versionJson[MAX_MSG_SIZE];
 
-static char currentStatus[MAX_MSG_SIZE];
+static char versionResponse[MAX_MSG_SIZE + 512];
+
+static zuluide::StatusStore statusStore;
+
+// Clients iterating the images with /nextImage at once, and how long a
+// client may leave its iteration idle before it is forgotten.
+#define IMAGE_CURSORS 4
+#define IMAGE_CURSOR_IDLE_US 60000000
+
+/**
+   A client's position in the image catalog while it iterates the images.
+   Every client reads the same catalog, which is fetched from the I2C server
+   once.
+ */
+typedef struct {
+   // Identifies the client's iteration, 0 while the cursor is free.
+   uint32_t token;
+   uint32_t generation;
+   size_t position;
+   uint64_t lastUsed;
+} ImageCursor;
+
+static ImageCursor imageCursors[IMAGE_CURSORS];
+
+// Cursor and number of images asked for by the /nextImage request being
+// opened. A count of 0 asks for a single image rather than an array.
+static uint32_t nextImageToken = 0;
+static size_t nextImageCount = 0;
+
+// Built by the core running the I2C client and read by the web server under
+// the catalog's sequence lock.
+static zuluide::ImageCatalog imageCatalog;
+static zuluide::CatalogSync catalogSync(&imageCatalog);
+
+// Record types kept in the flash store.
+#define STORE_CREDENTIALS 1
+#define STORE_CATALOG 2
+
+// Set in StoredCatalog::flags when serverGeneration is known.
+#define STORED_CATALOG_GENERATION 0x1
+
+/**
+   Start of the image catalog kept in flash, followed by each record as a 16
+   bit length and the record itself.
+ */
+typedef struct {
+   uint32_t count;
+   uint32_t serverGeneration;
+   uint32_t flags;
+} StoredCatalog;
+
+static zuluide::FlashStore flashStore;
+// Catalog generation held in flash, the one being saved and the next record to save.
+static uint32_t savedCatalogGeneration = UINT32_MAX;
+static uint32_t savingCatalogGeneration = 0;
+static size_t savingEntry = 0;
+static bool credentialsChanged = false;
+
+// Set when the WiFi credentials came from flash, so the network is started
+// without waiting for the I2C server.
+static bool warmBoot = false;
+// Set until a catalog restored from flash is checked against the server's.
+static bool catalogRestored = false;
+static bool serverVersionReceived = false;
+// Without catalog diffs the restored catalog is compared with the server's
+// as it is fetched again, and kept while the records match. Kept by the core
+// building the catalog.
+static bool catalogRevalidating = false;
+static size_t revalidatedCount = 0;
+// Set when the server's credentials differ from those the network was started with.
+static bool reconnectWiFi = false;
+
+// Time from boot until the network is up and until the first image list is served.
+static uint64_t bootUs = 0;
+static uint32_t bootNetworkMs = 0;
+static uint32_t bootImagesMs = 0;
+
+// Events that wake the main loops.
+#define EVENT_I2C 0             // The I2C client received a message, or is due to check its link.
+#define EVENT_SERVER_MESSAGE 1  // The I2C core passed on a message (dual core mode).
+#define EVENT_WEB 2             // The status or image catalog changed.
+#define EVENT_LINK 3            // The WiFi link went up or down.
+#define EVENT_FLASH 4           // More of the catalog is waiting to be written to flash.
+#define EVENT_TICK 5            // Time to check long poll deadlines and heartbeats.
+#define EVENT_FETCH_CATALOG 6   // A client asked for the image catalog (I2C client's core).
+#define EVENT_CHECK_CATALOG 7   // The restored catalog is due to be checked (I2C client's core).
+#define EVENT_LOG 8             // More log messages are waiting to be printed.
+
+// Log messages printed each time the network core handles an event.
+#define LOG_DRAIN_PER_EVENT 8
+
+#define MAIN_LOOP_TICK_MS 100
+static repeating_timer_t tickTimer;
+
+// Wakes the network core, and the core running the I2C client.
+static zuluide::EventScheduler networkEvents;
+#if ZULUIDE_DUAL_CORE
+static zuluide::EventScheduler i2cCoreEvents;
+static zuluide::EventScheduler &i2cEvents = i2cCoreEvents;
+#else
+static zuluide::EventScheduler &i2cEvents = networkEvents;
+#endif
+
+#if ZULUIDE_DUAL_CORE
+#define CORE1_STACK_SIZE 8192
+static uint32_t core1Stack[CORE1_STACK_SIZE / sizeof(uint32_t)];
+
+// Messages from the I2C server that change the network core's state, passed
+// on by the I2C core.
+static zuluide::SpscRing networkInbox;
+static_assert(SPSC_RING_SIZE >= 2 * (MAX_MSG_SIZE + SPSC_HEADER_SIZE), "The network inbox must hold two of the largest messages");
+#endif
+
+// Distinguishes entity tags from those handed out before a reboot.
+static uint32_t eTagSeed;
+
+#define RESPONSE_HEADER_MAX 192
+
+// Time httpd leaves a connection with nothing to send before dropping it: it
+// polls every HTTPD_POLL_INTERVAL half seconds and gives up after
+// HTTPD_MAX_RETRIES polls, the first of which may come straight away.
+#define HTTPD_IDLE_US ((HTTPD_MAX_RETRIES - 1) * HTTPD_POLL_INTERVAL * 500000ULL)
+
+// Longest a /status?since= request is held waiting for a newer status, a
+// second short of the time httpd would drop it.
+#define STATUS_LONG_POLL_US (HTTPD_IDLE_US - 1000000)
+
+// Sequence number from the /status request being opened, or -1.
+static long statusSince = -1;
+
+// Number of responses waiting for a newer status.
+static volatile int statusWaiters = 0;
+
+// Page of the catalog asked for by the /images request being opened, if
+// imagesPaged is set.
+static bool imagesPaged = false;
+static size_t imagesOffset = 0;
+static size_t imagesLimit = CATALOG_PAGE_DEFAULT;
+
+// Search asked for by the /images request being opened, if imagesSearched is set.
+#define IMAGES_QUERY_MAX 64
+static bool imagesSearched = false;
+static char imagesQuery[IMAGES_QUERY_MAX];
+static zuluide::CatalogSort imagesSort = zuluide::CatalogSort::None;
+static uint32_t imagesMatches[CATALOG_PAGE_MAX];
+
+// Connections allowed on /events at once, leaving the rest for requests.
+#define EVENTS_MAX_SUBSCRIBERS 3
+
+// Idle time after which /events subscribers are sent a comment to keep their
+// connections open.
+#define EVENTS_HEARTBEAT_US (HTTPD_IDLE_US - 1000000)
+
+static zuluide::EventRing events;
+
+static volatile int eventSubscribers = 0;
+
+static uint32_t eventsDropped = 0;
+
+// Position and sequence number of the latest status published to events. Set
+// stale when a subscriber needs the status published again.
+static uint64_t statusEvent = 0;
+static uint32_t statusEventSequence = 0;
+static volatile bool statusEventStale = false;
+
+static uint32_t catalogEventGeneration = 0;
 
-static queue_t imageQueue;
+static uint64_t lastEventTime = 0;
 
-static std::vector<char *> images;
+static char eventScratch[MAX_MSG_SIZE];
 
-static char *imageJson = NULL;
+static zuluide::web::WebSocketServer webSockets;
+
+static const char eventsBusy[] = "HTTP/1.0 503 Service Unavailable\r\nRetry-After: 30\r\nContent-Length: 0\r\n\r\n";
+
+/**
+   A response body being sent by the web server. Bodies are read from their
+   source as lwIP has room to send them rather than being copied whole into
+   the lwIP heap.
+ */
+typedef struct {
+   bool inUse;
+   const char *source;
+   char *owned;
+   bool catalog;
+   uint32_t generation;
+   // Set when only the records pageFirst to pageFirst + pageCount - 1 of the
+   // catalog are sent, between the header and a closing "]}".
+   bool page;
+   size_t pageFirst;
+   size_t pageCount;
+   // HTTP headers sent ahead of the body when httpd does not generate them.
+   char header[RESPONSE_HEADER_MAX];
+   int headerLength;
+   // Set for an /events subscriber, reading from cursor in events.
+   bool events;
+   uint64_t cursor;
+   // Holds a status response until a newer status arrives.
+   zuluide::web::LongPoll poll;
+   // Resumes the delayed response.
+   fs_wait_cb resume;
+   void *resumeArg;
+#if ZULUIDE_TRACE
+   // Set for a /trace response.
+   zuluide::trace::Export *trace;
+#endif
+} ResponseStream;
+
+// One per connection the web server can have open.
+static ResponseStream responseStreams[MEMP_NUM_TCP_PCB];
 
 static std::string wifiPass;
 
@@ -77,9 +311,72 @@ enum class State {
                    WIFIDown,
                    Normal };
 
-static State programState = State::WaitForAPIVersion;
+// Read by both cores.
+static std::atomic<State> programState{State::WaitForAPIVersion};
+
+void ServiceWebResponses();
+static void RequestCatalogDiff();
+
+/**
+   Saves credentials that differ from those in flash. After a warm boot the
+   network was started with the saved ones, so it is started again.
+ */
+static void UpdateCredentials() {
+   std::string credentials = wifiSSID + '\0' + wifiPass;
+   size_t length;
+   const uint8_t *saved = flashStore.Find(STORE_CREDENTIALS, &length);
+   if (saved != NULL && length == credentials.length() && memcmp(saved, credentials.data(), length) == 0) {
+      return;
+   }
+
+   credentialsChanged = true;
+   if (warmBoot) {
+      reconnectWiFi = true;
+   }
+}
+
+/**
+   In dual core mode, passes a message from the I2C core to the network core
+   and returns true. Returns false when already running on the network core.
+ */
+static bool ForwardToNetworkCore(uint8_t command, const uint8_t *message, size_t length) {
+#if ZULUIDE_DUAL_CORE
+   if (get_core_num() != 0) {
+      if (networkInbox.Fits(length)) {
+         networkInbox.Push(command, message, length);
+      } else {
+         // The server's answers cannot be lost, so the I2C client keeps the
+         // message until the network core has emptied the inbox, refusing the
+         // server once its own ring fills.
+         zuluide::i2c::client::RetryLater();
+      }
+
+      networkEvents.Post(EVENT_SERVER_MESSAGE);
+      return true;
+   }
+#endif
+
+   return false;
+}
+
+/**
+   Brackets changes to the image catalog. In single core mode the web
+   server's lwIP callbacks interrupt the main loop, so the catalog is changed
+   under the lwIP lock, and a reader never waits on a change it interrupted.
+   The I2C core changes it without the lock, and the network core reads
+   again if a change overlapped its read.
+ */
+static void BeginCatalogChange() {
+#if !ZULUIDE_DUAL_CORE
+   cyw43_arch_lwip_begin();
+#endif
+}
 
-void RebuildImageJson();
+static void EndCatalogChange() {
+#if !ZULUIDE_DUAL_CORE
+   cyw43_arch_lwip_end();
+#endif
+}
 
 namespace zuluide::i2c::client {
 
@@ -88,11 +385,15 @@ namespace zuluide::i2c::client {
  */
 
 void  ProcessServerAPIVersion(const uint8_t *message, size_t length) {
+   if (ForwardToNetworkCore(I2C_SERVER_API_VERSION, message, length)) {
+      return;
+   }
+
    memset(versionJson, '\0', sizeof(versionJson));
    strcat(versionJson, "{\"clientAPIVersion\":\"");
    strcat(versionJson, I2C_API_VERSION);
    strcat(versionJson, "\"");
-   printf("Client API version: v%s\n", I2C_API_VERSION );
+   LOG_INFO("Client API version: v%s\n", I2C_API_VERSION );
    bool matching_major_version = false;
    unsigned long server_major_version = 0;
    unsigned long client_major_version = 0;
@@ -105,7 +406,7 @@ void  ProcessServerAPIVersion(const uint8_t *message, size_t length) {
       strcat(versionJson, ", \"serverAPIVersion\":\"");
       strcat(versionJson, (const char*)message);
       strcat(versionJson, "\"");
-      printf("Server API version: v%s\n", message);
+      LOG_INFO("Server API version: v%s\n", (const char*)message);
 
       period_location = strchr((const char*)message, '.');
       if (period_location != NULL)
@@ -124,19 +425,19 @@ void  ProcessServerAPIVersion(const uint8_t *message, size_t length) {
    else
    {
       strcat(versionJson, ", \"serverAPIVersion\":\"Unknown\"");
-      printf("Error: no API version received from server\n");
+      LOG_ERROR("Error: no API version received from server\n");
    }
 
    if (!matching_major_version)
    {
       strcat(versionJson, ", \"message\":\"API major version mismatch. Please update both devices to the latest firmware. <br/> <a href='https://github.com/ZuluIDE/ZuluIDE-firmware/releases'>ZuluIDE firmware</a><br /><a href='https://github.com/ZuluIDE/ZuluIDE-HTTP-PicoW/releases'>ZuluIDE-HTTP-PicoW firmware</a>\"");
-      printf("Warning: major versions between client and sever do not match. Please upgrade both devices to the latest firmware\n");
-      printf("https://github.com/ZuluIDE/ZuluIDE-HTTP-PicoW/releases\n");
-      printf("https://github.com/ZuluIDE/ZuluIDE-firmware/releases\n");
+      LOG_WARN("Warning: major versions between client and sever do not match. Please upgrade both devices to the latest firmware\n");
+      LOG_WARN("https://github.com/ZuluIDE/ZuluIDE-HTTP-PicoW/releases\n");
+      LOG_WARN("https://github.com/ZuluIDE/ZuluIDE-firmware/releases\n");
    }
 
    strcat(versionJson, "}");
-
+   serverVersionReceived = true;
 }
 
 /**
@@ -144,39 +445,107 @@ void  ProcessServerAPIVersion(const uint8_t *message, size_t length) {
    into a local buffer for use by the web server.
  */
 void ProcessSystemStatus(const uint8_t *message, size_t length) {
-   memset(currentStatus, 0, MAX_MSG_SIZE);
-   memcpy(currentStatus, message, MAX_MSG_SIZE);
+   statusStore.Publish(message, length);
+   networkEvents.Post(EVENT_WEB);
 }
 
 /**
    Callback function fo rreceiving an image from the I2C server.
-   If the web service is iterating, the image is cached for the
-   next iterate request from the web server client. If the
-   web service is retreiving all fo the images, it is cached in a
-   vector until all are received and a single JSON document
-   is built for all of the images.
+   The image is appended to the image catalog, which holds the JSON
+   document for all of the images and is shared by every client
+   listing or iterating them.
  */
 void ProcessImage(const uint8_t *message, size_t length) {
+   // Pages of the catalog are read by the web server while records arrive.
+   BeginCatalogChange();
+   if (catalogRevalidating) {
+      size_t entryLength;
+      const char *entry = imageCatalog.Entry(revalidatedCount, &entryLength);
+      if (length > 0 && entry != NULL && entryLength == length && memcmp(entry, message, length) == 0) {
+         revalidatedCount++;
+         EndCatalogChange();
+         return;
+      }
+
+      catalogRevalidating = false;
+      if (length == 0 && revalidatedCount == imageCatalog.Count()) {
+         LOG_INFO("Image catalog restored from flash is up to date.\n");
+         imageState = ImageCacheState::Full;
+         EndCatalogChange();
+         return;
+      }
+
+      // The SD card changed, keep the records that match and take the rest as they arrive.
+      imageCatalog.Truncate(revalidatedCount);
+      imageCatalog.Reopen();
+      imageState = ImageCacheState::Fetching;
+   } else if (imageCatalog.IsComplete()) {
+      if (length == 0) {
+         // A repeated end of the list changes nothing.
+         EndCatalogChange();
+         return;
+      }
+
+      // Records arriving after the list was finished start a new list rather
+      // than being added to the old one.
+      imageCatalog.Clear();
+      imageState = ImageCacheState::Fetching;
+   }
+
    if (length > 0) {
-      char *image = new char[length + 1];
-      memset(image, 0, length + 1);
-      memcpy(image, message, length);
-      if (imageState == ImageCacheState::Iterating) {
-         queue_try_add(&imageQueue, &image);
-      } else {
-         images.push_back(image);
+      if (!imageCatalog.Append(message, length)) {
+         LOG_ERROR("Out of memory adding image %zu to the catalog.\n", imageCatalog.Count());
       }
    } else {
-      if (imageState == ImageCacheState::Iterating) {
-         imageState = ImageCacheState::IteratingFinished;
-      } else {
-         // Rebuild the image.
-         RebuildImageJson();
+      imageCatalog.Finish();
+
+      auto stats = imageCatalog.Stats();
+      LOG_INFO("Image catalog: %zu images, %zu bytes, peak %zu bytes.\n", stats.entries, stats.bytes, stats.peakBytes);
 
-         // All images received.
+      // All images received.
+      imageState = ImageCacheState::Full;
+      networkEvents.Post(EVENT_WEB);
+   }
+
+   EndCatalogChange();
+}
+
+/**
+   Applies the changes the server sends when its SD card changes, and asks
+   for them when it announces a new catalog generation. A catalog no client
+   has asked for yet is left to be fetched when one does.
+ */
+void ProcessCatalogDiff(const uint8_t *message, size_t length) {
+   if (programState != State::Normal) {
+      return;
+   }
+
+   BeginCatalogChange();
+   switch (catalogSync.Apply(message, length)) {
+      case zuluide::SyncResult::Outdated:
+         // The catalog is served as it is until the changes arrive.
+         if (imageState != ImageCacheState::Idle) {
+            RequestCatalogDiff();
+         }
+
+         break;
+      case zuluide::SyncResult::Finished: {
+         auto stats = catalogSync.Stats();
+         LOG_INFO("Image catalog synced: %zu images, %lu added, %lu removed.\n", imageCatalog.Count(),
+                (unsigned long)stats.added, (unsigned long)stats.removed);
          imageState = ImageCacheState::Full;
+         networkEvents.Post(EVENT_WEB);
+         break;
       }
+      default:
+         if (!imageCatalog.IsComplete()) {
+            imageState = ImageCacheState::Fetching;
+         }
+
+         break;
    }
+
+   EndCatalogChange();
 }
 
 /**
@@ -184,22 +553,29 @@ void ProcessImage(const uint8_t *message, size_t length) {
    then a compiled constant is used (if avaialble).
  */
 void ProcessSSID(const uint8_t *message, size_t length) {
+   if (ForwardToNetworkCore(I2C_SERVER_SSID, message, length)) {
+      return;
+   }
+
    if (length > 0) {
       wifiSSID = std::string((const char *)message);
-      printf("Using WIFI SSID (%s) from the server.\n", wifiSSID.c_str());
+      LOG_INFO("Using WIFI SSID (%s) from the server.\n", wifiSSID.c_str());
    } else if (sizeof(WIFI_SSID) > 0) {
       wifiSSID = std::string(WIFI_SSID);
-      printf("Using WIFI SSID (%s) compiled into the application.\n", wifiSSID.c_str());
+      LOG_INFO("Using WIFI SSID (%s) compiled into the application.\n", wifiSSID.c_str());
    } else {
-      printf("No WIFI SSID retrieved from server and none compiled into the application.");
+      LOG_ERROR("No WIFI SSID retrieved from server and none compiled into the application.\n");
    }
 
    if (wifiSSID.length() > 0) {
       if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_SSID_PASS)) {
-         printf("Failed to add request for SSID password to output queue.");
+         LOG_ERROR("Failed to add request for SSID password to output queue.\n");
       }
 
-      programState = State::WaitingForPassword;
+      // After a warm boot the network is already being started.
+      if (programState == State::WaitingForSSID) {
+         programState = State::WaitingForPassword;
+      }
    }
 }
 
@@ -208,23 +584,31 @@ void ProcessSSID(const uint8_t *message, size_t length) {
    then a compiled constant is used (if avaialble).
  */
 void ProcessPassword(const uint8_t *message, size_t length) {
+   if (ForwardToNetworkCore(I2C_SERVER_SSID_PASS, message, length)) {
+      return;
+   }
+
    if (length > 0) {
       wifiPass = std::string((const char *)message);
-      printf("Using WIFI password (%s) from the server.\n", wifiPass.c_str());
+      LOG_INFO("Using WIFI password (%s) from the server.\n", wifiPass.c_str());
    } else if (sizeof(WIFI_PASSWORD) > 0) {
       wifiPass = std::string(WIFI_PASSWORD);
-      printf("Using WIFI password (%s) compiled into the application.\n", wifiPass.c_str());
+      LOG_INFO("Using WIFI password (%s) compiled into the application.\n", wifiPass.c_str());
    } else {
-      printf("No WIFI password retrieved from server and none compiled into the application.");
+      LOG_ERROR("No WIFI password retrieved from server and none compiled into the application.\n");
    }
 
    if (wifiPass.length() > 0) {
       // Put a subscribe message in the queue so when we connect, we immediately subscribe.
       if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_SUBSCRIBE_STATUS_JSON)) {
-         printf("Failed to add subscribe to output queue.");
+         LOG_ERROR("Failed to add subscribe to output queue.\n");
       }
 
-      programState = State::WIFIInit;
+      if (programState == State::WaitingForPassword) {
+         programState = State::WIFIInit;
+      }
+
+      UpdateCredentials();
    }
 }
 
@@ -233,7 +617,7 @@ void ProcessPassword(const uint8_t *message, size_t length) {
    client receives the reset, it should reset because it may have old data.
  */
 void ProcessReset() {
-   printf("Reset Received.\n");
+   LOG_INFO("Reset Received.\n");
    // Was set to 1 sec which was causing the controller interface to miss initialization and data
    // transfer. Setting to 10ms for now, the wasn't any reasoning behind 10ms but it works
    // with more SD Cards. The theory is some SD cards caused a delay of more than 1 second
@@ -241,68 +625,457 @@ void ProcessReset() {
    // did allow the ZuluSCSI to connect to WiFi.
    watchdog_reboot(0, 0, 10);
 }
+
+/**
+   Wakes the main loops when the I2C client has received a message. Called
+   from the I2C interrupt.
+ */
+void NotifyMessageReceived() {
+   i2cEvents.Post(EVENT_I2C);
+}
+
 }  // namespace zuluide::i2c::client
 
+// Messages handled per EVENT_I2C, so a burst does not hold up other events.
+#define I2C_MESSAGES_PER_EVENT 8
+
+/**
+   Handles the messages the I2C client has received, which also lets it check
+   its link. Posts the event again if more are waiting.
+ */
+static void HandleI2CMessages() {
+   for (int i = 0; i < I2C_MESSAGES_PER_EVENT; i++) {
+      zuluide::i2c::client::RingStats before;
+      zuluide::i2c::client::RingStats after;
+      zuluide::i2c::client::GetReceiveStats(&before);
+      zuluide::i2c::client::ProcessMessages();
+      zuluide::i2c::client::GetReceiveStats(&after);
+      // A message left for later is retried when the network core has made
+      // room, and new messages post the event themselves.
+      if (after.pending == 0 || after.pending >= before.pending) {
+         return;
+      }
+   }
+
+   i2cEvents.Post(EVENT_I2C);
+}
+
+#if ZULUIDE_DUAL_CORE
+/**
+   Handles the I2C server's messages that the I2C core passed on to the
+   network core.
+ */
+static void ProcessServerMessages() {
+   static uint8_t message[MAX_MSG_SIZE + 1];
+   uint8_t command;
+   size_t length;
+   bool popped = false;
+   while (networkInbox.Pop(&command, message, MAX_MSG_SIZE, &length)) {
+      popped = true;
+      // The handlers read the message as a string.
+      message[length] = 0;
+      switch (command) {
+         case I2C_SERVER_API_VERSION:
+            zuluide::i2c::client::ProcessServerAPIVersion(message, length);
+            break;
+         case I2C_SERVER_SSID:
+            zuluide::i2c::client::ProcessSSID(message, length);
+            break;
+         case I2C_SERVER_SSID_PASS:
+            zuluide::i2c::client::ProcessPassword(message, length);
+            break;
+      }
+   }
+
+   if (popped) {
+      // The I2C core may be holding a message until there was room.
+      i2cEvents.Post(EVENT_I2C);
+   }
+}
+#endif
+
 /**
    Redirect a request to /version to /version.json.
  */
 static const char *cgi_handler_version(int index, int numParams, char *pcParam[], char *pcValue[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/version");
    return "/version.json";
 }
 
+/**
+   Subscribes to the Server-Sent Events stream of status and catalog changes.
+ */
+static const char *cgi_handler_events(int index, int numParams, char *pcParam[], char *pcValue[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/events");
+   return "/events.stream";
+}
+
 /**
    Redirect a request to /status to /status.json.
  */
 static const char *cgi_handler_status(int index, int numParams, char *pcParam[], char *pcValue[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/status");
+   statusSince = -1;
+   for (int i = 0; i < numParams; i++) {
+      if (strncmp(pcParam[i], "since", sizeof("since")) == 0) {
+         statusSince = strtol(pcValue[i], NULL, 10);
+      }
+   }
+
    return "/status.json";
 }
 
 /**
-   Fetches the entire set of images. If the images are not yet available then
-   a wait response is sent.
+   Asks the server for the changes to its catalog since the generation held.
  */
-static const char *cgi_handler_imgs(int index, int numParams, char *pcParam[], char *pcValue[]) {
+static void RequestCatalogDiff() {
+   char generation[16];
+   catalogSync.Request(generation, sizeof(generation));
+   if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_CATALOG_DIFF, generation)) {
+      LOG_ERROR("Failed to add fetch catalog diff to output queue.\n");
+   }
+}
+
+/**
+   Starts fetching the entire set of images if they have not been fetched,
+   which the core building the catalog does. Returns false while they are
+   being fetched.
+ */
+static bool FetchImages() {
    if (imageState == ImageCacheState::Idle) {
       imageState = ImageCacheState::Fetching;
+      i2cEvents.Post(EVENT_FETCH_CATALOG);
+   }
+
+   return imageState != ImageCacheState::Fetching;
+}
+
+/**
+   Asks the server for every image, on the core building the catalog.
+ */
+static void StartCatalogFetch() {
+   zuluide::i2c::client::LinkStats link;
+   zuluide::i2c::client::GetLinkStats(&link);
+   if (link.catalogDiffs) {
+      // The server answers with every record when no generation is held.
+      RequestCatalogDiff();
+   } else {
+      BeginCatalogChange();
+      imageCatalog.Clear();
+      EndCatalogChange();
       if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_IMAGES_JSON)) {
-         printf("Failed to add fetch images to output queue.");
+         LOG_ERROR("Failed to add fetch images to output queue.\n");
       }
    }
+}
+
+/**
+   Restores the WiFi credentials and image catalog saved in flash, so the
+   network can be started and the images served without waiting for the I2C
+   server.
+ */
+static void RestoreFromFlash() {
+   flashStore.Mount();
+
+   size_t length;
+   const uint8_t *credentials = flashStore.Find(STORE_CREDENTIALS, &length);
+   const uint8_t *separator = credentials != NULL ? (const uint8_t *)memchr(credentials, 0, length) : NULL;
+   if (separator != NULL) {
+      wifiSSID.assign((const char *)credentials, separator - credentials);
+      wifiPass.assign((const char *)separator + 1, credentials + length - separator - 1);
+      warmBoot = wifiSSID.length() > 0 && wifiPass.length() > 0;
+   }
+
+   const uint8_t *stored = flashStore.Find(STORE_CATALOG, &length);
+   if (stored != NULL && length >= sizeof(StoredCatalog)) {
+      StoredCatalog header;
+      memcpy(&header, stored, sizeof(header));
+      const uint8_t *record = stored + sizeof(header);
+      const uint8_t *end = stored + length;
+      imageCatalog.Clear();
+      for (uint32_t i = 0; i < header.count && end - record >= 2; i++) {
+         uint16_t recordLength;
+         memcpy(&recordLength, record, sizeof(recordLength));
+         record += sizeof(recordLength);
+         if (recordLength > end - record || !imageCatalog.Append(record, recordLength)) {
+            break;
+         }
+
+         record += recordLength;
+      }
+
+      if (imageCatalog.Count() == header.count) {
+         imageCatalog.Finish();
+         if (header.flags & STORED_CATALOG_GENERATION) {
+            catalogSync.Restore(header.serverGeneration);
+         }
 
-   if (imageState == ImageCacheState::Fetching) {
-      return "/wait.json";
+         savedCatalogGeneration = imageCatalog.Generation();
+         imageState = ImageCacheState::Full;
+         catalogRestored = true;
+      } else {
+         imageCatalog.Clear();
+      }
    }
 
-   return "/images.json";
+   auto stats = flashStore.Stats();
+   LOG_INFO("Flash store: %lu records found in %lu us%s%s.\n", (unsigned long)stats.mounted, (unsigned long)stats.mountUs,
+          warmBoot ? ", WiFi credentials restored" : "", catalogRestored ? ", image catalog restored" : "");
 }
 
 /**
-   Fetches the next image when iterating the images. A wait message is sent when
-   an image is not ready. A done message is sent when the iteration if finished.
+   Has a catalog restored from flash checked against the server's once the
+   server has answered, serving it as it is meanwhile.
  */
-static const char *cgi_handler_next_image(int index, int numParams, char *pcParam[], char *pcValue[]) {
-   if (imageState == ImageCacheState::Idle) {
-      if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_ITR_IMAGE)) {
-         printf("Failed to add iterate image to output queue.");
+static void RevalidateCatalog() {
+   if (!catalogRestored || !serverVersionReceived) {
+      return;
+   }
+
+   catalogRestored = false;
+   i2cEvents.Post(EVENT_CHECK_CATALOG);
+}
+
+/**
+   Asks the server for the changes to a restored catalog, or for every image
+   to compare, on the core building the catalog.
+ */
+static void StartCatalogCheck() {
+   if (imageState != ImageCacheState::Full) {
+      return;
+   }
+
+   zuluide::i2c::client::LinkStats link;
+   zuluide::i2c::client::GetLinkStats(&link);
+   if (link.catalogDiffs) {
+      RequestCatalogDiff();
+   } else {
+      catalogRevalidating = true;
+      revalidatedCount = 0;
+      if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_IMAGES_JSON)) {
+         LOG_ERROR("Failed to add fetch images to output queue.\n");
       }
+   }
+}
+
+// The next piece of a catalog save, copied out of the catalog: at most a
+// page of records plus one more.
+static uint8_t flashStaging[FLASH_PAGE_SIZE + sizeof(uint16_t) + MAX_MSG_SIZE];
+
+/**
+   Saves changed credentials and a newly completed catalog to flash, a page
+   or so of the catalog per call. Flash operations stall the I2C interrupt,
+   so each call runs with the I2C link held off between messages, and only
+   when nothing is waiting to go over it. Records are copied out under the
+   catalog's sequence lock, as the catalog may be fetched again meanwhile,
+   and written to flash once the copy is known to be whole. Returns true
+   while a save is under way.
+ */
+static bool PersistToFlash() {
+   bool catalogChanged = imageState == ImageCacheState::Full && imageCatalog.IsComplete() &&
+                         imageCatalog.Generation() != savedCatalogGeneration;
+   if (!flashStore.IsWriting() && !credentialsChanged && !catalogChanged) {
+      return false;
+   }
+
+   zuluide::i2c::client::QueueStats queue;
+   zuluide::i2c::client::RingStats ring;
+   zuluide::i2c::client::GetQueueStats(&queue);
+   zuluide::i2c::client::GetReceiveStats(&ring);
+   if (queue.level > 0 || ring.pending > 0 || !zuluide::i2c::client::HoldOff()) {
+      // Tried again on the next tick.
+      return false;
+   }
 
-      imageState = ImageCacheState::Iterating;
+   if (!flashStore.IsWriting() && credentialsChanged) {
+      credentialsChanged = false;
+      std::string credentials = wifiSSID + '\0' + wifiPass;
+      if (!flashStore.Begin(STORE_CREDENTIALS, credentials.length()) ||
+          !flashStore.Write((const uint8_t *)credentials.data(), credentials.length()) || !flashStore.Commit()) {
+         LOG_ERROR("Failed to save the WiFi credentials to flash.\n");
+      }
+
+      zuluide::i2c::client::ResumeLink();
+      return true;
+   }
+
+   size_t staged;
+   size_t recordLength;
+   bool begin;
+   bool changed;
+   size_t count;
+   size_t next;
+   uint32_t generation;
+   uint32_t begun;
+   do {
+      begun = imageCatalog.ReadBegin();
+      staged = 0;
+      recordLength = 0;
+      begin = false;
+      changed = false;
+      count = imageCatalog.Count();
+      next = savingEntry;
+      generation = imageCatalog.Generation();
+      if (!flashStore.IsWriting()) {
+         if (imageState == ImageCacheState::Full && imageCatalog.IsComplete() && generation != savedCatalogGeneration) {
+            StoredCatalog header = {(uint32_t)count, 0, 0};
+            if (catalogSync.Held(&header.serverGeneration)) {
+               header.flags |= STORED_CATALOG_GENERATION;
+            }
+
+            recordLength = sizeof(header);
+            for (size_t i = 0; i < count; i++) {
+               size_t entryLength;
+               imageCatalog.Entry(i, &entryLength);
+               recordLength += sizeof(uint16_t) + entryLength;
+            }
 
-      return "/wait.json";
-   } else if (imageState == ImageCacheState::Iterating) {
-      if (queue_is_empty(&imageQueue)) {
-         return "/wait.json";
+            next = 0;
+            memcpy(flashStaging, &header, sizeof(header));
+            staged = sizeof(header);
+            begin = true;
+         }
+      } else if (generation != savingCatalogGeneration) {
+         changed = true;
       } else {
-         // We have something that we are about to send out, lets fetch the next so we can be ready.
-         if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_ITR_IMAGE)) {
-            printf("Failed to add iterate image to output queue.");
+         while (next < count && staged < FLASH_PAGE_SIZE) {
+            size_t entryLength;
+            const char *entry = imageCatalog.Entry(next++, &entryLength);
+            if (entryLength > MAX_MSG_SIZE) {
+               // Read part way through a change, read again.
+               break;
+            }
+
+            uint16_t prefix = entryLength;
+            memcpy(flashStaging + staged, &prefix, sizeof(prefix));
+            memcpy(flashStaging + staged + sizeof(prefix), entry, entryLength);
+            staged += sizeof(prefix) + entryLength;
+         }
+      }
+   } while (!imageCatalog.ReadValid(begun));
+
+   savingEntry = next;
+   if (begin) {
+      savingCatalogGeneration = generation;
+      if (!flashStore.Begin(STORE_CATALOG, recordLength) || !flashStore.Write(flashStaging, staged)) {
+         LOG_ERROR("Unable to save the image catalog (%zu bytes) to flash.\n", recordLength);
+         savedCatalogGeneration = savingCatalogGeneration;
+      }
+   } else if (changed) {
+      // Changed while being saved, start again once it is complete.
+      flashStore.Abort();
+   } else if (flashStore.IsWriting()) {
+      bool ok = flashStore.Write(flashStaging, staged);
+      if (ok && savingEntry == count) {
+         ok = flashStore.Commit();
+         if (ok) {
+            savedCatalogGeneration = savingCatalogGeneration;
+            LOG_INFO("Image catalog of %zu images saved to flash.\n", count);
+         }
+      }
+
+      if (!ok) {
+         LOG_ERROR("Failed to save the image catalog to flash.\n");
+         flashStore.Abort();
+         savedCatalogGeneration = savingCatalogGeneration;
+      }
+   }
+
+   zuluide::i2c::client::ResumeLink();
+   return flashStore.IsWriting();
+}
+
+/**
+   Records how long after boot the first image list was served.
+ */
+static void NoteImagesServed() {
+   if (bootImagesMs == 0) {
+      bootImagesMs = std::max<uint32_t>(1, (time_us_64() - bootUs) / 1000);
+      LOG_INFO("First image list served %lu ms after boot.\n", (unsigned long)bootImagesMs);
+   }
+}
+
+/**
+   Fetches the entire set of images. If the images are not yet available then
+   a wait response is sent. With an offset or limit parameter a page of the
+   images is sent instead, as soon as the images on it have been received.
+   With a q or sort parameter the page holds the images whose names contain q,
+   in the order asked for.
+ */
+static const char *cgi_handler_imgs(int index, int numParams, char *pcParam[], char *pcValue[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/images");
+   imagesPaged = false;
+   imagesOffset = 0;
+   imagesLimit = CATALOG_PAGE_DEFAULT;
+   imagesSearched = false;
+   imagesQuery[0] = 0;
+   imagesSort = zuluide::CatalogSort::None;
+   for (int i = 0; i < numParams; i++) {
+      if (strncmp(pcParam[i], "q", sizeof("q")) == 0) {
+         imagesSearched = true;
+         urldecode(pcValue[i]);
+         strncpy(imagesQuery, pcValue[i], sizeof(imagesQuery) - 1);
+         imagesQuery[sizeof(imagesQuery) - 1] = 0;
+      } else if (strncmp(pcParam[i], "sort", sizeof("sort")) == 0) {
+         imagesSearched = true;
+         if (strcmp(pcValue[i], "name") == 0) {
+            imagesSort = zuluide::CatalogSort::Name;
+         } else if (strcmp(pcValue[i], "size") == 0) {
+            imagesSort = zuluide::CatalogSort::Size;
          }
+      } else if (strncmp(pcParam[i], "offset", sizeof("offset")) == 0) {
+         imagesPaged = true;
+         imagesOffset = strtoul(pcValue[i], NULL, 10);
+      } else if (strncmp(pcParam[i], "limit", sizeof("limit")) == 0) {
+         imagesPaged = true;
+         imagesLimit = std::min(strtoul(pcValue[i], NULL, 10), (unsigned long)CATALOG_PAGE_MAX);
       }
-   } else if (imageState == ImageCacheState::IteratingFinished) {
-      imageState = ImageCacheState::Idle;
-      return "/done.json";
    }
 
+   bool fetched = FetchImages();
+   if (imagesSearched) {
+      // Matches are only counted and sorted once every image has arrived.
+      return fetched ? "/imagesSearch.json" : "/wait.json";
+   }
+
+   if (imagesPaged) {
+      return fetched || imageCatalog.Count() >= imagesOffset + imagesLimit ? "/imagesPage.json" : "/wait.json";
+   }
+
+   return fetched ? "/images.json" : "/wait.json";
+}
+
+/**
+   Fetches the next image when iterating the images. A wait message is sent when
+   an image is not ready. A done message is sent when the iteration if finished.
+   With a count parameter up to that many images are sent at once in an array.
+   Each client's iteration is identified by a cursor token, passed as the
+   cursor parameter or the imageCursor cookie set by the first response.
+ */
+static const char *cgi_handler_next_image(int index, int numParams, char *pcParam[], char *pcValue[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/nextImage");
+   nextImageCount = 0;
+   nextImageToken = 0;
+
+   char cookie[16];
+   if (zuluide::web::RequestCookie("imageCursor", cookie, sizeof(cookie))) {
+      nextImageToken = strtoul(cookie, NULL, 16);
+   }
+
+   for (int i = 0; i < numParams; i++) {
+      if (strncmp(pcParam[i], "count", sizeof("count")) == 0) {
+         nextImageCount = std::min(strtoul(pcValue[i], NULL, 10), (unsigned long)CATALOG_PAGE_MAX);
+      } else if (strncmp(pcParam[i], "cursor", sizeof("cursor")) == 0) {
+         nextImageToken = strtoul(pcValue[i], NULL, 16);
+      }
+   }
+
+   FetchImages();
    return "/nextImage.json";
 }
 
@@ -311,12 +1084,14 @@ static const char *cgi_handler_next_image(int index, int numParams, char *pcPara
    query parameter imageName.
  */
 static const char *cgi_handler_image(int index, int numParams, char *params[], char *values[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/image");
    if (numParams > 0) {
       for (int i = 0; i < numParams; i++) {
          if (strncmp(params[i], "imageName", sizeof("imageName")) == 0) {
             // Decoding parameters that were URL encoded.
             urldecode(values[i]);
-            printf("Setting image to: %s\n", values[i]);
+            LOG_INFO("Setting image to: %s\n", values[i]);
             zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_LOAD_IMAGE, values[i]);
             return "/ok.json";
          }
@@ -330,56 +1105,200 @@ static const char *cgi_handler_image(int index, int numParams, char *params[], c
    Allows the user to eject the currently mounted image.
 */
 static const char *cgi_handler_eject(int index, int numParams, char *params[], char *values[]) {
+   TRACE_SCOPE(CGI, index);
+   zuluide::web::SelectRequest("/eject");
    zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_EJECT_IMAGE);
    return "/ok.json";
 }
 
+/**
+   Carries out a command from the WebSocket control channel, the same way as
+   the matching web request.
+ */
+static const char *HandleSocketCommand(const char *command, char *argument) {
+   if (strcmp(command, "load") == 0) {
+      if (argument[0] == 0) {
+         return "error";
+      }
+
+      LOG_INFO("Setting image to: %s\n", argument);
+      return zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_LOAD_IMAGE, argument) ? "ok" : "busy";
+   } else if (strcmp(command, "eject") == 0) {
+      return zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_EJECT_IMAGE) ? "ok" : "busy";
+   } else if (strcmp(command, "list") == 0) {
+      return FetchImages() ? "ok" : "wait";
+   }
+
+   return NULL;
+}
+
 static const tCGI cgi_handlers[] = {
                                     {"/version", cgi_handler_version},
                                     {"/status", cgi_handler_status},
+                                    {"/events", cgi_handler_events},
                                     {"/images", cgi_handler_imgs},
                                     {"/image", cgi_handler_image},
                                     {"/eject", cgi_handler_eject},
                                     {"/nextImage", cgi_handler_next_image}};
 
+/**
+   Wakes the network core for its periodic work, and the I2C client to check
+   its link. Runs in the timer interrupt.
+ */
+static bool Tick(repeating_timer_t *timer) {
+   networkEvents.Post(EVENT_TICK);
+   i2cEvents.Post(EVENT_I2C);
+   return true;
+}
+
+/**
+   Called by lwIP when the WiFi link goes up or down.
+ */
+static void LinkChanged(struct netif *netif) {
+   networkEvents.Post(EVENT_LINK);
+}
+
+/**
+   Handles an event for the I2C client and the image catalog it builds, on
+   the core running them.
+ */
+static void HandleI2CEvent(unsigned int event) {
+   switch (event) {
+      case EVENT_I2C:
+         HandleI2CMessages();
+         break;
+      case EVENT_FETCH_CATALOG:
+         StartCatalogFetch();
+         break;
+      case EVENT_CHECK_CATALOG:
+         StartCatalogCheck();
+         break;
+      default:
+         break;
+   }
+}
+
+/**
+   Handles an event on the network core. Until the network is up only the
+   I2C server's messages are handled.
+ */
+static void HandleNetworkEvent(unsigned int event) {
+   bool up = programState == State::Normal;
+   switch (event) {
+      case EVENT_I2C:
+      case EVENT_FETCH_CATALOG:
+      case EVENT_CHECK_CATALOG:
+         HandleI2CEvent(event);
+         break;
+#if ZULUIDE_DUAL_CORE
+      case EVENT_SERVER_MESSAGE:
+         ProcessServerMessages();
+         break;
+#endif
+      case EVENT_WEB:
+         if (up) {
+            ServiceWebResponses();
+         }
+
+         break;
+      case EVENT_TICK:
+         if (up) {
+            RevalidateCatalog();
+            ServiceWebResponses();
+         }
+
+         [[fallthrough]];
+      case EVENT_FLASH:
+         // A save is written a page per event so other events are handled in between.
+         if (up && PersistToFlash()) {
+            networkEvents.Post(EVENT_FLASH);
+         }
+
+         break;
+      default:
+         break;
+   }
+
+   // Prints a few messages at a time. EVENT_LOG is taken after every other
+   // event, so the rest are printed once the core is idle.
+   if (zuluide::log::Drain(LOG_DRAIN_PER_EVENT)) {
+      networkEvents.Post(EVENT_LOG);
+   }
+}
+
+#if ZULUIDE_DUAL_CORE
+/**
+   Runs the I2C client on core 1: the I2C interrupt, decoding the server's
+   messages and building the image catalog, which core 0 reads under the
+   catalog's sequence lock. Messages that change the state of the network are
+   passed on to core 0, so this core never takes the lwIP lock.
+ */
+static void I2CCore() {
+   zuluide::i2c::client::Init(I2C_SLAVE_SDA_PIN, I2C_SLAVE_SCL_PIN, I2C_SLAVE_ADDRESS, I2C_BAUDRATE, I2C_MAX_BAUDRATE);
+   // Lets core 0 pause this core while it writes to flash.
+   flash_safe_execute_core_init();
+   multicore_fifo_push_blocking(1);
+
+   while (true) {
+      HandleI2CEvent(i2cEvents.Next());
+   }
+}
+#endif
+
 int main() {
-   printf("Starting.\n");
+   LOG_INFO("Starting.\n");
 
-   memset(currentStatus, 0, MAX_MSG_SIZE);
    memset(versionJson, '\0', MAX_MSG_SIZE);
    sprintf(versionJson,"{\"clientAPIVersion\":\"%s\", \"serverAPIVersion\": \"server failed to send version\"}", I2C_API_VERSION);
-   queue_init(&imageQueue, sizeof(char *), 1);
+   eTagSeed = get_rand_32();
 
    stdio_init_all();
-
-   zuluide::i2c::client::Init(I2C_SLAVE_SDA_PIN, I2C_SLAVE_SCL_PIN, I2C_SLAVE_ADDRESS, I2C_BAUDRATE);
+   bootUs = time_us_64();
+   RestoreFromFlash();
+
+#if ZULUIDE_DUAL_CORE
+   multicore_launch_core1_with_stack(I2CCore, core1Stack, sizeof(core1Stack));
+   // Requests can be queued once core 1 has started the I2C client.
+   multicore_fifo_pop_blocking();
+   LOG_INFO("I2C client running on core 1.\n");
+#else
+   zuluide::i2c::client::Init(I2C_SLAVE_SDA_PIN, I2C_SLAVE_SCL_PIN, I2C_SLAVE_ADDRESS, I2C_BAUDRATE, I2C_MAX_BAUDRATE);
+#endif
 
    if (!zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_FETCH_SSID)) {
-      printf("Failed to add request for SSID to output queue.");
+      LOG_ERROR("Failed to add request for SSID to output queue.\n");
    }
 
+   add_repeating_timer_ms(-MAIN_LOOP_TICK_MS, Tick, NULL, &tickTimer);
+
    bool httpInitialized = false;
 
    while (true) {
       switch (programState) {
          case State::WaitForAPIVersion:
             zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_API_VERSION, I2C_API_VERSION);
-            programState = State::WaitingForSSID;
+            // With credentials from flash the network is started straight away,
+            // the server's replies are handled once it is up.
+            programState = warmBoot ? State::WIFIInit : State::WaitingForSSID;
             break;
          case State::WaitingForSSID:
          case State::WaitingForPassword: {
             // Waiting to receive the SSID and password via I2C.
-            zuluide::i2c::client::ProcessMessages();
+            HandleNetworkEvent(networkEvents.Next());
             break;
          }
 
          case State::WIFIInit: {
             if (cyw43_arch_init()) {
-               printf("failed to initialize\n");
+               LOG_ERROR("failed to initialize\n");
+               zuluide::log::Drain(LOG_RING_RECORDS * 2);
                return 1;
             }
 
             cyw43_arch_enable_sta_mode();
+            cyw43_arch_lwip_begin();
+            netif_set_link_callback(&cyw43_state.netif[CYW43_ITF_STA], LinkChanged);
+            cyw43_arch_lwip_end();
             // Disable powersave mode.
             cyw43_wifi_pm(&cyw43_state, cyw43_pm_value(CYW43_NO_POWERSAVE_MODE, 20, 1, 1, 1));
 
@@ -388,18 +1307,23 @@ int main() {
          }
 
          case State::WIFIDown: {
-            printf("Connecting to WiFi.\n");
+            LOG_INFO("Connecting to WiFi.\n");
+            reconnectWiFi = false;
             if (cyw43_arch_wifi_connect_timeout_ms(wifiSSID.c_str(), wifiPass.c_str(), CYW43_AUTH_WPA2_AES_PSK, 30000)) {
-               printf("Failed to connect to WiFi.\n");
+               LOG_ERROR("Failed to connect to WiFi.\n");
+               // Saved credentials may be out of date, take any the server has sent.
+               for (int event = networkEvents.Take(); event >= 0; event = networkEvents.Take()) {
+                  HandleNetworkEvent(event);
+               }
             } else {
-               printf("Connected to WiFi.\n");
+               LOG_INFO("Connected to WiFi.\n");
 
                extern cyw43_t cyw43_state;
                auto ip_addr = cyw43_state.netif[CYW43_ITF_STA].ip_addr.addr;
                char *ipBuffer = new char[32];
                memset(ipBuffer, 0, 32);
                sprintf(ipBuffer, "%lu.%lu.%lu.%lu", ip_addr & 0xFF, (ip_addr >> 8) & 0xFF, (ip_addr >> 16) & 0xFF, ip_addr >> 24);
-               printf("IP Address: %s\n", ipBuffer);
+               LOG_INFO("IP Address: %s\n", ipBuffer);
 
                // Send the IP address to the I2C server.
                zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_IP_ADDRESS, ipBuffer);
@@ -407,27 +1331,41 @@ int main() {
                if (!httpInitialized) {
                   httpd_init();
                   http_set_cgi_handlers(cgi_handlers, sizeof(cgi_handlers)/sizeof(cgi_handlers[0]));
-                  printf("Http server initialized.\n");
+                  LOG_INFO("Http server initialized.\n");
+
+                  cyw43_arch_lwip_begin();
+                  if (webSockets.Start(WEBSOCKET_PORT, &statusStore, &imageCatalog, HandleSocketCommand)) {
+                     LOG_INFO("WebSocket server listening on port %d.\n", WEBSOCKET_PORT);
+                  } else {
+                     LOG_ERROR("Failed to start the WebSocket server.\n");
+                  }
+                  cyw43_arch_lwip_end();
                   httpInitialized = true;
                }
 
                cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
 
+               if (bootNetworkMs == 0) {
+                  bootNetworkMs = (time_us_64() - bootUs) / 1000;
+                  LOG_INFO("Network up %lu ms after %s boot.\n", (unsigned long)bootNetworkMs, warmBoot ? "warm" : "cold");
+               }
+
                programState = State::Normal;
-               printf("System Ready\n");
+               LOG_INFO("System Ready\n");
             }
 
             break;
          }
 
          case State::Normal: {
-            // Allow I2C functions to process messages and make callbacks as appropriate.
-            zuluide::i2c::client::ProcessMessages();
+            // Sleep until a message, web or link event, or the next tick.
+            unsigned int event = networkEvents.Next();
+            HandleNetworkEvent(event);
 
-            // Test for WIFI going down.
-            if (cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_UP) {
+            // Test for WIFI going down, or the server sending new credentials.
+            if ((event == EVENT_LINK && cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_UP) || reconnectWiFi) {
                programState = State::WIFIInit;
-               printf("WiFi connection down.\n");
+               LOG_INFO(reconnectWiFi ? "WiFi credentials changed.\n" : "WiFi connection down.\n");
 
                // Notify the I2C server that we have lost our network connection.
                zuluide::i2c::client::EnqueueRequest(I2C_CLIENT_NET_DOWN);
@@ -438,7 +1376,7 @@ int main() {
          }
 
          default: {
-            printf("Error, unkown state.\n");
+            LOG_ERROR("Error, unkown state.\n");
             break;
          }
       }
@@ -448,118 +1386,989 @@ int main() {
 }
 
 /**
-   Builds a JSON document using the individual image JSON items sotred in images.
-   After it is finished, it clears images and puts the result in imageJson
+   Adds the negotiated I2C link settings and the measured bus throughput to the
+   version document.
+ */
+int BuildVersionResponse() {
+   zuluide::i2c::client::LinkStats link;
+   zuluide::i2c::client::GetLinkStats(&link);
+
+   auto core0 = networkEvents.Stats();
+#if ZULUIDE_DUAL_CORE
+   auto core1 = i2cCoreEvents.Stats();
+#else
+   zuluide::EventSchedulerStats core1 = {};
+#endif
+
+   // Drop the closing brace so the link fields can be appended.
+   int length = strlen(versionJson) - 1;
+   memcpy(versionResponse, versionJson, length);
+   length += snprintf(versionResponse + length, sizeof(versionResponse) - length,
+                      ", \"i2cBaudrate\":%u, \"i2cChunk\":%u, \"i2cThroughput\":%u, \"i2cFramingErrors\":%u, \"i2cFallbacks\":%u, \"catalogDiffs\":%s, \"catalogSyncs\":%lu, \"warmBoot\":%s, \"bootNetworkMs\":%lu, \"bootImagesMs\":%lu, \"dualCore\":%s, \"core0Load\":%lu, \"core1Load\":%lu, "
+                      "\"wakeupsPerSecond\":%lu, \"eventLatencyUs\":%lu, \"eventLatencyMaxUs\":%lu}",
+                      link.baudrate, link.txChunk, link.throughput, link.framingErrors, link.fallbacks,
+                      link.catalogDiffs ? "true" : "false", (unsigned long)catalogSync.Stats().syncs,
+                      warmBoot ? "true" : "false", (unsigned long)bootNetworkMs, (unsigned long)bootImagesMs,
+                      ZULUIDE_DUAL_CORE ? "true" : "false", (unsigned long)core0.loadPercent, (unsigned long)core1.loadPercent,
+                      (unsigned long)(core0.wakeupsPerSecond + core1.wakeupsPerSecond), (unsigned long)std::max(core0.latencyUs, core1.latencyUs),
+                      (unsigned long)std::max(core0.maxLatencyUs, core1.maxLatencyUs));
+   return length;
+}
+
+/**
+   Opens a response whose body is streamed in place from source by
+   fs_read_async_custom. If owned is set, it is released when the response
+   closes.
+ */
+int open_stream(struct fs_file *file, const char *source, int length, char *owned = NULL) {
+   memset(file, 0, sizeof(struct fs_file));
+   for (auto &stream : responseStreams) {
+      if (!stream.inUse) {
+         stream.inUse = true;
+         stream.source = source;
+         stream.owned = owned;
+         stream.catalog = false;
+         stream.page = false;
+         stream.headerLength = 0;
+         stream.events = false;
+         stream.poll.Release();
+         stream.resume = NULL;
+#if ZULUIDE_TRACE
+         stream.trace = NULL;
+#endif
+
+         file->pextension = &stream;
+         file->len = length;
+         file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+         return 1;
+      }
+   }
+
+   LOG_WARN("No response stream available.\n");
+   delete[] owned;
+   return 0;
+}
+
+/**
+   Opens a response holding a copy of a buffer that may change while it is
+   being sent.
+ */
+int open_snapshot(struct fs_file *file, const char *source, int length) {
+   char *snapshot = new char[length + 1];
+   memcpy(snapshot, source, length);
+   snapshot[length] = 0;
+   return open_stream(file, snapshot, length, snapshot);
+}
+
+/**
+   Sends the HTTP headers of a streamed JSON response from the stream, adding
+   an entity tag and any extra header lines. If the client already has this
+   version (notModified) the body is dropped and a 304 is sent instead.
+ */
+void tag_response(struct fs_file *file, const char *etag, bool notModified, const char *extra = "") {
+   auto stream = (ResponseStream *)file->pextension;
+   if (notModified) {
+      file->len = 0;
+      stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                      "HTTP/1.0 304 Not Modified\r\nETag: %s\r\nCache-Control: no-cache\r\n\r\n", etag);
+   } else {
+      stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                      "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\nETag: %s\r\nCache-Control: no-cache\r\n%s\r\n",
+                                      file->len, etag, extra);
+   }
+
+   file->len += stream->headerLength;
+   file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+}
+
+/**
+   Opens a response streaming the image catalog, tagged with the catalog
+   generation. An incomplete catalog is sent as an empty array.
  */
-void RebuildImageJson() {
-   size_t totalSize = 2;
-   for (auto item : images) {
-      totalSize += strlen(item) + 1;
+int open_catalog(struct fs_file *file) {
+   bool complete;
+   size_t length;
+   uint32_t generation;
+   uint32_t begun;
+   do {
+      begun = imageCatalog.ReadBegin();
+      complete = imageCatalog.IsComplete();
+      imageCatalog.Json(&length);
+      generation = imageCatalog.Generation();
+   } while (!imageCatalog.ReadValid(begun));
+
+   if (!complete) {
+      return open_stream(file, "[]", 2);
+   }
+
+   if (!open_stream(file, NULL, length)) {
+      return 0;
    }
 
-   if (imageJson != NULL) {
-      delete[] imageJson;
+   auto stream = (ResponseStream *)file->pextension;
+   stream->catalog = true;
+   stream->generation = generation;
+   NoteImagesServed();
+
+   char etag[24];
+   snprintf(etag, sizeof(etag), "\"%08lx-c%lu\"", (unsigned long)eTagSeed, (unsigned long)stream->generation);
+   tag_response(file, etag, zuluide::web::RequestMatchesETag(etag));
+   return 1;
+}
+
+/**
+   Opens a response streaming the page of the image catalog asked for, which
+   may be read while later images are still arriving. The page is wrapped in
+   an object giving the catalog generation and the number of images so far.
+ */
+int open_catalog_page(struct fs_file *file) {
+   size_t total;
+   size_t first;
+   size_t count;
+   size_t length;
+   bool complete;
+   uint32_t generation;
+   uint32_t begun;
+   do {
+      begun = imageCatalog.ReadBegin();
+      total = imageCatalog.Count();
+      first = std::min(imagesOffset, total);
+      count = std::min(imagesLimit, total - first);
+      imageCatalog.Range(first, count, &length);
+      complete = imageCatalog.IsComplete();
+      generation = imageCatalog.Generation();
+   } while (!imageCatalog.ReadValid(begun));
+
+   if (!open_stream(file, NULL, length + 2)) {
+      return 0;
    }
 
-   imageJson = new char[totalSize + 3];
-   imageJson[0] = '[';
-   int pos = 1;
-   for (auto item : images) {
-      if (pos > 1) {
-         strcat(imageJson, ",");
-         pos++;
+   auto stream = (ResponseStream *)file->pextension;
+   stream->catalog = true;
+   stream->generation = generation;
+   stream->page = true;
+   stream->pageFirst = first;
+   stream->pageCount = count;
+   stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                   "{\"generation\":%lu, \"total\":%u, \"complete\":%s, \"offset\":%u, \"images\":[",
+                                   (unsigned long)stream->generation, (unsigned int)total,
+                                   complete ? "true" : "false", (unsigned int)first);
+   file->len += stream->headerLength;
+   NoteImagesServed();
+   return 1;
+}
+
+/**
+   Opens a response with a page of the images matching the search asked for,
+   in the same form as a page of the whole catalog. The matching records are
+   scattered through the catalog, so the page is copied into the response.
+ */
+int open_catalog_search(struct fs_file *file) {
+   char *page = NULL;
+   size_t length;
+   uint32_t begun;
+   do {
+      delete[] page;
+      begun = imageCatalog.ReadBegin();
+      size_t total = imageCatalog.Search(imagesQuery, imagesSort, imagesOffset, imagesMatches, imagesLimit);
+      size_t count = total > imagesOffset ? std::min(total - imagesOffset, imagesLimit) : 0;
+
+      char prefix[RESPONSE_HEADER_MAX];
+      int prefixLength = snprintf(prefix, sizeof(prefix), "{\"generation\":%lu, \"total\":%u, \"complete\":%s, \"offset\":%u, \"images\":[",
+                                  (unsigned long)imageCatalog.Generation(), (unsigned int)total,
+                                  imageCatalog.IsComplete() ? "true" : "false", (unsigned int)imagesOffset);
+      length = prefixLength + 2;
+      for (size_t i = 0; i < count; i++) {
+         size_t entryLength;
+         imageCatalog.Entry(imagesMatches[i], &entryLength);
+         length += entryLength + (i > 0 ? 1 : 0);
       }
 
-      strcat(imageJson, item);
-      pos += strlen(item);
+      page = new char[length + 1];
+      char *end = page;
+      char *limit = page + length - 2;
+      memcpy(end, prefix, prefixLength);
+      end += prefixLength;
+      for (size_t i = 0; i < count; i++) {
+         size_t entryLength;
+         const char *entry = imageCatalog.Entry(imagesMatches[i], &entryLength);
+         if ((size_t)(limit - end) < entryLength + (i > 0 ? 1 : 0)) {
+            // The records changed since they were measured, read again.
+            break;
+         }
+
+         if (i > 0) {
+            *end++ = ',';
+         }
+
+         memcpy(end, entry, entryLength);
+         end += entryLength;
+      }
+
+      memcpy(end, "]}", 3);
+   } while (!imageCatalog.ReadValid(begun));
+
+   return open_stream(file, page, length, page);
+}
+
+/**
+   Gives an open status response a snapshot of the latest status, tagged with
+   its sequence number. Conditional requests are only checked while the
+   request is being opened, as the request headers are not kept after that.
+ */
+void snapshot_status(struct fs_file *file, bool opening) {
+   size_t length = statusStore.Length();
+   uint32_t sequence;
+   char *snapshot;
+   while (true) {
+      snapshot = new char[length + 1];
+      size_t read = statusStore.Read(snapshot, length + 1, &sequence);
+      if (read <= length) {
+         length = read;
+         break;
+      }
+
+      // A longer status arrived in the meantime.
+      delete[] snapshot;
+      length = read;
    }
 
-   imageJson[pos] = ']';
-   imageJson[pos + 1] = 0;
+   auto stream = (ResponseStream *)file->pextension;
+   stream->source = snapshot;
+   stream->owned = snapshot;
+   file->len = length;
 
-   // Delete the images prior to clearing them.
-   for (auto item : images) {
-      delete[] item;
+   char etag[24];
+   char sequenceHeader[40];
+   snprintf(etag, sizeof(etag), "\"%08lx-s%lu\"", (unsigned long)eTagSeed, (unsigned long)sequence);
+   snprintf(sequenceHeader, sizeof(sequenceHeader), "X-Status-Sequence: %lu\r\n", (unsigned long)sequence);
+   tag_response(file, etag, opening && zuluide::web::RequestMatchesETag(etag), sequenceHeader);
+}
+
+/**
+   Opens a status response. When the request is /status?since=N and N is the
+   latest sequence number, the response is held until a newer status arrives
+   or STATUS_LONG_POLL_US passes.
+ */
+int open_status(struct fs_file *file) {
+   long since = statusSince;
+   statusSince = -1;
+   if (!open_stream(file, NULL, 0)) {
+      return 0;
+   }
+
+   if (since >= 0 && (uint32_t)since == statusStore.Sequence()) {
+      auto stream = (ResponseStream *)file->pextension;
+      stream->poll.Hold(since, time_us_64() + STATUS_LONG_POLL_US);
+      statusWaiters++;
+
+      // Nothing to send until release_status takes the snapshot.
+      file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+      return 1;
    }
 
-   images.clear();
+   snapshot_status(file, true);
+   return 1;
 }
 
-int get_file_contents(struct fs_file *file, const char *fileContents, int fileLen) {
+/**
+   Returns true if a status response can be sent. A held response is
+   released once it is due, taking the snapshot that sets its length before
+   httpd looks at how much is left to send.
+ */
+bool release_status(struct fs_file *file) {
+   auto stream = (ResponseStream *)file->pextension;
+   switch (stream->poll.Poll(statusStore.Sequence(), time_us_64())) {
+      case zuluide::web::LongPoll::Readiness::Waiting:
+         return false;
+      case zuluide::web::LongPoll::Readiness::Released:
+         statusWaiters--;
+         snapshot_status(file, false);
+         return true;
+      default:
+         return true;
+   }
+}
+
+/**
+   Publishes status and catalog changes to the /events subscribers, or a
+   heartbeat if there has been nothing to send for a while.
+ */
+void PublishEvents() {
+   uint64_t now = time_us_64();
+   uint32_t sequence = statusStore.Sequence();
+   if (sequence != 0 && (sequence != statusEventSequence || statusEventStale)) {
+      size_t length = statusStore.Read(eventScratch, sizeof(eventScratch), &sequence);
+      statusEvent = events.Publish("status", sequence, eventScratch, length);
+      statusEventSequence = sequence;
+      statusEventStale = false;
+      lastEventTime = now;
+   }
+
+   uint32_t generation;
+   bool complete;
+   size_t images;
+   uint32_t begun;
+   do {
+      begun = imageCatalog.ReadBegin();
+      generation = imageCatalog.Generation();
+      complete = imageCatalog.IsComplete();
+      images = imageCatalog.Count();
+   } while (!imageCatalog.ReadValid(begun));
+
+   if (complete && generation != catalogEventGeneration) {
+      int length = snprintf(eventScratch, sizeof(eventScratch), "{\"generation\":%lu, \"images\":%u}",
+                            (unsigned long)generation, (unsigned int)images);
+      events.Publish("catalog", generation, eventScratch, length);
+      catalogEventGeneration = generation;
+      lastEventTime = now;
+   }
+
+   if (now - lastEventTime >= EVENTS_HEARTBEAT_US) {
+      events.PublishHeartbeat();
+      lastEventTime = now;
+   }
+}
+
+/**
+   Publishes events and resumes the responses that are waiting: status
+   responses once a newer status has arrived or they have waited long enough,
+   and /events subscribers once there is more to send. Also pushes updates to
+   the WebSocket clients. Called from the main loop.
+ */
+void ServiceWebResponses() {
+   if (statusWaiters == 0 && eventSubscribers == 0 && webSockets.Clients() == 0) {
+      return;
+   }
+
+   cyw43_arch_lwip_begin();
+   if (eventSubscribers > 0) {
+      PublishEvents();
+   }
+
+   webSockets.Service();
+
+   uint64_t now = time_us_64();
+   for (auto &stream : responseStreams) {
+      if (!stream.inUse || !stream.resume) {
+         continue;
+      }
+
+      if (stream.poll.ShouldResume(statusStore.Sequence(), now) ||
+          (stream.events && stream.cursor != events.Head())) {
+         auto resume = stream.resume;
+         stream.resume = NULL;
+         resume(stream.resumeArg);
+      }
+   }
+
+   cyw43_arch_lwip_end();
+}
+
+/**
+   Opens a response that is constant data in flash, which lwIP sends without
+   copying.
+ */
+int open_constant(struct fs_file *file, const char *data, int length, u8_t flags = FS_FILE_FLAGS_HEADER_PERSISTENT) {
    memset(file, 0, sizeof(struct fs_file));
-   file->pextension = mem_malloc(fileLen + 1);
+   file->data = data;
+   file->len = length;
+   file->index = length;
+   file->flags = flags;
+   return 1;
+}
 
-   if (file->pextension) {
-      memcpy(file->pextension, fileContents, fileLen + 1);
+#define CONSTANT_JSON(text) [](struct fs_file *file) { return open_constant(file, text, sizeof(text) - 1); }
 
-      file->data = (const char *)file->pextension;
-      file->len = fileLen;
-      file->index = file->len;
-      file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+/**
+   Opens an /events subscription. A subscriber first gets the latest status,
+   then every event published after it.
+ */
+int open_events(struct fs_file *file) {
+   if (eventSubscribers >= EVENTS_MAX_SUBSCRIBERS) {
+      LOG_WARN("Refusing event subscriber, %d already connected.\n", eventSubscribers);
+      return open_constant(file, eventsBusy, sizeof(eventsBusy) - 1, FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT);
+   }
 
-      return 1;
+   if (!open_stream(file, NULL, 0)) {
+      return 0;
+   }
+
+   auto stream = (ResponseStream *)file->pextension;
+   stream->events = true;
+   if (statusEventSequence == statusStore.Sequence() && events.Holds(statusEvent)) {
+      stream->cursor = statusEvent;
    } else {
+      stream->cursor = events.Head();
+      statusEventStale = true;
+   }
+
+   eventSubscribers++;
+   stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n");
+
+   // The stream ends when the client disconnects or falls behind.
+   file->len = INT_MAX;
+   file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+   return 1;
+}
+
+/**
+   Returns the cursor with the given token, or starts a new iteration if
+   there is none, taking the place of an idle or the least recently used
+   cursor.
+ */
+ImageCursor *find_image_cursor(uint32_t token) {
+   uint64_t now = time_us_64();
+   ImageCursor *oldest = &imageCursors[0];
+   for (auto &cursor : imageCursors) {
+      if (cursor.token != 0 && now - cursor.lastUsed > IMAGE_CURSOR_IDLE_US) {
+         // Expired.
+         cursor.token = 0;
+      }
+
+      if (token != 0 && cursor.token == token) {
+         cursor.lastUsed = now;
+         return &cursor;
+      }
+
+      if (oldest->token != 0 && (cursor.token == 0 || cursor.lastUsed < oldest->lastUsed)) {
+         oldest = &cursor;
+      }
+   }
+
+   if (oldest->token != 0) {
+      LOG_WARN("Forgetting an image iteration to start another.\n");
+   }
+
+   do {
+      oldest->token = get_rand_32();
+   } while (oldest->token == 0);
+
+   oldest->generation = imageCatalog.Generation();
+   oldest->position = 0;
+   oldest->lastUsed = now;
+   return oldest;
+}
+
+/**
+   Opens the response to /nextImage for the client's cursor: the next image
+   (or array of images) once it has arrived from the I2C server, otherwise a
+   wait or done message. The response sets the cursor cookie so browsers
+   keep their own place.
+ */
+int open_next_image(struct fs_file *file) {
+   ImageCursor *cursor = find_image_cursor(nextImageToken);
+   uint32_t generation;
+   size_t position;
+   size_t count;
+   size_t length;
+   bool complete;
+   char *owned = NULL;
+   uint32_t begun;
+   do {
+      delete[] owned;
+      owned = NULL;
+      begun = imageCatalog.ReadBegin();
+      generation = imageCatalog.Generation();
+      // If the images were fetched again, start over.
+      position = cursor->generation == generation ? cursor->position : 0;
+      size_t total = imageCatalog.Count();
+      size_t available = total > position ? total - position : 0;
+      count = std::min(available, nextImageCount > 0 ? nextImageCount : 1);
+      complete = imageCatalog.IsComplete();
+      if (count > 0) {
+         const char *images = imageCatalog.Range(position, count, &length);
+         if (nextImageCount > 0) {
+            owned = new char[length + 2];
+            owned[0] = '[';
+            memcpy(owned + 1, images, length);
+            owned[length + 1] = ']';
+            length += 2;
+         } else {
+            owned = new char[length];
+            memcpy(owned, images, length);
+         }
+      }
+   } while (!imageCatalog.ReadValid(begun));
+
+   cursor->generation = generation;
+   cursor->position = position;
+   const char *body;
+   uint32_t token = cursor->token;
+   if (count > 0) {
+      body = owned;
+   } else if (complete) {
+      static const char done[] = "{\"status\": \"done\"}";
+      body = done;
+      length = sizeof(done) - 1;
+   } else {
+      static const char wait[] = "{\"status\": \"wait\"}";
+      body = wait;
+      length = sizeof(wait) - 1;
+   }
+
+   // The cursor only moves once the response is open, so a request that
+   // could not be answered is answered in full by the next one. open_stream
+   // releases owned if it fails.
+   if (!open_stream(file, body, length, owned)) {
       return 0;
    }
+
+   if (count > 0) {
+      cursor->position += count;
+   } else if (complete) {
+      // Finished, the next request starts a new iteration.
+      cursor->token = 0;
+   }
+
+   auto stream = (ResponseStream *)file->pextension;
+   stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\nCache-Control: no-store\r\n"
+                                   "Set-Cookie: imageCursor=%08lx; Path=/\r\nX-Image-Cursor: %08lx\r\n\r\n",
+                                   file->len, (unsigned long)token, (unsigned long)token);
+   file->len += stream->headerLength;
+   file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+   return 1;
+}
+
+typedef struct {
+   const char *path;
+   int (*open)(struct fs_file *file);
+} Route;
+
+int open_metrics(struct fs_file *file);
+int open_trace(struct fs_file *file);
+
+/**
+   Responses built at run time, sorted by path. The web page resources are
+   looked up in the asset table generated at build time.
+ */
+static const Route routes[] = {
+    {"/done.json", CONSTANT_JSON("{\"status\": \"done\"}")},
+    {"/events.stream", open_events},
+    {"/images.json", open_catalog},
+    {"/imagesPage.json", open_catalog_page},
+    {"/imagesSearch.json", open_catalog_search},
+    {"/metrics", open_metrics},
+    {"/nextImage.json", open_next_image},
+    {"/ok.json", CONSTANT_JSON("{\"status\": \"ok\"}")},
+    {"/status.json", open_status},
+#if ZULUIDE_TRACE
+    {"/trace", open_trace},
+#endif
+    {"/version.json", [](struct fs_file *file) { return open_snapshot(file, versionResponse, BuildVersionResponse()); }},
+    {"/wait.json", CONSTANT_JSON("{\"status\": \"wait\"}")},
+};
+
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+// The web page resources are counted together after the routes.
+#define ROUTE_ASSETS ROUTE_COUNT
+
+// Requests per route and their time from being opened until closed. Only
+// updated from lwIP callbacks.
+static uint32_t routeRequests[ROUTE_COUNT + 1];
+static zuluide::LatencyHistogram routeLatencies[ROUTE_COUNT + 1];
+
+typedef struct {
+   const struct fs_file *file;
+   uint8_t route;
+   uint32_t openedUs;
+} OpenRequest;
+
+static OpenRequest openRequests[MEMP_NUM_TCP_PCB];
+
+/**
+   Counts a request for route if it was opened, and starts timing it.
+   Returns opened.
+ */
+static int CountRequest(struct fs_file *file, size_t route, int opened) {
+   if (opened) {
+      TRACE_INSTANT(HTTP_OPENED, route);
+      routeRequests[route]++;
+      for (auto &request : openRequests) {
+         if (request.file == NULL) {
+            request = {file, (uint8_t)route, time_us_32()};
+            break;
+         }
+      }
+   }
+
+   return opened;
+}
+
+/**
+   Records how long a request took, once its file is closed.
+ */
+static void FinishRequest(const struct fs_file *file) {
+   for (auto &request : openRequests) {
+      if (request.file == file) {
+         TRACE_INSTANT(HTTP_CLOSED, request.route);
+         routeLatencies[request.route].Observe(time_us_32() - request.openedUs);
+         request.file = NULL;
+         return;
+      }
+   }
 }
 
 int fs_open_custom(struct fs_file *file, const char *name) {
-   if (strncmp(name, "/status.json", sizeof("/status.json")) == 0) {
-      return get_file_contents(file, currentStatus, strlen(currentStatus));
-   } else if (strncmp(name, "/images.json", sizeof("/images.json")) == 0) {
-      return get_file_contents(file, imageJson, strlen(imageJson));
-   } else if (strncmp(name, "/ok.json", sizeof("/ok.json")) == 0) {
-      auto okMessage = "{\"status\": \"ok\"}";
-      return get_file_contents(file, okMessage, strlen(okMessage));
-   } else if (strncmp(name, "/wait.json", sizeof("/wait.json")) == 0) {
-      auto waitMessage = "{\"status\": \"wait\"}";
-      return get_file_contents(file, waitMessage, strlen(waitMessage));
-   } else if (strncmp(name, "/done.json", sizeof("/done.json")) == 0) {
-      auto doneMessage = "{\"status\": \"done\"}";
-      return get_file_contents(file, doneMessage, strlen(doneMessage));
-   } else if (strncmp(name, "/index.html", sizeof("/index.html")) == 0) {
-      return get_file_contents(file, index_html, strlen(index_html));
-   } else if (strncmp(name, "/control.js", sizeof("/control.js")) == 0) {
-      return get_file_contents(file, control_js, strlen(control_js));
-   } else if (strncmp(name, "/control2.js", sizeof("/control2.js")) == 0) {
-      return get_file_contents(file, control_2_js, strlen(control_2_js));
-   } else if (strncmp(name, "/style.css", sizeof("/style.css")) == 0) {
-      return get_file_contents(file, style_css, strlen(style_css));
-   } else if (strncmp(name, "/style2.css", sizeof("/style2.css")) == 0) {
-      return get_file_contents(file, style_2_css, strlen(style_2_css));
-   } else if (strncmp(name, "/style3.css", sizeof("/style3.css")) == 0) {
-      return get_file_contents(file, style_3_css, strlen(style_3_css));
-   } else if (strncmp(name, "/style4.css", sizeof("/style4.css")) == 0) {
-      return get_file_contents(file, style_4_css, strlen(style_4_css));
-   } else if (strncmp(name, "/style_rhc.css", sizeof("/style_rhc.css")) == 0) {
-      return get_file_contents(file, style_rhc_css, strlen(style_rhc_css));
-   } else if (strncmp(name, "/nextImage.json", sizeof("/nextImage.json")) == 0) {
-      char *image;
-      if (queue_try_remove(&imageQueue, &image)) {
-         int retVal = get_file_contents(file, image, strlen(image));
-         delete[] image;
-         return retVal;
+   TRACE_SCOPE(FS_OPEN, 0);
+   zuluide::web::SelectRequest(name);
+   auto asset = zuluide::web::FindAsset(name);
+   if (asset) {
+      const u8_t flags = FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT;
+      auto variant = zuluide::web::RequestAcceptsGzip() ? &asset->gzip : &asset->plain;
+      if (zuluide::web::RequestMatchesETag(variant->etag)) {
+         return CountRequest(file, ROUTE_ASSETS, open_constant(file, variant->notModified, variant->notModifiedLength, flags));
+      }
+
+      return CountRequest(file, ROUTE_ASSETS, open_constant(file, variant->response, variant->length, flags));
+   }
+
+   auto end = routes + ROUTE_COUNT;
+   auto route = std::lower_bound(routes, end, name, [](const Route &route, const char *path) {
+      return strcmp(route.path, path) < 0;
+   });
+   if (route != end && strcmp(route->path, name) == 0) {
+      return CountRequest(file, route - routes, route->open(file));
+   }
+
+   LOG_WARN("Unable to find %s\n", name);
+   return 0;
+}
+
+// Space for the /metrics text.
+#define METRICS_RESPONSE_MAX 16384
+
+/**
+   Writes the I2C traffic, queue, drop, lwIP memory and HTTP metrics. Runs in
+   lwIP's context, which is also the only writer of the HTTP ones.
+ */
+static void WriteMetrics(zuluide::MetricsWriter *metrics) {
+   // Too large for the interrupt stack.
+   static zuluide::i2c::client::CommandStats commands;
+   zuluide::i2c::client::GetCommandStats(&commands);
+   zuluide::i2c::client::LinkStats link;
+   zuluide::i2c::client::GetLinkStats(&link);
+   zuluide::i2c::client::QueueStats queue;
+   zuluide::i2c::client::GetQueueStats(&queue);
+   zuluide::i2c::client::RingStats ring;
+   zuluide::i2c::client::GetReceiveStats(&ring);
+   zuluide::i2c::client::PoolStats pools[OUTPUT_POOL_CLASSES];
+   zuluide::i2c::client::GetOutputPoolStats(pools);
+
+   char labels[64];
+   const zuluide::i2c::client::CommandCounters *directions[2] = {commands.received, commands.sent};
+   const char *directionNames[2] = {"in", "out"};
+   metrics->Family("zuluide_i2c_messages_total", "counter", "Messages moved over the I2C link per command ID.");
+   for (int direction = 0; direction < 2; direction++) {
+      for (int id = 0; id < I2C_COMMAND_IDS; id++) {
+         if (directions[direction][id].messages > 0) {
+            snprintf(labels, sizeof(labels), "direction=\"%s\",command=\"0x%02x\"", directionNames[direction], id);
+            metrics->Sample("zuluide_i2c_messages_total", labels, directions[direction][id].messages);
+         }
+      }
+   }
+
+   metrics->Family("zuluide_i2c_message_bytes_total", "counter", "Message bytes, including the command and length, per command ID.");
+   for (int direction = 0; direction < 2; direction++) {
+      for (int id = 0; id < I2C_COMMAND_IDS; id++) {
+         if (directions[direction][id].messages > 0) {
+            snprintf(labels, sizeof(labels), "direction=\"%s\",command=\"0x%02x\"", directionNames[direction], id);
+            metrics->Sample("zuluide_i2c_message_bytes_total", labels, directions[direction][id].bytes);
+         }
+      }
+   }
+
+   metrics->Family("zuluide_i2c_bytes_total", "counter", "Bytes moved over the I2C bus.");
+   metrics->Sample("zuluide_i2c_bytes_total", "direction=\"in\"", link.rxBytes);
+   metrics->Sample("zuluide_i2c_bytes_total", "direction=\"out\"", link.txBytes);
+   metrics->Family("zuluide_i2c_framing_errors_total", "counter", "Invalid lengths, truncated frames and aborted chunks.");
+   metrics->Sample("zuluide_i2c_framing_errors_total", NULL, link.framingErrors);
+   metrics->Family("zuluide_i2c_baudrate", "gauge", "Current I2C bus speed.");
+   metrics->Sample("zuluide_i2c_baudrate", NULL, link.baudrate);
+
+   // The output queue holds packets, the receive ring holds messages.
+   metrics->Family("zuluide_queue_depth", "gauge", "Entries waiting in a queue.");
+   metrics->Sample("zuluide_queue_depth", "queue=\"output\"", queue.level);
+   metrics->Sample("zuluide_queue_depth", "queue=\"receive\"", ring.pending);
+   metrics->Family("zuluide_queue_high_water", "gauge", "Most entries ever waiting in a queue.");
+   metrics->Sample("zuluide_queue_high_water", "queue=\"output\"", queue.maxLevel);
+   metrics->Sample("zuluide_queue_high_water", "queue=\"receive\"", ring.maxPending);
+   metrics->Family("zuluide_queue_capacity", "gauge", "Entries a queue holds.");
+   metrics->Sample("zuluide_queue_capacity", "queue=\"output\"", queue.capacity);
+   metrics->Family("zuluide_receive_ring_bytes", "gauge", "Bytes of the receive ring in use.");
+   metrics->Sample("zuluide_receive_ring_bytes", NULL, ring.used);
+   metrics->Family("zuluide_receive_ring_high_water_bytes", "gauge", "Most bytes of the receive ring ever in use.");
+   metrics->Sample("zuluide_receive_ring_high_water_bytes", NULL, ring.highWater);
+   metrics->Family("zuluide_receive_ring_size_bytes", "gauge", "Size of the receive ring.");
+   metrics->Sample("zuluide_receive_ring_size_bytes", NULL, ring.size);
+   metrics->Family("zuluide_receive_ring_holds_total", "counter", "Times the server was refused until the receive ring had room.");
+   metrics->Sample("zuluide_receive_ring_holds_total", NULL, ring.holds);
+
+   const char *poolFamilies[4][3] = {
+       {"zuluide_packet_pool_in_use", "gauge", "Outbound packets of a size class in use."},
+       {"zuluide_packet_pool_high_water", "gauge", "Most outbound packets of a size class ever in use."},
+       {"zuluide_packet_pool_capacity", "gauge", "Outbound packets of a size class."},
+       {"zuluide_packet_pool_exhausted_total", "counter", "Times a size class had no free packet."},
+   };
+   for (int family = 0; family < 4; family++) {
+      metrics->Family(poolFamilies[family][0], poolFamilies[family][1], poolFamilies[family][2]);
+      for (int i = 0; i < OUTPUT_POOL_CLASSES; i++) {
+         uint values[4] = {pools[i].inUse, pools[i].highWater, pools[i].capacity, pools[i].exhausted};
+         snprintf(labels, sizeof(labels), "payload=\"%u\"", pools[i].payloadSize);
+         metrics->Sample(poolFamilies[family][0], labels, values[family]);
+      }
+   }
+
+   metrics->Family("zuluide_drops_total", "counter", "Messages, requests, subscribers and log messages dropped.");
+   metrics->Sample("zuluide_drops_total", "reason=\"receive_ring_full\"", ring.dropped);
+   metrics->Sample("zuluide_drops_total", "reason=\"output_queue_full\"", commands.enqueueFailures);
+   metrics->Sample("zuluide_drops_total", "reason=\"event_subscriber_behind\"", eventsDropped);
+   metrics->Sample("zuluide_drops_total", "reason=\"log_ring_full\"", zuluide::log::Dropped());
+#if ZULUIDE_DUAL_CORE
+   metrics->Sample("zuluide_drops_total", "reason=\"network_inbox_full\"", networkInbox.Stats().dropped);
+#endif
+
+#if MEM_STATS
+   metrics->Family("zuluide_lwip_heap_used_bytes", "gauge", "Bytes of the lwIP heap in use.");
+   metrics->Sample("zuluide_lwip_heap_used_bytes", NULL, lwip_stats.mem.used);
+   metrics->Family("zuluide_lwip_heap_high_water_bytes", "gauge", "Most bytes of the lwIP heap ever in use.");
+   metrics->Sample("zuluide_lwip_heap_high_water_bytes", NULL, lwip_stats.mem.max);
+   metrics->Family("zuluide_lwip_heap_size_bytes", "gauge", "Size of the lwIP heap.");
+   metrics->Sample("zuluide_lwip_heap_size_bytes", NULL, lwip_stats.mem.avail);
+   metrics->Family("zuluide_lwip_heap_errors_total", "counter", "Failed lwIP heap allocations.");
+   metrics->Sample("zuluide_lwip_heap_errors_total", NULL, lwip_stats.mem.err);
+#endif
+
+#if MEMP_STATS
+   const struct {
+      const char *name;
+      memp_t pool;
+   } lwipPools[] = {{"pbuf_pool", MEMP_PBUF_POOL}, {"pbuf", MEMP_PBUF}, {"tcp_pcb", MEMP_TCP_PCB}, {"tcp_seg", MEMP_TCP_SEG}};
+   const char *lwipPoolFamilies[4][3] = {
+       {"zuluide_lwip_pool_used", "gauge", "Entries of an lwIP pool in use."},
+       {"zuluide_lwip_pool_high_water", "gauge", "Most entries of an lwIP pool ever in use."},
+       {"zuluide_lwip_pool_size", "gauge", "Entries in an lwIP pool."},
+       {"zuluide_lwip_pool_errors_total", "counter", "Failed allocations from an lwIP pool."},
+   };
+   for (int family = 0; family < 4; family++) {
+      metrics->Family(lwipPoolFamilies[family][0], lwipPoolFamilies[family][1], lwipPoolFamilies[family][2]);
+      for (auto &pool : lwipPools) {
+         const struct stats_mem *stats = lwip_stats.memp[pool.pool];
+         uint64_t values[4] = {stats->used, stats->max, stats->avail, stats->err};
+         snprintf(labels, sizeof(labels), "pool=\"%s\"", pool.name);
+         metrics->Sample(lwipPoolFamilies[family][0], labels, values[family]);
+      }
+   }
+#endif
+
+   metrics->Family("zuluide_http_requests_total", "counter", "HTTP requests per route.");
+   for (size_t i = 0; i <= ROUTE_COUNT; i++) {
+      if (routeRequests[i] > 0) {
+         snprintf(labels, sizeof(labels), "route=\"%s\"", i == ROUTE_ASSETS ? "assets" : routes[i].path);
+         metrics->Sample("zuluide_http_requests_total", labels, routeRequests[i]);
+      }
+   }
+
+   metrics->Family("zuluide_http_request_duration_seconds", "histogram", "Time from opening an HTTP response until it is closed.");
+   for (size_t i = 0; i <= ROUTE_COUNT; i++) {
+      if (routeLatencies[i].Count() > 0) {
+         snprintf(labels, sizeof(labels), "route=\"%s\"", i == ROUTE_ASSETS ? "assets" : routes[i].path);
+         metrics->Histogram("zuluide_http_request_duration_seconds", labels, routeLatencies[i]);
       }
+   }
+}
+
+/**
+   Opens a response with the metrics in the Prometheus text format.
+ */
+int open_metrics(struct fs_file *file) {
+   char *text = new char[METRICS_RESPONSE_MAX];
+   zuluide::MetricsWriter metrics(text, METRICS_RESPONSE_MAX);
+   WriteMetrics(&metrics);
+   if (metrics.Truncated()) {
+      LOG_WARN("Metrics truncated to %zu bytes.\n", metrics.Length());
+   }
 
+   if (!open_stream(file, text, metrics.Length(), text)) {
       return 0;
-      
-   } else if (strncmp(name, "/version.js", sizeof("/version.js")) == 0) {
-      return get_file_contents(file, version_js, strlen(version_js));
-   } else if (strncmp(name, "/version.json", sizeof("/version.json")) == 0) {
-      return get_file_contents(file, versionJson, strlen(versionJson));
-   } else {
-      printf("Unable to find %s\n", name);
+   }
+
+   auto stream = (ResponseStream *)file->pextension;
+   stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nCache-Control: no-store\r\n\r\n",
+                                   file->len);
+   file->len += stream->headerLength;
+   file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+   return 1;
+}
+
+#if ZULUIDE_TRACE
+/**
+   Opens a response streaming the trace rings as Chrome trace JSON. Tracing
+   is paused until it closes.
+ */
+int open_trace(struct fs_file *file) {
+   if (!open_stream(file, NULL, 0)) {
       return 0;
    }
+
+   auto stream = (ResponseStream *)file->pextension;
+   stream->trace = new zuluide::trace::Export();
+   stream->headerLength = snprintf(stream->header, sizeof(stream->header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nCache-Control: no-store\r\n\r\n");
+
+   // The length is not known up front, the response ends with the export.
+   file->len = INT_MAX;
+   file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+   return 1;
 }
+#endif
 
 void fs_close_custom(struct fs_file *file) {
+   FinishRequest(file);
    if (file && file->pextension) {
-      mem_free(file->pextension);
+      auto stream = (ResponseStream *)file->pextension;
+      if (stream->poll.Release()) {
+         statusWaiters--;
+      }
+
+      if (stream->events) {
+         stream->events = false;
+         eventSubscribers--;
+      }
+
+#if ZULUIDE_TRACE
+      delete stream->trace;
+      stream->trace = NULL;
+#endif
+
+      delete[] stream->owned;
+      stream->inUse = false;
       file->pextension = NULL;
    }
 }
 
-int fs_read_custom(struct fs_file *file, char *buffer, int count) {
-   return FS_READ_EOF;
+u8_t fs_canread_custom(struct fs_file *file) {
+   return file->pextension == NULL || release_status(file);
+}
+
+u8_t fs_wait_read_custom(struct fs_file *file, fs_wait_cb callback_fn, void *callback_arg) {
+   auto stream = (ResponseStream *)file->pextension;
+   stream->resume = callback_fn;
+   stream->resumeArg = callback_arg;
+   return 1;
+}
+
+/**
+   Copies part of a catalog response, the whole catalog or a page of it
+   followed by the end of the object. Returns false if the records no longer
+   take the room they did when the response was opened.
+ */
+static bool copy_catalog(struct fs_file *file, char *buffer, int offset, int length) {
+   auto stream = (ResponseStream *)file->pextension;
+   int body = file->len - stream->headerLength;
+   size_t available;
+   if (!stream->page) {
+      const char *json = imageCatalog.Json(&available);
+      if ((int)available != body) {
+         return false;
+      }
+
+      memcpy(buffer, json + offset, length);
+      return true;
+   }
+
+   const char *records = imageCatalog.Range(stream->pageFirst, stream->pageCount, &available);
+   int rangeLength = body - 2;
+   if ((int)available != rangeLength) {
+      return false;
+   }
+
+   int part = LWIP_MAX(0, LWIP_MIN(length, rangeLength - offset));
+   if (part > 0) {
+      memcpy(buffer, records + offset, part);
+   }
+
+   if (part < length) {
+      memcpy(buffer + part, "]}" + (offset + part - rangeLength), length - part);
+   }
+
+   return true;
+}
+
+/**
+   Copies the next part of a response body into lwIP's send buffer, which is
+   limited to a couple of TCP segments per connection. A status response that
+   is waiting for a newer status, or an /events subscriber with nothing new to
+   send, is delayed until ServiceWebResponses resumes it.
+ */
+int fs_read_async_custom(struct fs_file *file, char *buffer, int count, fs_wait_cb callback_fn, void *callback_arg) {
+   auto stream = (ResponseStream *)file->pextension;
+   if (!release_status(file)) {
+      stream->resume = callback_fn;
+      stream->resumeArg = callback_arg;
+      return FS_READ_DELAYED;
+   }
+
+   if (stream->events && file->index >= stream->headerLength) {
+      int length = events.Read(&stream->cursor, buffer, count);
+      if (length < 0) {
+         eventsDropped++;
+         LOG_WARN("Dropping an event subscriber that fell behind, %lu dropped.\n", (unsigned long)eventsDropped);
+         return FS_READ_EOF;
+      }
+
+      if (length == 0) {
+         stream->resume = callback_fn;
+         stream->resumeArg = callback_arg;
+         return FS_READ_DELAYED;
+      }
+
+      file->index += length;
+      return length;
+   }
+
+#if ZULUIDE_TRACE
+   if (stream->trace && file->index >= stream->headerLength) {
+      int length = stream->trace->Read(buffer, count);
+      if (length == 0) {
+         return FS_READ_EOF;
+      }
+
+      file->index += length;
+      return length;
+   }
+#endif
+
+   if (file->index < stream->headerLength) {
+      int length = LWIP_MIN(count, stream->headerLength - file->index);
+      memcpy(buffer, stream->header + file->index, length);
+      file->index += length;
+      return length;
+   }
+
+   int length = LWIP_MIN(count, file->len - file->index);
+   int offset = file->index - stream->headerLength;
+   if (stream->catalog) {
+      // The catalog may have been rebuilt (and moved) since the response
+      // started, or be changed by the I2C core while it is copied.
+      bool copied;
+      uint32_t begun;
+      do {
+         begun = imageCatalog.ReadBegin();
+         copied = imageCatalog.Generation() == stream->generation && copy_catalog(file, buffer, offset, length);
+      } while (!imageCatalog.ReadValid(begun));
+
+      if (!copied) {
+         LOG_WARN("Image catalog changed while it was being sent.\n");
+         return FS_READ_EOF;
+      }
+   } else {
+      memcpy(buffer, stream->source + offset, length);
+   }
+
+   file->index += length;
+   return length;
 }